@@ -0,0 +1,313 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* Compares the two ways of deploying the mechanisms: split, as
+ * opensettings-datetime and opensettings-hostname, and combined, as
+ * opensettings-daemon. Each is started a number of times; a run times
+ * how long it takes from starting the processes to both names answering
+ * a call, then, once they have settled, adds up their resident and
+ * proportional set sizes. PSS counts a page shared by two processes
+ * half to each, so it's the fairer total for the split deployment. Run
+ * as root with neither name owned, since this owns them. */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+static gint runs = 5;
+static gint settle = 2;
+static gchar *bindir = NULL;
+
+static GOptionEntry entries[] = {
+	{ "runs", 'n', 0, G_OPTION_ARG_INT, &runs, "Start each deployment N times (default: 5)", "N" },
+	{ "settle", 's', 0, G_OPTION_ARG_INT, &settle, "Let the daemons settle for SEC seconds before measuring memory (default: 2)", "SEC" },
+	{ "bindir", 'B', 0, G_OPTION_ARG_FILENAME, &bindir, "Where the daemons are (default: search PATH)", "DIR" },
+	{ NULL }
+};
+
+typedef struct {
+	const gchar *label;
+	const gchar *programs[3];
+} Deployment;
+
+static const Deployment deployments[] = {
+	{ "split", { "opensettings-datetime", "opensettings-hostname", NULL } },
+	{ "combined", { "opensettings-daemon", NULL } },
+};
+
+typedef struct {
+	const gchar *name;
+	const gchar *path;
+	const gchar *interface;
+	const gchar *method;
+	const gchar *parameters;
+} Probe;
+
+/* A cheap call each, answered only once the name is owned and served */
+static const Probe probes[] = {
+	{ "org.opensettings.DateTimeMechanism", "/",
+	  "org.opensettings.DateTimeMechanism", "GetTimezone", "()" },
+	{ "org.freedesktop.hostname1", "/org/freedesktop/hostname1",
+	  "org.freedesktop.DBus.Properties", "Get", "('org.freedesktop.hostname1', 'Hostname')" },
+};
+
+/* Microseconds, KiB and KiB, all of a type for median () */
+typedef struct {
+	gint64 activation;
+	gint64 rss;
+	gint64 pss;
+} Sample;
+
+static gboolean
+probe (GDBusConnection *bus,
+       const Probe *p)
+{
+	GVariant *reply;
+
+	/* Without auto-start, so the bus doesn't start the installed
+	 * deployment instead of ours */
+	reply = g_dbus_connection_call_sync (bus, p->name, p->path, p->interface, p->method,
+					     g_variant_new_parsed (p->parameters),
+					     NULL, G_DBUS_CALL_FLAGS_NO_AUTO_START,
+					     -1, NULL, NULL);
+	if (reply == NULL)
+		return FALSE;
+	g_variant_unref (reply);
+
+	return TRUE;
+}
+
+static gboolean
+name_has_owner (GDBusConnection *bus,
+                const gchar *name)
+{
+	GVariant *reply;
+	gboolean ret = FALSE;
+
+	reply = g_dbus_connection_call_sync (bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+					     "org.freedesktop.DBus", "NameHasOwner",
+					     g_variant_new ("(s)", name), G_VARIANT_TYPE ("(b)"),
+					     G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+	if (reply != NULL) {
+		g_variant_get (reply, "(b)", &ret);
+		g_variant_unref (reply);
+	}
+
+	return ret;
+}
+
+static gboolean
+names_owned (GDBusConnection *bus,
+             gboolean owned)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (probes); i++)
+		if (name_has_owner (bus, probes[i].name) != owned)
+			return FALSE;
+
+	return TRUE;
+}
+
+/* Adds the Rss: and Pss: lines of /proc/PID/smaps_rollup, in KiB */
+static gboolean
+add_memory (const gchar *pid,
+            Sample *sample)
+{
+	gchar *path, *contents, **lines;
+	guint64 kib;
+	gint i;
+
+	path = g_strdup_printf ("/proc/%s/smaps_rollup", pid);
+	if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+		g_free (path);
+		return FALSE;
+	}
+	g_free (path);
+
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		if (sscanf (lines[i], "Rss: %" G_GUINT64_FORMAT, &kib) == 1)
+			sample->rss += kib;
+		else if (sscanf (lines[i], "Pss: %" G_GUINT64_FORMAT, &kib) == 1)
+			sample->pss += kib;
+	}
+	g_strfreev (lines);
+	g_free (contents);
+
+	return TRUE;
+}
+
+static gboolean
+run_once (GDBusConnection *bus,
+          const Deployment *deployment,
+          Sample *sample,
+          GError **error)
+{
+	GPtrArray *processes;
+	gint64 start, deadline;
+	gboolean ready = FALSE;
+	gboolean ret = FALSE;
+	guint i;
+
+	memset (sample, 0, sizeof (Sample));
+	processes = g_ptr_array_new_with_free_func (g_object_unref);
+
+	start = g_get_monotonic_time ();
+	for (i = 0; deployment->programs[i] != NULL; i++) {
+		GSubprocess *process;
+		gchar *program;
+
+		program = bindir != NULL ? g_build_filename (bindir, deployment->programs[i], NULL)
+					 : g_strdup (deployment->programs[i]);
+		process = g_subprocess_new (G_SUBPROCESS_FLAGS_NONE, error, program, NULL);
+		g_free (program);
+		if (process == NULL)
+			goto out;
+		g_ptr_array_add (processes, process);
+	}
+
+	deadline = start + 10 * G_USEC_PER_SEC;
+	for (i = 0; i < G_N_ELEMENTS (probes) && g_get_monotonic_time () < deadline; ) {
+		if (probe (bus, &probes[i]))
+			i++;
+		else
+			g_usleep (1000);
+	}
+	ready = i == G_N_ELEMENTS (probes);
+	sample->activation = g_get_monotonic_time () - start;
+	if (!ready) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+			     "%s did not answer within 10 seconds", probes[i].name);
+		goto out;
+	}
+
+	g_usleep (settle * G_USEC_PER_SEC);
+	for (i = 0; i < processes->len; i++) {
+		const gchar *pid = g_subprocess_get_identifier (g_ptr_array_index (processes, i));
+
+		if (pid == NULL || !add_memory (pid, sample)) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				     "%s exited, or its memory can't be read",
+				     deployment->programs[i]);
+			goto out;
+		}
+	}
+
+	ret = TRUE;
+
+out:
+	for (i = 0; i < processes->len; i++) {
+		GSubprocess *process = g_ptr_array_index (processes, i);
+
+		g_subprocess_send_signal (process, SIGTERM);
+		g_subprocess_wait (process, NULL, NULL);
+	}
+	g_ptr_array_unref (processes);
+
+	/* The names go with the connections, but the bus may take a moment */
+	deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+	while (!names_owned (bus, FALSE) && g_get_monotonic_time () < deadline)
+		g_usleep (1000);
+
+	return ret;
+}
+
+static gint
+compare_sample (gconstpointer a,
+                gconstpointer b)
+{
+	gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Median of a field of the samples */
+static gint64
+median (GArray *samples,
+        gsize offset)
+{
+	gint64 *values, ret;
+	guint i;
+
+	values = g_new (gint64, samples->len);
+	for (i = 0; i < samples->len; i++)
+		values[i] = G_STRUCT_MEMBER (gint64, &g_array_index (samples, Sample, i), offset);
+	qsort (values, samples->len, sizeof (gint64), compare_sample);
+	ret = values[samples->len / 2];
+	g_free (values);
+
+	return ret;
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	GOptionContext *option_context;
+	GDBusConnection *bus;
+	GError *err = NULL;
+	gint64 results[G_N_ELEMENTS (deployments)][3];
+	guint d;
+	gint i;
+
+	option_context = g_option_context_new ("- split vs. combined daemons");
+	g_option_context_add_main_entries (option_context, entries, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &err)) {
+		g_printerr ("%s\n", err->message);
+		return 1;
+	}
+	g_option_context_free (option_context);
+	runs = MAX (runs, 1);
+	settle = MAX (settle, 0);
+
+	bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &err);
+	if (bus == NULL) {
+		g_printerr ("Cannot connect: %s\n", err->message);
+		return 1;
+	}
+
+	if (!names_owned (bus, FALSE)) {
+		g_printerr ("Stop the running daemons first\n");
+		return 1;
+	}
+
+	g_print ("%d runs each, medians\n", runs);
+	g_print ("%-10s %16s %10s %10s\n", "", "activation (ms)", "RSS (KiB)", "PSS (KiB)");
+
+	for (d = 0; d < G_N_ELEMENTS (deployments); d++) {
+		GArray *samples;
+
+		samples = g_array_new (FALSE, FALSE, sizeof (Sample));
+		for (i = 0; i < runs; i++) {
+			Sample sample;
+
+			if (!run_once (bus, &deployments[d], &sample, &err)) {
+				g_printerr ("%s: %s\n", deployments[d].label, err->message);
+				return 1;
+			}
+			g_array_append_val (samples, sample);
+		}
+
+		results[d][0] = median (samples, G_STRUCT_OFFSET (Sample, activation));
+		results[d][1] = median (samples, G_STRUCT_OFFSET (Sample, rss));
+		results[d][2] = median (samples, G_STRUCT_OFFSET (Sample, pss));
+		g_array_unref (samples);
+
+		g_print ("%-10s %16.1f %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT "\n",
+			 deployments[d].label, results[d][0] / 1000.0, results[d][1], results[d][2]);
+	}
+
+	g_print ("%-10s %+15.0f%% %+9.0f%% %+9.0f%%\n", "combined",
+		 100.0 * (results[1][0] - results[0][0]) / MAX (results[0][0], 1),
+		 100.0 * (results[1][1] - results[0][1]) / MAX (results[0][1], 1),
+		 100.0 * (results[1][2] - results[0][2]) / MAX (results[0][2], 1));
+
+	g_object_unref (bus);
+
+	return 0;
+}
@@ -0,0 +1,277 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* Hammers org.freedesktop.hostname1 from an increasing number of client
+ * threads, each on its own bus connection, and reports the throughput
+ * reached at each step. Set* calls write back the values the daemon
+ * already has, so a run leaves the host configuration as it found it.
+ * Against a daemon built with --enable-alloc-count, also reports what
+ * each Set* call allocated in the daemon. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#define HOSTNAME1_NAME "org.freedesktop.hostname1"
+#define HOSTNAME1_PATH "/org/freedesktop/hostname1"
+#define HOSTNAME1_IFACE "org.freedesktop.hostname1"
+
+static gint max_threads = 0;
+static gint seconds = 3;
+static gchar *mode = NULL;
+static gchar *address = NULL;
+
+static GOptionEntry entries[] = {
+	{ "threads", 't', 0, G_OPTION_ARG_INT, &max_threads, "Scale up to N client threads (default: number of CPUs)", "N" },
+	{ "seconds", 's', 0, G_OPTION_ARG_INT, &seconds, "Run each step for SEC seconds", "SEC" },
+	{ "mode", 'm', 0, G_OPTION_ARG_STRING, &mode, "get, set or mixed (default: mixed)", "MODE" },
+	{ "address", 'a', 0, G_OPTION_ARG_STRING, &address, "Connect to ADDRESS instead of the system bus", "ADDRESS" },
+	{ NULL }
+};
+
+static gchar *static_hostname = NULL;
+static gchar *pretty_hostname = NULL;
+static gchar *icon_name = NULL;
+
+/* Outside the workers, for the daemon's statistics */
+static GDBusConnection *stats_connection = NULL;
+
+struct worker {
+	GThread *thread;
+	GDBusConnection *connection;
+	gint64 deadline;
+	guint64 calls;
+	guint64 errors;
+};
+
+static GDBusConnection *
+open_connection (GError **error)
+{
+	gchar *bus_address;
+	GDBusConnection *connection;
+
+	if (address != NULL)
+		return g_dbus_connection_new_for_address_sync (address,
+							       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+							       NULL, NULL, error);
+
+	bus_address = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SYSTEM, NULL, error);
+	if (bus_address == NULL)
+		return NULL;
+
+	/* A private connection per thread, so the client side doesn't
+	 * serialize on a shared one */
+	connection = g_dbus_connection_new_for_address_sync (bus_address,
+							     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+							     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+							     NULL, NULL, error);
+	g_free (bus_address);
+
+	return connection;
+}
+
+static GVariant *
+call (GDBusConnection *connection,
+      const gchar *interface,
+      const gchar *method,
+      GVariant *parameters,
+      GError **error)
+{
+	return g_dbus_connection_call_sync (connection,
+					    address != NULL ? NULL : HOSTNAME1_NAME,
+					    HOSTNAME1_PATH,
+					    interface,
+					    method,
+					    parameters,
+					    NULL,
+					    G_DBUS_CALL_FLAGS_NONE,
+					    -1, NULL, error);
+}
+
+static gchar *
+get_property (GDBusConnection *connection,
+              const gchar *property)
+{
+	GVariant *reply, *value;
+	gchar *ret = NULL;
+
+	reply = call (connection, "org.freedesktop.DBus.Properties", "Get",
+		      g_variant_new ("(ss)", HOSTNAME1_IFACE, property), NULL);
+	if (reply == NULL)
+		return g_strdup ("");
+
+	g_variant_get (reply, "(v)", &value);
+	ret = g_variant_dup_string (value, NULL);
+	g_variant_unref (value);
+	g_variant_unref (reply);
+
+	return ret;
+}
+
+/* FALSE when the daemon doesn't count its allocations */
+static gboolean
+get_set_allocations (guint64 *requests,
+                     guint64 *allocations)
+{
+	GVariant *reply, *stats;
+	gboolean ret;
+
+	reply = call (stats_connection, HOSTNAME1_IFACE, "GetStatistics", NULL, NULL);
+	if (reply == NULL)
+		return FALSE;
+
+	stats = g_variant_get_child_value (reply, 0);
+	ret = g_variant_lookup (stats, "SetRequests", "t", requests) &&
+	      g_variant_lookup (stats, "SetAllocations", "t", allocations);
+	g_variant_unref (stats);
+	g_variant_unref (reply);
+
+	return ret;
+}
+
+static gboolean
+one_call (GDBusConnection *connection,
+          guint64 n)
+{
+	GVariant *reply;
+	const gchar *method = NULL;
+	const gchar *value = NULL;
+
+	if (g_strcmp0 (mode, "get") == 0 ||
+	    (g_strcmp0 (mode, "mixed") == 0 && n % 2 == 0)) {
+		reply = call (connection, "org.freedesktop.DBus.Properties", "GetAll",
+			      g_variant_new ("(s)", HOSTNAME1_IFACE), NULL);
+	} else {
+		/* Alternate between keys that live behind different locks */
+		switch ((n / 2) % 3) {
+			case 0:
+				method = "SetStaticHostname";
+				value = static_hostname;
+				break;
+			case 1:
+				method = "SetPrettyHostname";
+				value = pretty_hostname;
+				break;
+			default:
+				method = "SetIconName";
+				value = icon_name;
+				break;
+		}
+		reply = call (connection, HOSTNAME1_IFACE, method,
+			      g_variant_new ("(sb)", value, FALSE), NULL);
+	}
+
+	if (reply == NULL)
+		return FALSE;
+
+	g_variant_unref (reply);
+	return TRUE;
+}
+
+static gpointer
+worker_func (gpointer data)
+{
+	struct worker *worker = (struct worker *) data;
+
+	while (g_get_monotonic_time () < worker->deadline) {
+		if (one_call (worker->connection, worker->calls + worker->errors))
+			worker->calls++;
+		else
+			worker->errors++;
+	}
+
+	return NULL;
+}
+
+static void
+run_step (gint n_threads)
+{
+	struct worker *workers;
+	guint64 calls = 0, errors = 0;
+	guint64 requests_before, allocations_before, requests_after, allocations_after;
+	gboolean counted;
+	gint64 start, deadline;
+	gint i;
+
+	workers = g_new0 (struct worker, n_threads);
+	for (i = 0; i < n_threads; i++) {
+		GError *err = NULL;
+
+		workers[i].connection = open_connection (&err);
+		if (workers[i].connection == NULL) {
+			g_printerr ("Cannot connect: %s\n", err->message);
+			exit (1);
+		}
+	}
+
+	counted = get_set_allocations (&requests_before, &allocations_before);
+
+	start = g_get_monotonic_time ();
+	deadline = start + (gint64) seconds * G_USEC_PER_SEC;
+	for (i = 0; i < n_threads; i++) {
+		workers[i].deadline = deadline;
+		workers[i].thread = g_thread_new ("stress", worker_func, &workers[i]);
+	}
+
+	for (i = 0; i < n_threads; i++) {
+		g_thread_join (workers[i].thread);
+		calls += workers[i].calls;
+		errors += workers[i].errors;
+		g_object_unref (workers[i].connection);
+	}
+
+	g_print ("%3d threads: %10.1f calls/s  (%" G_GUINT64_FORMAT " calls, %" G_GUINT64_FORMAT " errors)\n",
+		 n_threads,
+		 calls * (gdouble) G_USEC_PER_SEC / (g_get_monotonic_time () - start),
+		 calls, errors);
+
+	if (counted && get_set_allocations (&requests_after, &allocations_after) &&
+	    requests_after > requests_before)
+		g_print ("             %10.1f mallocs per set request\n",
+			 (gdouble) (allocations_after - allocations_before) / (requests_after - requests_before));
+
+	g_free (workers);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	GOptionContext *option_context;
+	GError *err = NULL;
+	gint n;
+
+	option_context = g_option_context_new ("- hostname1 throughput benchmark");
+	g_option_context_add_main_entries (option_context, entries, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &err)) {
+		g_printerr ("%s\n", err->message);
+		return 1;
+	}
+	g_option_context_free (option_context);
+
+	if (mode == NULL)
+		mode = g_strdup ("mixed");
+	if (max_threads <= 0)
+		max_threads = g_get_num_processors ();
+
+	stats_connection = open_connection (&err);
+	if (stats_connection == NULL) {
+		g_printerr ("Cannot connect: %s\n", err->message);
+		return 1;
+	}
+	static_hostname = get_property (stats_connection, "StaticHostname");
+	pretty_hostname = get_property (stats_connection, "PrettyHostname");
+	icon_name = get_property (stats_connection, "IconName");
+
+	g_print ("mode %s, %d s per step\n", mode, seconds);
+	for (n = 1; n < max_threads; n *= 2)
+		run_step (n);
+	run_step (max_threads);
+
+	g_object_unref (stats_connection);
+
+	return 0;
+}
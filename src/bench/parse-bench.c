@@ -0,0 +1,546 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* Times the parsers of the shared library on realistic and pathological
+ * inputs and reports ns/op and allocations/op for each case. With --gate,
+ * fails when a case got slower than a saved baseline by more than the
+ * tolerance, or allocates more. --fuzz also runs every parser over
+ * mutated inputs and checks what they return. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "alloc-count.h"
+#include "parsers.h"
+
+#define ZONEINFODIR "/usr/share/zoneinfo"
+
+static gint time_ms = 200;
+static gchar *gate = NULL;
+static gchar *save = NULL;
+static gdouble tolerance = 25.0;
+static gint fuzz = 0;
+static gint seed = 1;
+static gchar *filter = NULL;
+
+static GOptionEntry entries[] = {
+	{ "time", 't', 0, G_OPTION_ARG_INT, &time_ms, "Run each case for MSEC milliseconds", "MSEC" },
+	{ "gate", 'g', 0, G_OPTION_ARG_FILENAME, &gate, "Fail on a regression against the baseline in FILE", "FILE" },
+	{ "save", 's', 0, G_OPTION_ARG_FILENAME, &save, "Save the results to FILE, as a baseline", "FILE" },
+	{ "tolerance", 'T', 0, G_OPTION_ARG_DOUBLE, &tolerance, "Let ns/op grow by PCT percent before failing the gate (default: 25)", "PCT" },
+	{ "fuzz", 'f', 0, G_OPTION_ARG_INT, &fuzz, "Run N mutated inputs through every parser", "N" },
+	{ "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Seed the mutations with N", "N" },
+	{ "filter", 'F', 0, G_OPTION_ARG_STRING, &filter, "Only run cases whose name contains STRING", "STRING" },
+	{ NULL }
+};
+
+typedef void (*CaseFunc) (gconstpointer input);
+
+typedef struct {
+	const gchar *name;
+	CaseFunc func;
+	gchar *input;
+	gdouble ns_per_op;
+	gdouble allocs_per_op;
+} Case;
+
+static void
+run_key_file_value (gconstpointer input)
+{
+	g_free (parse_key_file_value (input, "hostname"));
+}
+
+static void
+run_env_file (gconstpointer input)
+{
+	g_hash_table_unref (parse_env_file (input));
+}
+
+static void
+run_zoneinfo_path (gconstpointer input)
+{
+	g_free (parse_zoneinfo_path (input, ZONEINFODIR));
+}
+
+static void
+run_tz_name_is_valid (gconstpointer input)
+{
+	parse_tz_name_is_valid (input);
+}
+
+static void
+run_adjtime (gconstpointer input)
+{
+	ParsedAdjtime adjtime;
+	GError *error = NULL;
+
+	parse_adjtime (input, &adjtime, &error);
+	g_clear_error (&error);
+}
+
+/* TZif data is binary, so those inputs start with their length */
+static void
+run_tzif (gconstpointer input)
+{
+	const gsize *length = input;
+	ParsedTzifOffset offset;
+	GError *error = NULL;
+
+	parse_tzif ((const guchar *) (length + 1), *length, 1571234567, &offset, &error);
+	g_clear_error (&error);
+}
+
+static void
+append_be32 (GByteArray *a,
+             guint32 value)
+{
+	value = GUINT32_TO_BE (value);
+	g_byte_array_append (a, (const guint8 *) &value, 4);
+}
+
+static void
+append_tzif_header (GByteArray *a,
+                    guint timecnt,
+                    guint typecnt,
+                    guint charcnt)
+{
+	static const guint8 zeros[15] = { 0 };
+
+	g_byte_array_append (a, (const guint8 *) "TZif2", 5);
+	g_byte_array_append (a, zeros, sizeof (zeros));
+	append_be32 (a, 0);
+	append_be32 (a, 0);
+	append_be32 (a, 0);
+	append_be32 (a, timecnt);
+	append_be32 (a, typecnt);
+	append_be32 (a, charcnt);
+}
+
+/* A version 2 file for a CET/CEST zone with transitions every half year
+ * from 1980, and the rule for the years after */
+static gchar *
+make_tzif (guint n_transitions,
+           const gchar *footer,
+           gsize *data_length)
+{
+	GByteArray *a;
+	gsize length;
+	guint i;
+
+	a = g_byte_array_new ();
+	g_byte_array_append (a, (const guint8 *) &length, sizeof (length));
+
+	/* Version 1 data, only there for old readers */
+	append_tzif_header (a, 0, 1, 4);
+	append_be32 (a, 0);
+	g_byte_array_append (a, (const guint8 *) "\0\0UTC\0", 6);
+
+	append_tzif_header (a, n_transitions, 2, 9);
+	for (i = 0; i < n_transitions; i++) {
+		guint64 t = GUINT64_TO_BE (315532800 + (guint64) i * 15778800);
+		g_byte_array_append (a, (const guint8 *) &t, 8);
+	}
+	for (i = 0; i < n_transitions; i++) {
+		guint8 type = i % 2 == 0 ? 1 : 0;
+		g_byte_array_append (a, &type, 1);
+	}
+	append_be32 (a, 3600);
+	g_byte_array_append (a, (const guint8 *) "\0\0", 2);
+	append_be32 (a, 7200);
+	g_byte_array_append (a, (const guint8 *) "\1\4", 2);
+	g_byte_array_append (a, (const guint8 *) "CET\0CEST\0", 9);
+
+	g_byte_array_append (a, (const guint8 *) "\n", 1);
+	g_byte_array_append (a, (const guint8 *) footer, strlen (footer));
+	g_byte_array_append (a, (const guint8 *) "\n", 1);
+
+	length = a->len - sizeof (length);
+	memcpy (a->data, &length, sizeof (length));
+	if (data_length != NULL)
+		*data_length = length;
+
+	return (gchar *) g_byte_array_free (a, FALSE);
+}
+
+static gchar *
+make_rc_conf (guint n_lines)
+{
+	GString *s;
+	guint i;
+
+	s = g_string_new ("# /etc/rc.conf\n\n");
+	for (i = 0; i < n_lines; i++)
+		g_string_append_printf (s, "option_%u=\"value %u\"\n", i, i);
+	g_string_append (s, "hostname=\"ataraxia\"\ntimezone=Europe/Paris\n");
+
+	return g_string_free (s, FALSE);
+}
+
+static gchar *
+make_long_quoted (gsize len)
+{
+	GString *s;
+
+	s = g_string_new ("hostname=\"");
+	while (s->len < len)
+		g_string_append (s, "a very long value ");
+	g_string_append (s, "\"\n");
+
+	return g_string_free (s, FALSE);
+}
+
+static gchar *
+make_repeated (const gchar *line,
+               guint n)
+{
+	GString *s;
+	guint i;
+
+	s = g_string_new (NULL);
+	for (i = 0; i < n; i++)
+		g_string_append (s, line);
+
+	return g_string_free (s, FALSE);
+}
+
+static Case cases[] = {
+	{ "key-file-value/rc.conf", run_key_file_value },
+	{ "key-file-value/rc.conf-100k", run_key_file_value },
+	{ "key-file-value/long-quoted", run_key_file_value },
+	{ "key-file-value/unterminated-quotes", run_key_file_value },
+	{ "key-file-value/blanks", run_key_file_value },
+	{ "env-file/machine-info", run_env_file },
+	{ "env-file/100k", run_env_file },
+	{ "zoneinfo-path/posix", run_zoneinfo_path },
+	{ "zoneinfo-path/outside", run_zoneinfo_path },
+	{ "tz-name-is-valid/zone", run_tz_name_is_valid },
+	{ "tz-name-is-valid/4k", run_tz_name_is_valid },
+	{ "adjtime/utc", run_adjtime },
+	{ "adjtime/garbage", run_adjtime },
+	{ "tzif/rule", run_tzif },
+	{ "tzif/1k-transitions", run_tzif },
+};
+
+static void
+make_inputs (void)
+{
+	GString *s;
+	guint i;
+
+	cases[0].input = make_rc_conf (30);
+	cases[1].input = make_rc_conf (100000);
+	cases[2].input = make_long_quoted (64 * 1024);
+	cases[3].input = make_repeated ("hostname=\"no closing quote\n", 10000);
+	cases[4].input = make_repeated ("hostname=      \t     \n", 10000);
+	cases[5].input = g_strdup ("PRETTY_HOSTNAME=\"Ataraxia's laptop\"\n"
+				   "ICON_NAME=computer-laptop\n"
+				   "CHASSIS=laptop\n"
+				   "DEPLOYMENT=production\n"
+				   "LOCATION=\"Desk 42\"\n");
+	s = g_string_new (NULL);
+	for (i = 0; i < 100000; i++)
+		g_string_append_printf (s, "KEY_%u=\"value %u\"\n", i, i);
+	cases[6].input = g_string_free (s, FALSE);
+	cases[7].input = g_strdup (ZONEINFODIR "/posix/America/Argentina/Buenos_Aires");
+	cases[8].input = g_strdup ("/etc/localtime");
+	cases[9].input = g_strdup ("America/Argentina/Buenos_Aires");
+	cases[10].input = g_strnfill (4096, 'a');
+	cases[11].input = g_strdup ("0.000000 1571234567 0.000000\n1571234567\nUTC\n");
+	cases[12].input = make_repeated ("\xff\x01 not adjtime at all ", 1000);
+	/* As zic -b slim writes them, and as it did before that */
+	cases[13].input = make_tzif (0, "CET-1CEST,M3.5.0,M10.5.0/3", NULL);
+	cases[14].input = make_tzif (1000, "CET-1CEST,M3.5.0,M10.5.0/3", NULL);
+}
+
+static void
+measure (Case *c)
+{
+	guint64 iterations, i, allocs;
+	gint64 start, elapsed;
+
+	/* Warm up, then count what one call allocates */
+	c->func (c->input);
+	allocs = alloc_count_get ();
+	c->func (c->input);
+	c->allocs_per_op = alloc_count_get () - allocs;
+
+	/* Double the batch until it takes long enough */
+	for (iterations = 1; ; iterations *= 2) {
+		start = g_get_monotonic_time ();
+		for (i = 0; i < iterations; i++)
+			c->func (c->input);
+		elapsed = g_get_monotonic_time () - start;
+		if (elapsed >= time_ms * 1000 || iterations >= G_MAXUINT64 / 2)
+			break;
+	}
+
+	c->ns_per_op = elapsed * 1000.0 / iterations;
+}
+
+/* "name ns/op allocs/op" lines */
+static GHashTable *
+load_baseline (const gchar *filename)
+{
+	GHashTable *baseline;
+	gchar *contents;
+	gchar **lines;
+	guint i;
+
+	if (!g_file_get_contents (filename, &contents, NULL, NULL)) {
+		g_printerr ("Cannot read %s\n", filename);
+		exit (2);
+	}
+
+	baseline = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		gchar name[256];
+		gdouble *values;
+
+		values = g_new0 (gdouble, 2);
+		if (sscanf (lines[i], "%255s %lf %lf", name, &values[0], &values[1]) == 3)
+			g_hash_table_replace (baseline, g_strdup (name), values);
+		else
+			g_free (values);
+	}
+	g_strfreev (lines);
+	g_free (contents);
+
+	return baseline;
+}
+
+static gint
+check_gate (GHashTable *baseline)
+{
+	gint failed = 0;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+		gdouble *base;
+
+		if (cases[i].input == NULL)
+			continue;
+		base = g_hash_table_lookup (baseline, cases[i].name);
+		if (base == NULL)
+			continue;
+
+		if (cases[i].ns_per_op > base[0] * (1.0 + tolerance / 100.0)) {
+			g_print ("REGRESSION %s: %.1f ns/op, baseline %.1f\n", cases[i].name, cases[i].ns_per_op, base[0]);
+			failed++;
+		}
+		if (ALLOC_COUNT_SUPPORTED && cases[i].allocs_per_op > base[1]) {
+			g_print ("REGRESSION %s: %.0f allocs/op, baseline %.0f\n", cases[i].name, cases[i].allocs_per_op, base[1]);
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+static void
+save_results (const gchar *filename)
+{
+	GString *s;
+	GError *error = NULL;
+	guint i;
+
+	s = g_string_new (NULL);
+	for (i = 0; i < G_N_ELEMENTS (cases); i++)
+		if (cases[i].input != NULL)
+			g_string_append_printf (s, "%s %.1f %.0f\n", cases[i].name, cases[i].ns_per_op, cases[i].allocs_per_op);
+
+	if (!g_file_set_contents (filename, s->str, s->len, &error)) {
+		g_printerr ("%s\n", error->message);
+		exit (2);
+	}
+	g_string_free (s, TRUE);
+}
+
+/* Flip, drop, duplicate and insert bytes, with a bias towards the bytes
+ * the parsers care about */
+static gchar *
+mutate (GRand *rand,
+        const gchar *input)
+{
+	static const gchar special[] = "=\"\n\t /#";
+	GString *s;
+	gint n, i;
+
+	s = g_string_new (input);
+	n = g_rand_int_range (rand, 1, 8);
+	for (i = 0; i < n && s->len > 0; i++) {
+		gsize pos = g_rand_int_range (rand, 0, s->len);
+		gchar c = g_rand_boolean (rand) ?
+			special[g_rand_int_range (rand, 0, sizeof (special) - 1)] :
+			(gchar) g_rand_int_range (rand, 1, 256);
+
+		switch (g_rand_int_range (rand, 0, 4)) {
+			case 0:
+				s->str[pos] = c;
+				break;
+			case 1:
+				g_string_erase (s, pos, 1);
+				break;
+			case 2:
+				g_string_insert_len (s, pos, s->str + pos, MIN (s->len - pos, 64));
+				break;
+			default:
+				g_string_insert_c (s, pos, c);
+				break;
+		}
+	}
+
+	return g_string_free (s, FALSE);
+}
+
+static void
+check_value (const gchar *input,
+             const gchar *value)
+{
+	gsize len;
+
+	if (value == NULL)
+		return;
+
+	len = strlen (value);
+	if (strchr (value, '\n') != NULL ||
+	    (len > 0 && (g_ascii_isspace (value[0]) || g_ascii_isspace (value[len - 1])))) {
+		g_printerr ("Bad value '%s' parsed from:\n%s\n", value, input);
+		exit (3);
+	}
+}
+
+static void
+run_fuzz (void)
+{
+	static const gchar *corpus[] = {
+		"hostname=\"ataraxia\"\n",
+		"hostname=plain\nhostname=\"quoted\"\n",
+		"  hostname = \"x\"\n",
+		"A=1\nB=\"2\"\n=3\nC\n",
+		ZONEINFODIR "/right/Europe/Paris",
+		"Europe/Paris",
+		"0.5 1571234567 0.0\n1571234567\nLOCAL\n",
+		"0\n0\nUTC",
+	};
+	GRand *rand;
+	gchar *tzif;
+	gsize tzif_length;
+	gint i;
+
+	tzif = make_tzif (8, "<+0330>-3:30<+0430>,J79/24,J263/24", &tzif_length);
+
+	rand = g_rand_new_with_seed (seed);
+	for (i = 0; i < fuzz; i++) {
+		gchar *input, *value;
+		GHashTable *values;
+		GHashTableIter iter;
+		gpointer key;
+		ParsedAdjtime adjtime;
+		ParsedTzifOffset offset;
+		GByteArray *bytes;
+		gint64 at;
+		gint j;
+
+		input = mutate (rand, corpus[g_rand_int_range (rand, 0, G_N_ELEMENTS (corpus))]);
+
+		value = parse_key_file_value (input, "hostname");
+		check_value (input, value);
+		g_free (value);
+
+		values = parse_env_file (input);
+		g_hash_table_iter_init (&iter, values);
+		while (g_hash_table_iter_next (&iter, &key, (gpointer *) &value)) {
+			if (*(gchar *) key == '\0' || strchr (key, '\n') != NULL) {
+				g_printerr ("Bad key '%s' parsed from:\n%s\n", (gchar *) key, input);
+				exit (3);
+			}
+			check_value (input, value);
+		}
+		g_hash_table_unref (values);
+
+		value = parse_zoneinfo_path (input, ZONEINFODIR);
+		g_free (value);
+		parse_tz_name_is_valid (input);
+		parse_adjtime (input, &adjtime, NULL);
+
+		g_free (input);
+
+		/* Bytes anywhere, with the footer as a string among them */
+		bytes = g_byte_array_new ();
+		g_byte_array_append (bytes, (const guint8 *) tzif + sizeof (gsize), tzif_length);
+		for (j = g_rand_int_range (rand, 1, 8); j > 0; j--) {
+			guint pos = g_rand_int_range (rand, 0, bytes->len);
+
+			if (g_rand_boolean (rand))
+				bytes->data[pos] = g_rand_int_range (rand, 0, 256);
+			else
+				g_byte_array_remove_index (bytes, pos);
+		}
+		at = (gint64) g_rand_int (rand) - G_MAXINT32;
+		if (parse_tzif (bytes->data, bytes->len, at, &offset, NULL) &&
+		    offset.next != PARSE_TZIF_NEVER && offset.next <= at) {
+			g_printerr ("Transition at %" G_GINT64_FORMAT " found after %" G_GINT64_FORMAT "\n",
+				    offset.next, at);
+			exit (3);
+		}
+		g_byte_array_unref (bytes);
+	}
+	g_rand_free (rand);
+	g_free (tzif);
+
+	g_print ("fuzz: %d inputs, seed %d, ok\n", fuzz, seed);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	GOptionContext *option_context;
+	GError *err = NULL;
+	gint failed = 0;
+	guint i;
+
+	option_context = g_option_context_new ("- parser microbenchmarks");
+	g_option_context_add_main_entries (option_context, entries, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &err)) {
+		g_printerr ("%s\n", err->message);
+		return 2;
+	}
+	g_option_context_free (option_context);
+
+	make_inputs ();
+
+	g_print ("%-40s %14s %10s\n", "case", "ns/op", "allocs/op");
+	for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+		if (filter != NULL && strstr (cases[i].name, filter) == NULL) {
+			g_clear_pointer (&cases[i].input, g_free);
+			continue;
+		}
+
+		measure (&cases[i]);
+		if (ALLOC_COUNT_SUPPORTED)
+			g_print ("%-40s %14.1f %10.0f\n", cases[i].name, cases[i].ns_per_op, cases[i].allocs_per_op);
+		else
+			g_print ("%-40s %14.1f %10s\n", cases[i].name, cases[i].ns_per_op, "-");
+	}
+
+	if (fuzz > 0)
+		run_fuzz ();
+
+	if (save != NULL)
+		save_results (save);
+
+	if (gate != NULL) {
+		GHashTable *baseline = load_baseline (gate);
+
+		failed = check_gate (baseline);
+		g_hash_table_unref (baseline);
+		g_print ("gate: %s\n", failed ? "FAILED" : "passed");
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* Compares the round-trip latency of cheap calls through the system bus
+ * and over the peer-to-peer sockets the daemons listen on with
+ * --p2p-socket. Calls are made one at a time, so the numbers are
+ * latencies, not throughput. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+static gint count = 10000;
+static gchar *hostname_socket = NULL;
+static gchar *datetime_socket = NULL;
+
+static GOptionEntry entries[] = {
+	{ "count", 'n', 0, G_OPTION_ARG_INT, &count, "Make N calls each way (default: 10000)", "N" },
+	{ "hostname-socket", 'H', 0, G_OPTION_ARG_FILENAME, &hostname_socket, "opensettings-hostname's peer-to-peer socket", "PATH" },
+	{ "datetime-socket", 'D', 0, G_OPTION_ARG_FILENAME, &datetime_socket, "opensettings-datetime's peer-to-peer socket", "PATH" },
+	{ NULL }
+};
+
+typedef struct {
+	const gchar *label;
+	const gchar *name;
+	const gchar *path;
+	const gchar *interface;
+	const gchar *method;
+	GVariant *parameters;
+} Call;
+
+static gint
+compare_latency (gconstpointer a,
+                 gconstpointer b)
+{
+	gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Returns the median, for the comparison */
+static gint64
+measure (GDBusConnection *connection,
+         const Call *call,
+         gboolean p2p)
+{
+	GArray *latencies;
+	gint64 *l, sum = 0, median;
+	gint i;
+
+	latencies = g_array_sized_new (FALSE, FALSE, sizeof (gint64), count);
+
+	/* The first calls warm up caches on both ends */
+	for (i = -100; i < count; i++) {
+		GVariant *reply;
+		GError *err = NULL;
+		gint64 start, usec;
+
+		start = g_get_monotonic_time ();
+		reply = g_dbus_connection_call_sync (connection,
+						     p2p ? NULL : call->name,
+						     call->path,
+						     call->interface,
+						     call->method,
+						     call->parameters,
+						     NULL,
+						     G_DBUS_CALL_FLAGS_NONE,
+						     -1, NULL, &err);
+		usec = g_get_monotonic_time () - start;
+		if (reply == NULL) {
+			g_printerr ("%s: %s\n", call->label, err->message);
+			exit (1);
+		}
+		g_variant_unref (reply);
+
+		if (i >= 0) {
+			g_array_append_val (latencies, usec);
+			sum += usec;
+		}
+	}
+
+	g_array_sort (latencies, compare_latency);
+	l = (gint64 *) latencies->data;
+	median = l[count / 2];
+
+	g_print ("%-9s %-4s  mean %6.1f  p50 %5" G_GINT64_FORMAT "  p99 %5" G_GINT64_FORMAT "  max %6" G_GINT64_FORMAT " usec\n",
+		 call->label, p2p ? "p2p" : "bus", sum / (gdouble) count,
+		 median, l[MIN (count - 1, (gint) (count * 0.99))], l[count - 1]);
+
+	g_array_unref (latencies);
+
+	return median;
+}
+
+static void
+compare (GDBusConnection *bus,
+         const Call *call,
+         const gchar *socket_path)
+{
+	GDBusConnection *peer;
+	gchar *address;
+	GError *err = NULL;
+	gint64 via_bus, via_peer;
+
+	via_bus = measure (bus, call, FALSE);
+
+	if (socket_path == NULL)
+		return;
+
+	address = g_strdup_printf ("unix:path=%s", socket_path);
+	peer = g_dbus_connection_new_for_address_sync (address,
+						       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+						       NULL, NULL, &err);
+	g_free (address);
+	if (peer == NULL) {
+		g_printerr ("Cannot connect to %s: %s\n", socket_path, err->message);
+		exit (1);
+	}
+
+	via_peer = measure (peer, call, TRUE);
+	g_print ("%-9s p2p median is %.2fx the bus one\n", call->label,
+		 via_peer / (gdouble) MAX (via_bus, 1));
+
+	g_object_unref (peer);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	GOptionContext *option_context;
+	GDBusConnection *bus;
+	GError *err = NULL;
+	Call hostname = {
+		"hostname", "org.freedesktop.hostname1", "/org/freedesktop/hostname1",
+		"org.freedesktop.DBus.Properties", "Get", NULL
+	};
+	Call datetime = {
+		"datetime", "org.opensettings.DateTimeMechanism", "/",
+		"org.opensettings.DateTimeMechanism", "GetTimezone", NULL
+	};
+
+	option_context = g_option_context_new ("- bus vs. peer-to-peer latency");
+	g_option_context_add_main_entries (option_context, entries, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &err)) {
+		g_printerr ("%s\n", err->message);
+		return 1;
+	}
+	g_option_context_free (option_context);
+	count = MAX (count, 1);
+
+	bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &err);
+	if (bus == NULL) {
+		g_printerr ("Cannot connect: %s\n", err->message);
+		return 1;
+	}
+
+	hostname.parameters = g_variant_ref_sink (g_variant_new ("(ss)", "org.freedesktop.hostname1", "Hostname"));
+	datetime.parameters = g_variant_ref_sink (g_variant_new ("()"));
+
+	g_print ("%d calls each\n", count);
+	compare (bus, &hostname, hostname_socket);
+	compare (bus, &datetime, datetime_socket);
+
+	g_variant_unref (hostname.parameters);
+	g_variant_unref (datetime.parameters);
+	g_object_unref (bus);
+
+	return 0;
+}
@@ -0,0 +1,447 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* Calls the datetime and hostname mechanisms in batches. Operations come
+ * from the arguments, one per argument, or from stdin, one per line:
+ *
+ *   datetime SetTimezone Europe/Paris
+ *   datetime Apply "{'UsingNtp': <true>}"
+ *   hostname SetPrettyHostname "Desk 42" false
+ *   hostname get StaticHostname
+ *
+ * They are all sent over one connection without waiting for replies, up
+ * to --concurrency at once, and a line is printed for each, in order:
+ *
+ *   number  service.Method  ok|error  usec  reply|error-name: message
+ *
+ * with tabs between the fields. --repeat runs the whole list again, which
+ * with -q and -s makes a load generator. Exits with 1 if a call failed,
+ * 2 if an operation can't be parsed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+static gint repeat = 1;
+static gint concurrency = 64;
+static gint timeout_ms = -1;
+static gboolean quiet = FALSE;
+static gboolean summary = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "repeat", 'n', 0, G_OPTION_ARG_INT, &repeat, "Run the operations N times", "N" },
+	{ "concurrency", 'c', 0, G_OPTION_ARG_INT, &concurrency, "Keep up to N calls in flight (default: 64)", "N" },
+	{ "timeout", 't', 0, G_OPTION_ARG_INT, &timeout_ms, "Fail calls without a reply after MSEC milliseconds", "MSEC" },
+	{ "quiet", 'q', 0, G_OPTION_ARG_NONE, &quiet, "Don't print a line per call", NULL },
+	{ "summary", 's', 0, G_OPTION_ARG_NONE, &summary, "Print throughput and latencies on stderr", NULL },
+	{ NULL }
+};
+
+typedef struct {
+	const gchar *service;
+	const gchar *name;
+	const gchar *path;
+	const gchar *interface;
+} Service;
+
+static const Service services[] = {
+	{ "datetime", "org.opensettings.DateTimeMechanism", "/", "org.opensettings.DateTimeMechanism" },
+	{ "hostname", "org.freedesktop.hostname1", "/org/freedesktop/hostname1", "org.freedesktop.hostname1" },
+};
+
+/* Argument types of the methods, and two for properties, which take the
+ * interface name first */
+typedef struct {
+	const gchar *service;
+	const gchar *method;
+	const gchar *signature;
+} Method;
+
+static const Method methods[] = {
+	{ "datetime", "SetTimezone", "(s)" },
+	{ "datetime", "SetTimezoneForRoots", "(sas)" },
+	{ "datetime", "GetTimezone", "()" },
+	{ "datetime", "CanSetTimezone", "()" },
+	{ "datetime", "SetDate", "(uuu)" },
+	{ "datetime", "SetTime", "(x)" },
+	{ "datetime", "CanSetTime", "()" },
+	{ "datetime", "AdjustTime", "(x)" },
+	{ "datetime", "GetHardwareClockUsingUtc", "()" },
+	{ "datetime", "SetHardwareClockUsingUtc", "(b)" },
+	{ "datetime", "GetUsingNtp", "()" },
+	{ "datetime", "SetUsingNtp", "(b)" },
+	{ "datetime", "CanSetUsingNtp", "()" },
+	{ "datetime", "Apply", "(a{sv})" },
+	{ "datetime", "GetStatistics", "()" },
+	{ "hostname", "SetHostname", "(sb)" },
+	{ "hostname", "SetStaticHostname", "(sb)" },
+	{ "hostname", "SetPrettyHostname", "(sb)" },
+	{ "hostname", "SetIconName", "(sb)" },
+	{ "hostname", "GetStatistics", "()" },
+	{ "hostname", "Describe", "()" },
+	{ "hostname", "RegisterContainer", "(sub)" },
+	{ "hostname", "UnregisterContainer", "(sb)" },
+	{ NULL, "get", "(s)" },
+	{ NULL, "get-all", "()" },
+};
+
+typedef struct {
+	const Service *service;
+	const gchar *interface;
+	const gchar *method;
+	gchar *label;
+	GVariant *parameters;
+} Operation;
+
+/* A call in flight or waiting to be printed */
+typedef struct {
+	gboolean done;
+	gint64 start;
+	gint64 usec;
+	gchar *text;
+} Slot;
+
+static GDBusConnection *connection;
+static GPtrArray *operations;
+static GMainLoop *loop;
+
+/* Calls are numbered from 0 across repeats; call n is in slot n %
+ * concurrency until printed, so at most that many are ever buffered */
+static guint64 n_calls;
+static guint64 n_sent = 0;
+static guint64 n_printed = 0;
+static guint64 n_errors = 0;
+static Slot *slots;
+static GArray *latencies;
+
+static void
+operation_free (gpointer data)
+{
+	Operation *op = data;
+
+	g_free (op->label);
+	if (op->parameters != NULL)
+		g_variant_unref (op->parameters);
+	g_free (op);
+}
+
+/* Strings may be given bare; anything else is GVariant text */
+static GVariant *
+parse_argument (const GVariantType *type,
+                const gchar *token,
+                GError **error)
+{
+	if (g_variant_type_equal (type, G_VARIANT_TYPE_STRING) &&
+	    token[0] != '\'' && token[0] != '"') {
+		if (!g_utf8_validate (token, -1, NULL)) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Not UTF-8");
+			return NULL;
+		}
+		return g_variant_ref_sink (g_variant_new_string (token));
+	}
+
+	return g_variant_parse (type, token, NULL, NULL, error);
+}
+
+static Operation *
+parse_operation (const gchar *line,
+                 GError **error)
+{
+	const Service *service = NULL;
+	const Method *method = NULL;
+	GVariantType *signature;
+	const GVariantType *type;
+	GPtrArray *args;
+	Operation *op;
+	gchar **argv;
+	gint argc, i;
+
+	if (!g_shell_parse_argv (line, &argc, &argv, error))
+		return NULL;
+
+	for (i = 0; i < (gint) G_N_ELEMENTS (services); i++)
+		if (strcmp (argv[0], services[i].service) == 0)
+			service = &services[i];
+	if (service == NULL || argc < 2) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+			     "Expected datetime or hostname, then a method: %s", line);
+		g_strfreev (argv);
+		return NULL;
+	}
+
+	for (i = 0; i < (gint) G_N_ELEMENTS (methods); i++)
+		if ((methods[i].service == NULL || strcmp (methods[i].service, service->service) == 0) &&
+		    strcmp (methods[i].method, argv[1]) == 0)
+			method = &methods[i];
+	if (method == NULL) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+			     "No method %s in %s", argv[1], service->service);
+		g_strfreev (argv);
+		return NULL;
+	}
+
+	signature = g_variant_type_new (method->signature);
+	if ((gsize) argc - 2 != g_variant_type_n_items (signature)) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+			     "%s %s takes arguments %s", service->service, method->method, method->signature);
+		g_variant_type_free (signature);
+		g_strfreev (argv);
+		return NULL;
+	}
+
+	op = g_new0 (Operation, 1);
+	op->service = service;
+	op->label = g_strdup_printf ("%s.%s", service->service, argv[1]);
+
+	args = g_ptr_array_new ();
+	if (method->service == NULL) {
+		/* Properties of the service's own interface */
+		op->interface = "org.freedesktop.DBus.Properties";
+		op->method = strcmp (method->method, "get") == 0 ? "Get" : "GetAll";
+		g_ptr_array_add (args, g_variant_ref_sink (g_variant_new_string (service->interface)));
+	} else {
+		op->interface = service->interface;
+		op->method = method->method;
+	}
+
+	for (type = g_variant_type_first (signature), i = 2; type != NULL; type = g_variant_type_next (type), i++) {
+		GVariant *arg = parse_argument (type, argv[i], error);
+
+		if (arg == NULL) {
+			g_prefix_error (error, "Argument %d of %s: ", i - 1, op->label);
+			g_ptr_array_foreach (args, (GFunc) g_variant_unref, NULL);
+			g_ptr_array_free (args, TRUE);
+			g_variant_type_free (signature);
+			g_strfreev (argv);
+			operation_free (op);
+			return NULL;
+		}
+		g_ptr_array_add (args, arg);
+	}
+
+	op->parameters = g_variant_ref_sink (g_variant_new_tuple ((GVariant **) args->pdata, args->len));
+
+	g_ptr_array_foreach (args, (GFunc) g_variant_unref, NULL);
+	g_ptr_array_free (args, TRUE);
+	g_variant_type_free (signature);
+	g_strfreev (argv);
+
+	return op;
+}
+
+static gboolean
+add_operation (const gchar *line,
+               guint number)
+{
+	Operation *op;
+	GError *err = NULL;
+
+	while (g_ascii_isspace (*line))
+		line++;
+	if (*line == '\0' || *line == '#')
+		return TRUE;
+
+	op = parse_operation (line, &err);
+	if (op == NULL) {
+		g_printerr ("%u: %s\n", number, err->message);
+		g_error_free (err);
+		return FALSE;
+	}
+
+	g_ptr_array_add (operations, op);
+	return TRUE;
+}
+
+static void
+print_done (void)
+{
+	Slot *slot;
+	Operation *op;
+
+	for (;;) {
+		slot = &slots[n_printed % concurrency];
+		if (n_printed == n_sent || !slot->done)
+			break;
+
+		op = g_ptr_array_index (operations, n_printed % operations->len);
+		if (!quiet)
+			g_print ("%" G_GUINT64_FORMAT "\t%s\t%s\t%" G_GINT64_FORMAT "\t%s\n",
+				 n_printed, op->label, slot->text[0] == '!' ? "error" : "ok",
+				 slot->usec, slot->text + 1);
+
+		g_clear_pointer (&slot->text, g_free);
+		slot->done = FALSE;
+		n_printed++;
+	}
+}
+
+static void send_calls (void);
+
+static void
+call_done (GObject *source,
+           GAsyncResult *result,
+           gpointer user_data)
+{
+	Slot *slot = user_data;
+	GVariant *reply;
+	GError *err = NULL;
+
+	slot->usec = g_get_monotonic_time () - slot->start;
+	g_array_append_val (latencies, slot->usec);
+
+	/* Prefixed with ! or a blank, for print_done () */
+	reply = g_dbus_connection_call_finish (connection, result, &err);
+	if (reply != NULL) {
+		gchar *text = g_variant_print (reply, FALSE);
+
+		slot->text = g_strconcat (" ", text, NULL);
+		g_free (text);
+		g_variant_unref (reply);
+	} else {
+		gchar *name, *message;
+
+		/* The name the service sent; only errors of our own making
+		 * need one made up */
+		if (g_dbus_error_is_remote_error (err))
+			name = g_dbus_error_get_remote_error (err);
+		else
+			name = g_dbus_error_encode_gerror (err);
+
+		g_dbus_error_strip_remote_error (err);
+		message = g_strescape (err->message, NULL);
+		slot->text = g_strdup_printf ("!%s: %s", name, message);
+		g_free (message);
+		g_free (name);
+		g_error_free (err);
+		n_errors++;
+	}
+	slot->done = TRUE;
+
+	print_done ();
+	send_calls ();
+
+	if (n_printed == n_calls)
+		g_main_loop_quit (loop);
+}
+
+static void
+send_calls (void)
+{
+	while (n_sent < n_calls && n_sent < n_printed + concurrency) {
+		Operation *op = g_ptr_array_index (operations, n_sent % operations->len);
+		Slot *slot = &slots[n_sent % concurrency];
+
+		slot->start = g_get_monotonic_time ();
+		g_dbus_connection_call (connection,
+					op->service->name,
+					op->service->path,
+					op->interface,
+					op->method,
+					op->parameters,
+					NULL,
+					G_DBUS_CALL_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION,
+					timeout_ms, NULL, call_done, slot);
+		n_sent++;
+	}
+}
+
+static gint
+compare_latency (gconstpointer a,
+                 gconstpointer b)
+{
+	gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+print_summary (gint64 usec)
+{
+	gint64 *l;
+	guint n;
+
+	g_array_sort (latencies, compare_latency);
+	l = (gint64 *) latencies->data;
+	n = latencies->len;
+
+	g_printerr ("%" G_GUINT64_FORMAT " calls, %" G_GUINT64_FORMAT " errors in %.3f s: %.1f calls/s\n",
+		    n_calls, n_errors, usec / (gdouble) G_USEC_PER_SEC,
+		    n_calls * (gdouble) G_USEC_PER_SEC / MAX (usec, 1));
+	if (n > 0)
+		g_printerr ("latency usec: min %" G_GINT64_FORMAT " p50 %" G_GINT64_FORMAT
+			    " p99 %" G_GINT64_FORMAT " max %" G_GINT64_FORMAT "\n",
+			    l[0], l[n / 2], l[MIN (n - 1, (guint) (n * 0.99))], l[n - 1]);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	GOptionContext *option_context;
+	GError *err = NULL;
+	gint64 start;
+	gint i;
+
+	option_context = g_option_context_new ("[OPERATION...] - call the datetime and hostname mechanisms");
+	g_option_context_set_description (option_context,
+					  "Without operations, reads them from stdin, one per line.\n");
+	g_option_context_add_main_entries (option_context, entries, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &err)) {
+		g_printerr ("%s\n", err->message);
+		return 2;
+	}
+	g_option_context_free (option_context);
+
+	concurrency = MAX (concurrency, 1);
+	repeat = MAX (repeat, 0);
+
+	operations = g_ptr_array_new_with_free_func (operation_free);
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			if (!add_operation (argv[i], i))
+				return 2;
+	} else {
+		GIOChannel *in = g_io_channel_unix_new (0);
+		gchar *line;
+		guint number = 0;
+
+		while (g_io_channel_read_line (in, &line, NULL, NULL, &err) == G_IO_STATUS_NORMAL) {
+			gboolean ok = add_operation (line, ++number);
+
+			g_free (line);
+			if (!ok)
+				return 2;
+		}
+		if (err != NULL) {
+			g_printerr ("Cannot read stdin: %s\n", err->message);
+			return 2;
+		}
+		g_io_channel_unref (in);
+	}
+
+	n_calls = (guint64) operations->len * repeat;
+	if (n_calls == 0)
+		return 0;
+
+	connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &err);
+	if (connection == NULL) {
+		g_printerr ("Cannot connect: %s\n", err->message);
+		return 1;
+	}
+
+	slots = g_new0 (Slot, concurrency);
+	latencies = g_array_sized_new (FALSE, FALSE, sizeof (gint64), MIN (n_calls, 1 << 20));
+	loop = g_main_loop_new (NULL, FALSE);
+
+	start = g_get_monotonic_time ();
+	send_calls ();
+	g_main_loop_run (loop);
+
+	if (summary)
+		print_summary (g_get_monotonic_time () - start);
+
+	return n_errors > 0 ? 1 : 0;
+}
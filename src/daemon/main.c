@@ -0,0 +1,126 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* org.opensettings.DateTimeMechanism and org.freedesktop.hostname1 from
+ * one process and one main loop, rather than a process each. They keep a
+ * bus connection each, as the first is served with dbus-glib and the
+ * second with GDBus. What they have in common is there once: libraries,
+ * type system, the threads behind their GTasks, and the polkit authority,
+ * of which polkit keeps one per process. The datetime mechanism doesn't
+ * exit when idle here, since hostname1 never does. */
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib-object.h>
+#include <dbus/dbus-glib.h>
+
+#include "datetime.h"
+#include "datetime-service.h"
+#include "hostname.h"
+#include "startup.h"
+
+/* Names made up for clashing options, kept until the options are parsed */
+static GPtrArray *renamed = NULL;
+
+static gboolean
+has_option (const GOptionEntry *entries,
+	    const gchar *long_name)
+{
+	guint i;
+
+	for (i = 0; entries[i].long_name != NULL; i++)
+		if (g_strcmp0 (entries[i].long_name, long_name) == 0)
+			return TRUE;
+
+	return FALSE;
+}
+
+/* Options a service shares a name with are only reached with its own in
+ * front, as in --hostname-rate-limit: left to GLib, the plain name would
+ * go to whichever service was added first. Short names would clash too,
+ * so they are left out. */
+static void
+add_group (GOptionContext *context,
+	   const gchar *name,
+	   const gchar *description,
+	   const GOptionEntry *entries,
+	   const GOptionEntry *others)
+{
+	GOptionGroup *group;
+	GOptionEntry *copy;
+	gchar *help, *long_name;
+	guint n, i;
+
+	for (n = 0; entries[n].long_name != NULL; n++)
+		;
+	copy = g_new0 (GOptionEntry, n + 1);
+	for (i = 0; i < n; i++) {
+		copy[i] = entries[i];
+		copy[i].short_name = 0;
+		if (has_option (others, entries[i].long_name)) {
+			long_name = g_strdup_printf ("%s-%s", name, entries[i].long_name);
+			g_ptr_array_add (renamed, long_name);
+			copy[i].long_name = long_name;
+		}
+	}
+
+	help = g_strdup_printf ("Show %s", description);
+	group = g_option_group_new (name, description, help, NULL, NULL);
+	/* Copied in, but not the names */
+	g_option_group_add_entries (group, copy);
+	g_option_context_add_group (context, group);
+
+	g_free (help);
+	g_free (copy);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	GOptionContext *option_context;
+	GsdDatetimeMechanism *mechanism;
+	GMainLoop *loop;
+	GError *error = NULL;
+	gint status;
+
+	startup_begin ();
+	if (!g_thread_supported ())
+		g_thread_init (NULL);
+	dbus_g_thread_init ();
+	g_type_init ();
+
+	option_context = g_option_context_new ("[ROOT...] - opensettings mechanisms");
+	renamed = g_ptr_array_new_with_free_func (g_free);
+	add_group (option_context, "datetime", "datetime mechanism options",
+		   datetime_service_get_options (), hostname_get_options ());
+	add_group (option_context, "hostname", "hostname1 mechanism options",
+		   hostname_get_options (), datetime_service_get_options ());
+	if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+		g_critical ("%s", error->message);
+		g_error_free (error);
+		g_option_context_free (option_context);
+		g_ptr_array_unref (renamed);
+		return 1;
+	}
+	g_option_context_free (option_context);
+	g_ptr_array_unref (renamed);
+
+	if (datetime_service_run_once (argc, argv, &status))
+		return status;
+
+	mechanism = datetime_service_start (TRUE);
+	if (mechanism == NULL)
+		return 1;
+	hostname_start ();
+
+	loop = g_main_loop_new (NULL, FALSE);
+	g_main_loop_run (loop);
+	g_main_loop_unref (loop);
+
+	hostname_stop ();
+	g_object_unref (mechanism);
+
+	return 0;
+}
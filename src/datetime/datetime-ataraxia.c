@@ -30,87 +30,49 @@
 #include "datetime-ataraxia.h"
 #include "datetime.h"
 
-gboolean
-_get_using_ntp_ataraxia (DBusGMethodInvocation   *context)
-{
-        int exit_status;
-        GError *error = NULL;
-        gboolean can_use_ntp;
-        gboolean is_using_ntp;
-
-        if (g_file_test ("/etc/ntp.conf", G_FILE_TEST_EXISTS)) {
-                can_use_ntp = TRUE;
-                if (!g_spawn_command_line_sync ("/usr/bin/perpstat ntpd",
-                                                NULL, NULL, &exit_status, &error)) {
-                        GError *error2;
-                        error2 = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                              GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                              "Error spawning /usr/bin/perpstat: %s", error->message);
-                        g_error_free (error);
-                        dbus_g_method_return_error (context, error2);
-                        g_error_free (error2);
-                        return FALSE;
-                }
-                if (exit_status == 0)
-                        is_using_ntp = TRUE;
-                else
-                        is_using_ntp = FALSE;
-        }
-        else {
-                can_use_ntp = FALSE;
-                is_using_ntp = FALSE;
-        }
-
-        dbus_g_method_return (context, can_use_ntp, is_using_ntp);
-        return TRUE;
-}
-
-gboolean
-_set_using_ntp_ataraxia (DBusGMethodInvocation   *context,
-                     gboolean                 using_ntp)
+DatetimeJob *
+_get_using_ntp_ataraxia (gboolean *can_use,
+                         gboolean *is_using)
 {
-        GError *error;
-        int exit_status;
-        char *cmd;
-
-        error = NULL;
+        DatetimeJob *job;
 
-        cmd = g_strconcat ("/usr/bin/perpctl A ntpd && /usr/bin/perpctl u ntpd ", using_ntp ? "on" : "off", NULL);
+        *can_use = g_file_test ("/etc/ntp.conf", G_FILE_TEST_EXISTS);
+        *is_using = FALSE;
+        if (!*can_use)
+                return NULL;
 
-        if (!g_spawn_command_line_sync (cmd,
-                                        NULL, NULL, &exit_status, &error)) {
-                GError *error2;
-                error2 = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                      GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                      "Error spawning '%s': %s", cmd, error->message);
-                g_error_free (error);
-                dbus_g_method_return_error (context, error2);
-                g_error_free (error2);
-                g_free (cmd);
-                return FALSE;
-        }
+        /* ntpd is in use if perpstat succeeds */
+        job = datetime_job_new ("GetUsingNtp");
+        datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, TRUE,
+                               "/usr/bin/perpstat", "ntpd", NULL);
 
-        g_free (cmd);
-
-        cmd = g_strconcat ("/usr/bin/perpctl d ntpd && /usr/bin/perpctl u ntpd ", using_ntp ? "restart" : "stop", NULL);;
+        return job;
+}
 
-        if (!g_spawn_command_line_sync (cmd,
-                                        NULL, NULL, &exit_status, &error)) {
-                GError *error2;
-                error2 = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                      GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                      "Error spawning '%s': %s", cmd, error->message);
-                g_error_free (error);
-                dbus_g_method_return_error (context, error2);
-                g_error_free (error2);
-                g_free (cmd);
-                return FALSE;
+DatetimeJob *
+_set_using_ntp_ataraxia (gboolean using_ntp)
+{
+        DatetimeJob *job;
+
+        job = datetime_job_new ("SetUsingNtp");
+
+        if (using_ntp) {
+                /* Activate the service, then restart it */
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, FALSE,
+                                       "/usr/bin/perpctl", "A", "ntpd", NULL);
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_SERVICE, TRUE,
+                                       "/usr/bin/perpctl", "d", "ntpd", NULL);
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_SERVICE, FALSE,
+                                       "/usr/bin/perpctl", "u", "ntpd", NULL);
+        } else {
+                /* Stop the service and keep it from coming back */
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_SERVICE, TRUE,
+                                       "/usr/bin/perpctl", "d", "ntpd", NULL);
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, FALSE,
+                                       "/usr/bin/perpctl", "X", "ntpd", NULL);
         }
 
-        g_free (cmd);
-
-        dbus_g_method_return (context);
-        return TRUE;
+        return job;
 }
 
 gboolean
@@ -24,9 +24,11 @@
 #include <glib.h>
 #include <dbus/dbus-glib.h>
 
-gboolean _get_using_ntp_ataraxia  (DBusGMethodInvocation   *context);
-gboolean _set_using_ntp_ataraxia  (DBusGMethodInvocation   *context,
-                               gboolean                 using_ntp);
+#include "datetime-job.h"
+
+DatetimeJob *_get_using_ntp_ataraxia  (gboolean *can_use,
+                                       gboolean *is_using);
+DatetimeJob *_set_using_ntp_ataraxia  (gboolean  using_ntp);
 gboolean _update_etc_rcd_ntp_ataraxia
                                 (DBusGMethodInvocation *context,
                                  const char            *key,
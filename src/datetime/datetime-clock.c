@@ -0,0 +1,276 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/timex.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "datetime.h"
+#include "datetime-clock.h"
+#include "parsers.h"
+
+#define ETC_LOCALTIME "/etc/localtime"
+
+/* A timer that never expires; TFD_TIMER_CANCEL_ON_SET makes reads of it
+ * fail with ECANCELED once the clock is set */
+#define TIME_T_MAX ((time_t) ((G_GUINT64_CONSTANT (1) << (sizeof (time_t) * 8 - 1)) - 1))
+
+static int watch_fd = -1;
+static guint watch_id = 0;
+static DatetimeClockChangedFunc watch_func;
+static gpointer watch_data;
+
+/* Where both clocks were when the timer was last armed */
+static gint64 base_realtime;
+static gint64 base_boottime;
+
+static gint64
+get_boottime (void)
+{
+        struct timespec ts;
+
+        clock_gettime (CLOCK_BOOTTIME, &ts);
+        return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static gboolean
+arm (GError **error)
+{
+        struct itimerspec its;
+
+        memset (&its, 0, sizeof (its));
+        its.it_value.tv_sec = TIME_T_MAX;
+
+        if (timerfd_settime (watch_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) < 0) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error arming clock watch: %s", g_strerror (errno));
+                return FALSE;
+        }
+
+        /* After arming, so a change in between is reported rather than lost */
+        base_boottime = get_boottime ();
+        base_realtime = g_get_real_time ();
+
+        return TRUE;
+}
+
+static gboolean
+watch_cb (gint         fd,
+          GIOCondition condition,
+          gpointer     user_data)
+{
+        guint64 expirations;
+        gint64 old_realtime;
+        GError *error = NULL;
+
+        if (read (fd, &expirations, sizeof (expirations)) >= 0 || errno != ECANCELED)
+                return TRUE;
+
+        old_realtime = base_realtime + (get_boottime () - base_boottime);
+
+        if (!arm (&error)) {
+                g_warning ("%s", error->message);
+                g_error_free (error);
+                watch_id = 0;
+                datetime_clock_watch_stop ();
+                return FALSE;
+        }
+
+        g_debug ("System time set, %" G_GINT64_FORMAT " us off",
+                 base_realtime - old_realtime);
+        watch_func (old_realtime, base_realtime, watch_data);
+
+        return TRUE;
+}
+
+gboolean
+datetime_clock_watch_start (DatetimeClockChangedFunc   func,
+                            gpointer                   user_data,
+                            GError                   **error)
+{
+        g_return_val_if_fail (watch_fd < 0, FALSE);
+
+        watch_fd = timerfd_create (CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (watch_fd < 0) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error creating clock watch: %s", g_strerror (errno));
+                return FALSE;
+        }
+
+        if (!arm (error)) {
+                datetime_clock_watch_stop ();
+                return FALSE;
+        }
+
+        watch_func = func;
+        watch_data = user_data;
+        watch_id = g_unix_fd_add (watch_fd, G_IO_IN, watch_cb, NULL);
+
+        return TRUE;
+}
+
+void
+datetime_clock_watch_stop (void)
+{
+        if (watch_id > 0) {
+                g_source_remove (watch_id);
+                watch_id = 0;
+        }
+        if (watch_fd >= 0) {
+                close (watch_fd);
+                watch_fd = -1;
+        }
+}
+
+gboolean
+datetime_clock_is_synchronized (void)
+{
+        struct timex tx;
+
+        memset (&tx, 0, sizeof (tx));
+        if (adjtimex (&tx) < 0)
+                return FALSE;
+
+        return (tx.status & STA_UNSYNC) == 0;
+}
+
+/* Offset watch */
+
+static int offset_fd = -1;
+static guint offset_id = 0;
+static DatetimeOffsetChangedFunc offset_func;
+static gpointer offset_data;
+
+static gboolean offset_known = FALSE;
+static gint32 offset_current;
+
+static void
+arm_offset (gint64 at)
+{
+        struct itimerspec its;
+
+        /* Zero disarms it */
+        memset (&its, 0, sizeof (its));
+        if (at != PARSE_TZIF_NEVER)
+                its.it_value.tv_sec = (time_t) MIN (MAX (at, 1), (gint64) TIME_T_MAX);
+
+        if (timerfd_settime (offset_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+                g_warning ("Error arming offset watch: %s", g_strerror (errno));
+}
+
+void
+datetime_offset_watch_update (void)
+{
+        ParsedTzifOffset offset;
+        char *contents;
+        gsize length;
+        GError *error = NULL;
+
+        if (offset_fd < 0)
+                return;
+
+        if (!g_file_get_contents (ETC_LOCALTIME, &contents, &length, &error) ||
+            !parse_tzif ((const guchar *) contents, length,
+                         g_get_real_time () / G_USEC_PER_SEC, &offset, &error)) {
+                g_warning ("Not watching for offset changes: %s", error->message);
+                g_error_free (error);
+                g_free (contents);
+                offset_known = FALSE;
+                arm_offset (PARSE_TZIF_NEVER);
+                return;
+        }
+        g_free (contents);
+
+        arm_offset (offset.next);
+        if (offset.next != PARSE_TZIF_NEVER)
+                g_debug ("Next offset change at %" G_GINT64_FORMAT ", to %d (%s)",
+                         offset.next, offset.next_offset, offset.next_abbrev);
+
+        if (offset_known && offset.offset != offset_current)
+                offset_func (offset_current, offset.offset, offset.abbrev, offset_data);
+
+        offset_known = TRUE;
+        offset_current = offset.offset;
+}
+
+static gboolean
+offset_cb (gint         fd,
+           GIOCondition condition,
+           gpointer     user_data)
+{
+        guint64 expirations;
+
+        if (read (fd, &expirations, sizeof (expirations)) < 0)
+                return TRUE;
+
+        datetime_offset_watch_update ();
+
+        return TRUE;
+}
+
+gboolean
+datetime_offset_watch_start (DatetimeOffsetChangedFunc   func,
+                             gpointer                    user_data,
+                             GError                    **error)
+{
+        g_return_val_if_fail (offset_fd < 0, FALSE);
+
+        offset_fd = timerfd_create (CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (offset_fd < 0) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error creating offset watch: %s", g_strerror (errno));
+                return FALSE;
+        }
+
+        offset_func = func;
+        offset_data = user_data;
+        offset_id = g_unix_fd_add (offset_fd, G_IO_IN, offset_cb, NULL);
+
+        datetime_offset_watch_update ();
+
+        return TRUE;
+}
+
+void
+datetime_offset_watch_stop (void)
+{
+        if (offset_id > 0) {
+                g_source_remove (offset_id);
+                offset_id = 0;
+        }
+        if (offset_fd >= 0) {
+                close (offset_fd);
+                offset_fd = -1;
+        }
+        offset_known = FALSE;
+}
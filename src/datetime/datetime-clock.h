@@ -0,0 +1,64 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __DATETIME_CLOCK_H__
+#define __DATETIME_CLOCK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Both in microseconds since the epoch. old_realtime is what the clock
+ * would read had it not been set, going by CLOCK_BOOTTIME since the last
+ * change, so slewing in between shows up in it. */
+typedef void (*DatetimeClockChangedFunc) (gint64   old_realtime,
+                                          gint64   new_realtime,
+                                          gpointer user_data);
+
+/* Calls func on the main loop whenever the system time is set, by anyone.
+ * Changes in quick succession may be reported once. */
+gboolean datetime_clock_watch_start (DatetimeClockChangedFunc   func,
+                                     gpointer                   user_data,
+                                     GError                   **error);
+void     datetime_clock_watch_stop  (void);
+
+/* Whether something, such as an NTP daemon, is keeping the system time
+ * in sync, going by the kernel's STA_UNSYNC */
+gboolean datetime_clock_is_synchronized (void);
+
+/* Offsets in seconds east of UTC, abbrev being that of the new one */
+typedef void (*DatetimeOffsetChangedFunc) (gint32      old_offset,
+                                           gint32      new_offset,
+                                           const char *abbrev,
+                                           gpointer    user_data);
+
+/* Calls func on the main loop when the UTC offset of the system zone
+ * changes: at its transitions, which are read from /etc/localtime, and
+ * when datetime_offset_watch_update () finds another. That has to be
+ * called after the zone or the time was set. */
+gboolean datetime_offset_watch_start  (DatetimeOffsetChangedFunc   func,
+                                       gpointer                    user_data,
+                                       GError                    **error);
+void     datetime_offset_watch_update (void);
+void     datetime_offset_watch_stop   (void);
+
+G_END_DECLS
+
+#endif /* __DATETIME_CLOCK_H__ */
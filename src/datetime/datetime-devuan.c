@@ -27,7 +27,7 @@
 #include "datetime.h"
 
 static void
-_get_using_ntpdate (gboolean *can_use, gboolean *is_using, GError ** error)
+_get_using_ntpdate (gboolean *can_use, gboolean *is_using)
 {
         if (!g_file_test ("/usr/sbin/ntpdate-debian", G_FILE_TEST_EXISTS))
                 return;
@@ -38,62 +38,35 @@ _get_using_ntpdate (gboolean *can_use, gboolean *is_using, GError ** error)
                 *is_using = TRUE;
 }
 
-static void
-_get_using_ntpd (gboolean *can_use, gboolean *is_using, GError ** error)
+DatetimeJob *
+_get_using_ntp_debian (gboolean *can_use, gboolean *is_using)
 {
-        int exit_status;
-        GError *tmp_error = NULL;
+        DatetimeJob *job;
+
+        *can_use = FALSE;
+        *is_using = FALSE;
+
+        /* In Debian, ntpdate is used whenever the network comes up. So if
+           either ntpdate or ntpd is installed and available, can_use is true.
+           If either is active, is_using is true. */
+        _get_using_ntpdate (can_use, is_using);
 
         if (!g_file_test ("/usr/sbin/ntpd", G_FILE_TEST_EXISTS))
-                return;
+                return NULL;
 
         *can_use = TRUE;
 
-        if (!g_spawn_command_line_sync ("/usr/sbin/service ntp status",
-                                        NULL, NULL, &exit_status, &tmp_error)) {
-                if (error != NULL && *error == NULL) {
-                        *error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                              GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                              "Error spawning /usr/sbin/service: %s",
-                                              tmp_error->message);
-                }
-                g_error_free (tmp_error);
-                return;
-        }
+        /* ntpd is in use if its status succeeds */
+        job = datetime_job_new ("GetUsingNtp");
+        datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, TRUE,
+                               "/usr/sbin/service", "ntp", "status", NULL);
 
-        if (exit_status == 0)
-                *is_using = TRUE;
-}
-
-gboolean
-_get_using_ntp_debian (DBusGMethodInvocation   *context)
-{
-        gboolean can_use_ntp = FALSE;
-        gboolean is_using_ntp = FALSE;
-        GError *error = NULL;
-
-        /* In Debian, ntpdate is used whenever the network comes up. So if
-           either ntpdate or ntpd is installed and available, can_use is true.
-           If either is active, is_using is true. */
-        _get_using_ntpdate (&can_use_ntp, &is_using_ntp, &error);
-        _get_using_ntpd (&can_use_ntp, &is_using_ntp, &error);
-
-        if (error == NULL) {
-                dbus_g_method_return (context, can_use_ntp, is_using_ntp);
-                return TRUE;
-        } else {
-                dbus_g_method_return_error (context, error);
-                g_error_free (error);
-                return FALSE;
-        }
+        return job;
 }
 
 static void
-_set_using_ntpdate (gboolean using_ntp, GError **error)
+_set_using_ntpdate (DatetimeJob *job, gboolean using_ntp)
 {
-        const gchar *cmd = NULL;
-        GError  *tmp_error = NULL;
-
         /* Debian uses an if-up.d script to sync network time when an interface
            comes up.  This is a separate mechanism from ntpd altogether. */
 
@@ -101,100 +74,46 @@ _set_using_ntpdate (gboolean using_ntp, GError **error)
 #define NTPDATE_DISABLED "/etc/network/if-up.d/ntpdate.disabled"
 
         if (using_ntp && g_file_test (NTPDATE_DISABLED, G_FILE_TEST_EXISTS))
-                cmd = "/bin/mv -f "NTPDATE_DISABLED" "NTPDATE_ENABLED;
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, FALSE,
+                                       "/bin/mv", "-f", NTPDATE_DISABLED, NTPDATE_ENABLED, NULL);
         else if (!using_ntp && g_file_test (NTPDATE_ENABLED, G_FILE_TEST_EXISTS))
-                cmd = "/bin/mv -f "NTPDATE_ENABLED" "NTPDATE_DISABLED;
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, FALSE,
+                                       "/bin/mv", "-f", NTPDATE_ENABLED, NTPDATE_DISABLED, NULL);
         else
                  return;
 
-        if (!g_spawn_command_line_sync (cmd, NULL, NULL, NULL, &tmp_error)) {
-                if (error != NULL && *error == NULL) {
-                        *error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                              GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                              "Error spawning /bin/mv: %s",
-                                              tmp_error->message);
-                }
-                g_error_free (tmp_error);
-                return;
-        }
-
-        /* Kick start ntpdate to sync time immediately */
-        if (using_ntp &&
-            !g_spawn_command_line_sync ("/etc/network/if-up.d/ntpdate",
-                                        NULL, NULL, NULL, &tmp_error)) {
-                if (error != NULL && *error == NULL) {
-                        *error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                              GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                              "Error spawning /etc/network/if-up.d/ntpdate: %s",
-                                              tmp_error->message);
-                }
-                g_error_free (tmp_error);
-                return;
-        }
+        /* Kick start ntpdate to sync time immediately. It fails when
+           the network is down, which is no reason to fail the job. */
+        if (using_ntp)
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_SERVICE, TRUE,
+                                       NTPDATE_ENABLED, NULL);
 }
 
 static void
-_set_using_ntpd (gboolean using_ntp, GError **error)
+_set_using_ntpd (DatetimeJob *job, gboolean using_ntp)
 {
-        GError *tmp_error = NULL;
-        int exit_status;
-        char *cmd;
-
         if (!g_file_test ("/usr/sbin/ntpd", G_FILE_TEST_EXISTS))
                 return;
 
-        cmd = g_strconcat ("/usr/sbin/update-rc.d ntp ", using_ntp ? "enable" : "disable", NULL);
-
-        if (!g_spawn_command_line_sync (cmd, NULL, NULL, &exit_status, &tmp_error)) {
-                if (error != NULL && *error == NULL) {
-                        *error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                              GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                              "Error spawning '%s': %s",
-                                              cmd, tmp_error->message);
-                }
-                g_error_free (tmp_error);
-                g_free (cmd);
-                return;
-        }
-
-        g_free (cmd);
-
-        cmd = g_strconcat ("/usr/sbin/service ntp ", using_ntp ? "restart" : "stop", NULL);;
-
-        if (!g_spawn_command_line_sync (cmd, NULL, NULL, &exit_status, &tmp_error)) {
-                if (error != NULL && *error == NULL) {
-                        *error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                              GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                              "Error spawning '%s': %s",
-                                              cmd, tmp_error->message);
-                }
-                g_error_free (tmp_error);
-                g_free (cmd);
-                return;
-        }
-
-        g_free (cmd);
+        datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, FALSE,
+                               "/usr/sbin/update-rc.d", "ntp",
+                               using_ntp ? "enable" : "disable", NULL);
+        /* Stopping a stopped service is not an error */
+        datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_SERVICE, !using_ntp,
+                               "/usr/sbin/service", "ntp",
+                               using_ntp ? "restart" : "stop", NULL);
 }
 
-gboolean
-_set_using_ntp_debian  (DBusGMethodInvocation   *context,
-                        gboolean                 using_ntp)
+DatetimeJob *
+_set_using_ntp_debian (gboolean using_ntp)
 {
-        GError *error = NULL;
+        DatetimeJob *job;
 
         /* In Debian, ntpdate and ntpd may be installed separately, so don't
            assume both are valid. */
+        job = datetime_job_new ("SetUsingNtp");
+        _set_using_ntpdate (job, using_ntp);
+        _set_using_ntpd (job, using_ntp);
 
-        _set_using_ntpdate (using_ntp, &error);
-        _set_using_ntpd (using_ntp, &error);
-
-        if (error == NULL) {
-                dbus_g_method_return (context);
-                return TRUE;
-        } else {
-                dbus_g_method_return_error (context, error);
-                g_error_free (error);
-                return FALSE;
-        }
+        return job;
 }
-
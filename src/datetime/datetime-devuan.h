@@ -22,6 +22,8 @@
 #include <glib.h>
 #include <dbus/dbus-glib.h>
 
-gboolean _get_using_ntp_debian (DBusGMethodInvocation   *context);
-gboolean _set_using_ntp_debian  (DBusGMethodInvocation   *context,
-                                 gboolean                 using_ntp);
+#include "datetime-job.h"
+
+DatetimeJob *_get_using_ntp_debian (gboolean *can_use,
+                                    gboolean *is_using);
+DatetimeJob *_set_using_ntp_debian (gboolean  using_ntp);
@@ -0,0 +1,355 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdarg.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "datetime.h"
+#include "datetime-job.h"
+
+typedef struct
+{
+        char            **argv;
+        guint             timeout;
+        gboolean          may_fail;
+
+        /* Instead of argv */
+        DatetimeJobFunc   func;
+        gpointer          func_data;
+} JobStep;
+
+struct _DatetimeJob
+{
+        char                    *name;
+        GPtrArray               *steps;
+        guint                    current;
+        int                      exit_status;
+
+        DatetimeJobProgressFunc  progress;
+        gpointer                 progress_data;
+
+        GTask                   *task;
+        GSubprocess             *subprocess;
+        guint                    timeout_id;
+        gboolean                 timed_out;
+};
+
+static guint n_running = 0;
+
+static void run_step (DatetimeJob *job);
+
+static void
+job_step_free (gpointer data)
+{
+        JobStep *step = data;
+
+        g_strfreev (step->argv);
+        g_free (step);
+}
+
+DatetimeJob *
+datetime_job_new (const char *name)
+{
+        DatetimeJob *job;
+
+        job = g_new0 (DatetimeJob, 1);
+        job->name = g_strdup (name);
+        job->steps = g_ptr_array_new_with_free_func (job_step_free);
+
+        return job;
+}
+
+static void
+datetime_job_free (gpointer data)
+{
+        DatetimeJob *job = data;
+
+        g_ptr_array_unref (job->steps);
+        g_free (job->name);
+        g_free (job);
+}
+
+const char *
+datetime_job_get_name (DatetimeJob *job)
+{
+        return job->name;
+}
+
+guint
+datetime_job_get_n_steps (DatetimeJob *job)
+{
+        return job->steps->len;
+}
+
+void
+datetime_job_add_step (DatetimeJob *job,
+                       guint        timeout,
+                       gboolean     may_fail,
+                       const char  *argv0,
+                       ...)
+{
+        JobStep *step;
+        GPtrArray *argv;
+        const char *arg;
+        va_list args;
+
+        argv = g_ptr_array_new ();
+        g_ptr_array_add (argv, g_strdup (argv0));
+        va_start (args, argv0);
+        while ((arg = va_arg (args, const char *)) != NULL)
+                g_ptr_array_add (argv, g_strdup (arg));
+        va_end (args);
+        g_ptr_array_add (argv, NULL);
+
+        step = g_new0 (JobStep, 1);
+        step->argv = (char **) g_ptr_array_free (argv, FALSE);
+        step->timeout = timeout;
+        step->may_fail = may_fail;
+
+        g_ptr_array_add (job->steps, step);
+}
+
+void
+datetime_job_add_func_step (DatetimeJob     *job,
+                            gboolean         may_fail,
+                            DatetimeJobFunc  func,
+                            gpointer         user_data)
+{
+        JobStep *step;
+
+        step = g_new0 (JobStep, 1);
+        step->may_fail = may_fail;
+        step->func = func;
+        step->func_data = user_data;
+
+        g_ptr_array_add (job->steps, step);
+}
+
+void
+datetime_job_set_progress_func (DatetimeJob             *job,
+                                DatetimeJobProgressFunc  func,
+                                gpointer                 user_data)
+{
+        job->progress = func;
+        job->progress_data = user_data;
+}
+
+static void
+job_progress (DatetimeJob *job)
+{
+        if (job->progress != NULL)
+                job->progress (job, job->current, job->steps->len, job->progress_data);
+}
+
+static void
+job_return (DatetimeJob *job,
+            GError      *error)
+{
+        GTask *task = job->task;
+
+        job->task = NULL;
+        n_running--;
+
+        if (error != NULL)
+                g_task_return_error (task, error);
+        else
+                g_task_return_boolean (task, TRUE);
+
+        g_object_unref (task);
+}
+
+static gboolean
+step_timeout_cb (gpointer user_data)
+{
+        DatetimeJob *job = user_data;
+
+        job->timeout_id = 0;
+        job->timed_out = TRUE;
+        g_subprocess_force_exit (job->subprocess);
+
+        return FALSE;
+}
+
+static void
+step_done_cb (GObject      *source,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+        DatetimeJob *job = user_data;
+        JobStep *step = g_ptr_array_index (job->steps, job->current);
+        GError *error = NULL;
+
+        g_subprocess_wait_finish (job->subprocess, result, NULL);
+
+        if (job->timeout_id != 0) {
+                g_source_remove (job->timeout_id);
+                job->timeout_id = 0;
+        }
+
+        if (job->timed_out) {
+                error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
+                                     GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                                     "%s killed after %u seconds", step->argv[0], step->timeout);
+        } else if (!g_subprocess_get_if_exited (job->subprocess)) {
+                error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
+                                     GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                                     "%s killed by signal %d", step->argv[0],
+                                     g_subprocess_get_term_sig (job->subprocess));
+        } else {
+                job->exit_status = g_subprocess_get_exit_status (job->subprocess);
+                if (job->exit_status != 0 && !step->may_fail)
+                        error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
+                                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                                             "%s returned %d", step->argv[0], job->exit_status);
+        }
+
+        g_clear_object (&job->subprocess);
+
+        if (error != NULL) {
+                job_return (job, error);
+                return;
+        }
+
+        job->current++;
+        run_step (job);
+}
+
+static void
+func_step_thread (GTask        *task,
+                  gpointer      source_object,
+                  gpointer      task_data,
+                  GCancellable *cancellable)
+{
+        JobStep *step = task_data;
+        GError *error = NULL;
+
+        if (step->func (step->func_data, &error))
+                g_task_return_boolean (task, TRUE);
+        else
+                g_task_return_error (task, error);
+}
+
+static void
+func_step_done_cb (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+        DatetimeJob *job = user_data;
+        JobStep *step = g_ptr_array_index (job->steps, job->current);
+        GError *error = NULL;
+
+        if (g_task_propagate_boolean (G_TASK (result), &error)) {
+                job->exit_status = 0;
+        } else if (step->may_fail) {
+                job->exit_status = 1;
+                g_clear_error (&error);
+        } else {
+                job_return (job, error);
+                return;
+        }
+
+        job->current++;
+        run_step (job);
+}
+
+static void
+run_step (DatetimeJob *job)
+{
+        JobStep *step;
+        GTask *task;
+        GError *error = NULL;
+        GError *error2;
+
+        job_progress (job);
+
+        if (job->current == job->steps->len) {
+                job_return (job, NULL);
+                return;
+        }
+
+        step = g_ptr_array_index (job->steps, job->current);
+
+        /* In a thread, as these do I/O and sync files too */
+        if (step->func != NULL) {
+                g_debug ("%s: running step %u in-process", job->name, job->current);
+                task = g_task_new (NULL, NULL, func_step_done_cb, job);
+                g_task_set_task_data (task, step, NULL);
+                g_task_run_in_thread (task, func_step_thread);
+                g_object_unref (task);
+                return;
+        }
+
+        g_debug ("%s: running %s", job->name, step->argv[0]);
+
+        job->timed_out = FALSE;
+        job->subprocess = g_subprocess_newv ((const char * const *) step->argv,
+                                             G_SUBPROCESS_FLAGS_STDOUT_SILENCE,
+                                             &error);
+        if (job->subprocess == NULL) {
+                error2 = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
+                                      GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                                      "Error spawning %s: %s", step->argv[0], error->message);
+                g_error_free (error);
+                job_return (job, error2);
+                return;
+        }
+
+        job->timeout_id = g_timeout_add_seconds (step->timeout, step_timeout_cb, job);
+        g_subprocess_wait_async (job->subprocess, NULL, step_done_cb, job);
+}
+
+void
+datetime_job_run (DatetimeJob         *job,
+                  GAsyncReadyCallback  callback,
+                  gpointer             user_data)
+{
+        job->task = g_task_new (NULL, NULL, callback, user_data);
+        /* The job goes away with the task */
+        g_task_set_task_data (job->task, job, datetime_job_free);
+
+        n_running++;
+        run_step (job);
+}
+
+gboolean
+datetime_job_finish (GAsyncResult  *result,
+                     int           *exit_status,
+                     GError       **error)
+{
+        DatetimeJob *job;
+
+        job = g_task_get_task_data (G_TASK (result));
+        if (exit_status != NULL)
+                *exit_status = job->exit_status;
+
+        return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+guint
+datetime_job_get_n_running (void)
+{
+        return n_running;
+}
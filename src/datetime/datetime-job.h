@@ -0,0 +1,79 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __DATETIME_JOB_H__
+#define __DATETIME_JOB_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* A job is a list of helper commands run one after the other, without
+ * blocking the main loop. Each step gets its own timeout, after which the
+ * helper is killed. The first step that fails ends the job. */
+typedef struct _DatetimeJob DatetimeJob;
+
+/* Step timeouts, in seconds: for helpers that only touch local state, and
+ * for those that start or stop services */
+#define DATETIME_JOB_TIMEOUT_QUICK      10
+#define DATETIME_JOB_TIMEOUT_SERVICE    30
+
+/* A step run in-process, in a thread of its own */
+typedef gboolean (*DatetimeJobFunc) (gpointer   user_data,
+                                     GError   **error);
+
+typedef void (*DatetimeJobProgressFunc) (DatetimeJob *job,
+                                         guint        step,
+                                         guint        n_steps,
+                                         gpointer     user_data);
+
+DatetimeJob *datetime_job_new               (const char              *name);
+const char  *datetime_job_get_name          (DatetimeJob             *job);
+guint        datetime_job_get_n_steps       (DatetimeJob             *job);
+
+/* A step that may fail doesn't end the job on a non-zero exit status */
+void         datetime_job_add_step          (DatetimeJob             *job,
+                                             guint                    timeout,
+                                             gboolean                 may_fail,
+                                             const char              *argv0,
+                                             ...) G_GNUC_NULL_TERMINATED;
+void         datetime_job_add_func_step     (DatetimeJob             *job,
+                                             gboolean                 may_fail,
+                                             DatetimeJobFunc          func,
+                                             gpointer                 user_data);
+void         datetime_job_set_progress_func (DatetimeJob             *job,
+                                             DatetimeJobProgressFunc  func,
+                                             gpointer                 user_data);
+
+/* Takes ownership of the job */
+void         datetime_job_run               (DatetimeJob             *job,
+                                             GAsyncReadyCallback      callback,
+                                             gpointer                 user_data);
+/* exit_status is that of the last step */
+gboolean     datetime_job_finish            (GAsyncResult            *result,
+                                             int                     *exit_status,
+                                             GError                 **error);
+
+guint        datetime_job_get_n_running     (void);
+
+G_END_DECLS
+
+#endif /* __DATETIME_JOB_H__ */
@@ -22,110 +22,22 @@
 #  include "config.h"
 #endif
 
-#include <stdlib.h>
-#include <stdio.h>
-#include <unistd.h>
-#include <signal.h>
-#include <errno.h>
-#include <string.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-
 #include <glib.h>
 #include <glib-object.h>
 
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
 
-
 #include "datetime.h"
-
-static DBusGProxy *
-get_bus_proxy (DBusGConnection *connection)
-{
-        DBusGProxy *bus_proxy;
-
-	bus_proxy = dbus_g_proxy_new_for_name (connection,
-                                               DBUS_SERVICE_DBUS,
-                                               DBUS_PATH_DBUS,
-                                               DBUS_INTERFACE_DBUS);
-        return bus_proxy;
-}
-
-#define BUS_NAME "org.opensettings.DateTimeMechanism"
-
-static gboolean
-acquire_name_on_proxy (DBusGProxy *bus_proxy)
-{
-        GError     *error;
-        guint       result;
-        gboolean    res;
-        gboolean    ret;
-
-        ret = FALSE;
-
-        if (bus_proxy == NULL) {
-                goto out;
-        }
-
-        error = NULL;
-	res = dbus_g_proxy_call (bus_proxy,
-                                 "RequestName",
-                                 &error,
-                                 G_TYPE_STRING, BUS_NAME,
-                                 G_TYPE_UINT, 0,
-                                 G_TYPE_INVALID,
-                                 G_TYPE_UINT, &result,
-                                 G_TYPE_INVALID);
-        if (! res) {
-                if (error != NULL) {
-                        g_warning ("Failed to acquire %s: %s", BUS_NAME, error->message);
-                        g_error_free (error);
-                } else {
-                        g_warning ("Failed to acquire %s", BUS_NAME);
-                }
-                goto out;
-	}
-
- 	if (result != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
-                if (error != NULL) {
-                        g_warning ("Failed to acquire %s: %s", BUS_NAME, error->message);
-                        g_error_free (error);
-                } else {
-                        g_warning ("Failed to acquire %s", BUS_NAME);
-                }
-                goto out;
-        }
-
-        ret = TRUE;
-
- out:
-        return ret;
-}
-
-static DBusGConnection *
-get_system_bus (void)
-{
-        GError          *error;
-        DBusGConnection *bus;
-
-        error = NULL;
-        bus = dbus_g_bus_get (DBUS_BUS_SYSTEM, &error);
-        if (bus == NULL) {
-                g_warning ("Couldn't connect to system bus: %s", error->message);
-                g_error_free (error);
-        }
-        return bus;
-}
+#include "datetime-service.h"
 
 int
 main (int argc, char **argv)
 {
         GMainLoop             *loop;
         GsdDatetimeMechanism  *mechanism;
-        DBusGProxy            *bus_proxy;
-        DBusGConnection       *connection;
+        GOptionContext        *option_context;
+        GError                *error = NULL;
         int                    ret;
 
         ret = 1;
@@ -136,24 +48,20 @@ main (int argc, char **argv)
         dbus_g_thread_init ();
         g_type_init ();
 
-        connection = get_system_bus ();
-        if (connection == NULL) {
-                goto out;
-        }
-
-        bus_proxy = get_bus_proxy (connection);
-        if (bus_proxy == NULL) {
-                g_warning ("Could not construct bus_proxy object; bailing out");
+        option_context = g_option_context_new ("[ROOT...] - datetime mechanism");
+        g_option_context_add_main_entries (option_context, datetime_service_get_options (), NULL);
+        if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+                g_warning ("%s", error->message);
+                g_error_free (error);
+                g_option_context_free (option_context);
                 goto out;
         }
+        g_option_context_free (option_context);
 
-        if (!acquire_name_on_proxy (bus_proxy) ) {
-                g_warning ("Could not acquire name; bailing out");
+        if (datetime_service_run_once (argc, argv, &ret))
                 goto out;
-        }
-
-        mechanism = gsd_datetime_mechanism_new ();
 
+        mechanism = datetime_service_start (FALSE);
         if (mechanism == NULL) {
                 goto out;
         }
@@ -0,0 +1,207 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-object.h>
+
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#include "datetime.h"
+#include "datetime-peer.h"
+#include "parsers.h"
+
+static DBusServer *server = NULL;
+static guint n_connections = 0;
+static dbus_int32_t start_time_slot = -1;
+
+/* Anyone may connect; polkit decides what they may change, as on the
+ * bus. The start time of the peer is taken now, so that its PID can't
+ * name another process by the time polkit looks at it; a peer that's
+ * gone already is refused. */
+static dbus_bool_t
+allow_user (DBusConnection *connection,
+            unsigned long   uid,
+            void           *data)
+{
+        unsigned long pid;
+        guint64 *start_time;
+        char *path, *contents;
+        gboolean ok;
+
+        if (!dbus_connection_get_unix_process_id (connection, &pid))
+                return FALSE;
+
+        path = g_strdup_printf ("/proc/%lu/stat", pid);
+        ok = g_file_get_contents (path, &contents, NULL, NULL);
+        g_free (path);
+        if (!ok)
+                return FALSE;
+
+        start_time = g_new (guint64, 1);
+        ok = parse_proc_stat_start_time (contents, start_time);
+        g_free (contents);
+        if (!ok) {
+                g_free (start_time);
+                return FALSE;
+        }
+
+        return dbus_connection_set_data (connection, start_time_slot, start_time, g_free);
+}
+
+static DBusHandlerResult
+disconnected_filter (DBusConnection *connection,
+                     DBusMessage    *message,
+                     void           *user_data)
+{
+        GObject *object = user_data;
+
+        if (!dbus_message_is_signal (message, DBUS_INTERFACE_LOCAL, "Disconnected"))
+                return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+        g_debug ("Peer disconnected");
+        dbus_g_connection_unregister_g_object (dbus_connection_get_g_connection (connection), object);
+        dbus_connection_remove_filter (connection, disconnected_filter, user_data);
+        dbus_connection_unref (connection);
+        n_connections--;
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void
+new_connection (DBusServer     *server,
+                DBusConnection *connection,
+                void           *user_data)
+{
+        GObject *object = user_data;
+
+        g_debug ("Peer connected");
+
+        dbus_connection_ref (connection);
+        dbus_connection_set_exit_on_disconnect (connection, FALSE);
+        dbus_connection_set_unix_user_function (connection, allow_user, NULL, NULL);
+        dbus_connection_add_filter (connection, disconnected_filter, object, NULL);
+        dbus_connection_setup_with_g_main (connection, NULL);
+
+        dbus_g_connection_register_g_object (dbus_connection_get_g_connection (connection),
+                                             "/", object);
+        n_connections++;
+}
+
+gboolean
+datetime_peer_listen (const char  *path,
+                      GObject     *object,
+                      GError     **error)
+{
+        /* The only one that gives us credentials to check */
+        static const char *mechanisms[] = { "EXTERNAL", NULL };
+        DBusError derror;
+        struct stat st;
+        char *address, *dir;
+
+        g_return_val_if_fail (server == NULL, FALSE);
+
+        /* The socket's mode is set by path below, which is only safe in a
+         * directory no one else can put anything into */
+        dir = g_path_get_dirname (path);
+        g_mkdir_with_parents (dir, 0755);
+        if (lstat (dir, &st) != 0 || !S_ISDIR (st.st_mode) ||
+            st.st_uid != geteuid () || (st.st_mode & 022) != 0) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "%s must be a directory only we can write to", dir);
+                g_free (dir);
+                return FALSE;
+        }
+        g_free (dir);
+
+        /* A socket left by an earlier run would make the bind fail */
+        if (g_unlink (path) < 0 && errno != ENOENT) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Cannot remove %s: %s", path, g_strerror (errno));
+                return FALSE;
+        }
+
+        if (!dbus_connection_allocate_data_slot (&start_time_slot)) {
+                g_set_error_literal (error, GSD_DATETIME_MECHANISM_ERROR,
+                                     GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                                     "Out of memory");
+                return FALSE;
+        }
+
+        dbus_error_init (&derror);
+        address = g_strdup_printf ("unix:path=%s", path);
+        server = dbus_server_listen (address, &derror);
+        g_free (address);
+        if (server == NULL) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Cannot listen on %s: %s", path, derror.message);
+                dbus_error_free (&derror);
+                return FALSE;
+        }
+
+        /* Anyone may connect; polkit decides what they may change, as on
+         * the bus */
+        g_chmod (path, 0666);
+
+        dbus_server_set_auth_mechanisms (server, mechanisms);
+        dbus_server_set_new_connection_function (server, new_connection,
+                                                 g_object_ref (object), g_object_unref);
+        dbus_server_setup_with_g_main (server, NULL);
+        g_debug ("Listening on %s", path);
+
+        return TRUE;
+}
+
+gboolean
+datetime_peer_get_start_time (DBusConnection *connection,
+                              guint64        *start_time)
+{
+        guint64 *data;
+
+        if (start_time_slot == -1)
+                return FALSE;
+        data = dbus_connection_get_data (connection, start_time_slot);
+        if (data == NULL)
+                return FALSE;
+        *start_time = *data;
+
+        return TRUE;
+}
+
+guint
+datetime_peer_get_n_connections (void)
+{
+        return n_connections;
+}
@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __DATETIME_PEER_H__
+#define __DATETIME_PEER_H__
+
+#include <glib-object.h>
+#include <dbus/dbus.h>
+
+G_BEGIN_DECLS
+
+/* Serves object at / on peer-to-peer connections to the unix socket at
+ * path, as it is on the bus. Peers are authenticated by their
+ * credentials, for polkit to check. */
+gboolean datetime_peer_listen            (const char  *path,
+                                          GObject     *object,
+                                          GError     **error);
+/* The start time of the peer at the other end of connection, as it was
+ * when it connected; FALSE for a bus connection */
+gboolean datetime_peer_get_start_time    (DBusConnection *connection,
+                                          guint64        *start_time);
+guint    datetime_peer_get_n_connections (void);
+
+G_END_DECLS
+
+#endif /* __DATETIME_PEER_H__ */
@@ -0,0 +1,417 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <linux/rtc.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "config-writer.h"
+#include "datetime.h"
+#include "datetime-rtc.h"
+
+#define ETC_ADJTIME "/etc/adjtime"
+
+/* hwclock gives up on a drift factor past this, in seconds per day */
+#define MAX_DRIFT 2145.0
+/* Nor does it recalibrate from less than this, in seconds */
+#define MIN_CALIBRATION_INTERVAL (4 * 60 * 60)
+
+static const char *rtc_devices[] = { "/dev/rtc0", "/dev/rtc", NULL };
+
+/* Job steps call in from threads of their own: the cache, and each
+ * read-modify-write of the RTC and /etc/adjtime, are done under this */
+static GRecMutex rtc_lock;
+static ParsedAdjtime adjtime_cache;
+static struct stat adjtime_stat;
+static gboolean adjtime_cached = FALSE;
+
+static gboolean
+rtc_get_adjtime (ParsedAdjtime  *adjtime,
+                 GError        **error)
+{
+        struct stat st;
+        GError *our_error = NULL;
+        char *contents;
+        gboolean ret;
+
+        if (g_stat (ETC_ADJTIME, &st) == 0 && adjtime_cached &&
+            st.st_ino == adjtime_stat.st_ino &&
+            st.st_size == adjtime_stat.st_size &&
+            st.st_mtime == adjtime_stat.st_mtime) {
+                *adjtime = adjtime_cache;
+                return TRUE;
+        }
+
+        adjtime_cached = FALSE;
+
+        if (!g_file_get_contents (ETC_ADJTIME, &contents, NULL, &our_error)) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error reading /etc/adjtime file: %s", our_error->message);
+                g_error_free (our_error);
+                return FALSE;
+        }
+
+        ret = parse_adjtime (contents, adjtime, &our_error);
+        g_free (contents);
+
+        if (!ret) {
+                g_set_error_literal (error, GSD_DATETIME_MECHANISM_ERROR,
+                                     GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                                     our_error->message);
+                g_error_free (our_error);
+                return FALSE;
+        }
+
+        adjtime_cache = *adjtime;
+        adjtime_stat = st;
+        adjtime_cached = TRUE;
+
+        return TRUE;
+}
+
+gboolean
+datetime_rtc_get_adjtime (ParsedAdjtime  *adjtime,
+                          GError        **error)
+{
+        gboolean ret;
+
+        g_rec_mutex_lock (&rtc_lock);
+        ret = rtc_get_adjtime (adjtime, error);
+        g_rec_mutex_unlock (&rtc_lock);
+
+        return ret;
+}
+
+/* Without /etc/adjtime, hwclock takes the RTC to be in UTC, with no drift */
+static void
+get_adjtime_or_default (ParsedAdjtime *adjtime)
+{
+        if (!rtc_get_adjtime (adjtime, NULL)) {
+                memset (adjtime, 0, sizeof (ParsedAdjtime));
+                adjtime->utc = TRUE;
+        }
+}
+
+static gboolean
+write_adjtime (const ParsedAdjtime  *adjtime,
+               GError              **error)
+{
+        char drift[G_ASCII_DTOSTR_BUF_SIZE];
+        char adjust[G_ASCII_DTOSTR_BUF_SIZE];
+        char *contents;
+        GError *our_error = NULL;
+        ConfigTransaction *transaction;
+        gboolean ret;
+
+        contents = g_strdup_printf ("%s %" G_GINT64_FORMAT " %s\n%" G_GINT64_FORMAT "\n%s\n",
+                                    g_ascii_formatd (drift, sizeof (drift), "%f", adjtime->drift),
+                                    adjtime->last_adjust,
+                                    g_ascii_formatd (adjust, sizeof (adjust), "%f", adjtime->adjust),
+                                    adjtime->last_calibration,
+                                    adjtime->utc ? "UTC" : "LOCAL");
+
+        transaction = config_transaction_new ();
+        ret = config_transaction_set_contents (transaction, ETC_ADJTIME, contents, -1, &our_error) &&
+              config_transaction_commit (transaction, &our_error);
+        config_transaction_free (transaction);
+        g_free (contents);
+
+        if (!ret) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error writing /etc/adjtime file: %s", our_error->message);
+                g_error_free (our_error);
+        }
+
+        return ret;
+}
+
+static int
+rtc_open (int       flags,
+          GError  **error)
+{
+        int fd = -1;
+        int i;
+
+        for (i = 0; rtc_devices[i] != NULL && fd < 0; i++)
+                fd = open (rtc_devices[i], flags | O_CLOEXEC);
+
+        if (fd < 0)
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error opening the RTC: %s", strerror (errno));
+
+        return fd;
+}
+
+gboolean
+datetime_rtc_available (void)
+{
+        int i;
+
+        for (i = 0; rtc_devices[i] != NULL; i++)
+                if (g_file_test (rtc_devices[i], G_FILE_TEST_EXISTS))
+                        return TRUE;
+
+        return FALSE;
+}
+
+static gboolean
+rtc_read (gboolean   utc,
+          time_t    *t,
+          GError   **error)
+{
+        struct rtc_time rt;
+        struct tm tm;
+        int fd, ret;
+
+        if ((fd = rtc_open (O_RDONLY, error)) < 0)
+                return FALSE;
+
+        memset (&rt, 0, sizeof (rt));
+        ret = ioctl (fd, RTC_RD_TIME, &rt);
+        close (fd);
+
+        if (ret < 0) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error reading the RTC: %s", strerror (errno));
+                return FALSE;
+        }
+
+        memset (&tm, 0, sizeof (tm));
+        tm.tm_sec = rt.tm_sec;
+        tm.tm_min = rt.tm_min;
+        tm.tm_hour = rt.tm_hour;
+        tm.tm_mday = rt.tm_mday;
+        tm.tm_mon = rt.tm_mon;
+        tm.tm_year = rt.tm_year;
+        tm.tm_isdst = -1;
+
+        if (!utc)
+                tzset ();
+        *t = utc ? timegm (&tm) : mktime (&tm);
+
+        return TRUE;
+}
+
+static gboolean
+rtc_write (gboolean   utc,
+           time_t     t,
+           GError   **error)
+{
+        struct rtc_time rt;
+        struct tm tm;
+        int fd, ret;
+
+        if (utc) {
+                gmtime_r (&t, &tm);
+        } else {
+                /* localtime_r() doesn't look at /etc/localtime again by
+                 * itself, and the zone may have just been set */
+                tzset ();
+                localtime_r (&t, &tm);
+        }
+
+        memset (&rt, 0, sizeof (rt));
+        rt.tm_sec = tm.tm_sec;
+        rt.tm_min = tm.tm_min;
+        rt.tm_hour = tm.tm_hour;
+        rt.tm_mday = tm.tm_mday;
+        rt.tm_mon = tm.tm_mon;
+        rt.tm_year = tm.tm_year;
+        rt.tm_wday = tm.tm_wday;
+        rt.tm_yday = tm.tm_yday;
+        rt.tm_isdst = 0;
+
+        if ((fd = rtc_open (O_RDONLY, error)) < 0)
+                return FALSE;
+
+        ret = ioctl (fd, RTC_SET_TIME, &rt);
+        close (fd);
+
+        if (ret < 0) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error setting the RTC: %s", strerror (errno));
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* What the RTC should have said, had it not drifted since it was last
+ * set */
+static time_t
+rtc_correct (const ParsedAdjtime *adjtime,
+             time_t               rtc)
+{
+        double drift;
+
+        if (adjtime->last_adjust <= 0)
+                return rtc;
+
+        drift = adjtime->drift * (rtc - adjtime->last_adjust) / 86400.0;
+        return rtc + (time_t) (drift >= 0 ? drift + 0.5 : drift - 0.5);
+}
+
+static gboolean
+rtc_hctosys (guint    tolerance,
+             GError **error)
+{
+        ParsedAdjtime adjtime;
+        struct timeval tv;
+        time_t rtc;
+
+        get_adjtime_or_default (&adjtime);
+
+        if (!rtc_read (adjtime.utc, &rtc, error))
+                return FALSE;
+
+        tv.tv_sec = rtc_correct (&adjtime, rtc);
+        tv.tv_usec = 0;
+
+        if (tolerance > 0 && ABS ((gint64) tv.tv_sec - (gint64) time (NULL)) <= tolerance)
+                return TRUE;
+
+        g_debug ("Setting the system time from the RTC (drift %f s/day)", adjtime.drift);
+
+        if (settimeofday (&tv, NULL) != 0) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error calling settimeofday(): %s", strerror (errno));
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+gboolean
+datetime_rtc_hctosys (guint    tolerance,
+                      GError **error)
+{
+        gboolean ret;
+
+        g_rec_mutex_lock (&rtc_lock);
+        ret = rtc_hctosys (tolerance, error);
+        g_rec_mutex_unlock (&rtc_lock);
+
+        return ret;
+}
+
+static gboolean
+rtc_systohc (DatetimeRtcMode   mode,
+             GError          **error)
+{
+        ParsedAdjtime adjtime;
+        gboolean utc;
+        time_t rtc, now;
+
+        get_adjtime_or_default (&adjtime);
+
+        utc = mode == DATETIME_RTC_MODE_KEEP ? adjtime.utc : mode == DATETIME_RTC_MODE_UTC;
+
+        /* How far the RTC went since it was last calibrated tells how fast
+         * it drifts; it can only be compared in the mode it was kept in */
+        if (utc == adjtime.utc &&
+            adjtime.last_calibration > 0 &&
+            rtc_read (adjtime.utc, &rtc, NULL) &&
+            rtc - adjtime.last_calibration >= MIN_CALIBRATION_INTERVAL) {
+                now = time (NULL);
+                adjtime.drift += (double) (now - rtc_correct (&adjtime, rtc)) * 86400.0 /
+                                 (rtc - adjtime.last_calibration);
+                if (ABS (adjtime.drift) > MAX_DRIFT)
+                        adjtime.drift = 0.0;
+                g_debug ("RTC drift is now %f s/day", adjtime.drift);
+        }
+
+        now = time (NULL);
+        if (!rtc_write (utc, now, error))
+                return FALSE;
+
+        adjtime.last_adjust = now;
+        adjtime.adjust = 0.0;
+        adjtime.last_calibration = now;
+        adjtime.utc = utc;
+
+        return write_adjtime (&adjtime, error);
+}
+
+gboolean
+datetime_rtc_systohc (DatetimeRtcMode   mode,
+                      GError          **error)
+{
+        gboolean ret;
+
+        g_rec_mutex_lock (&rtc_lock);
+        ret = rtc_systohc (mode, error);
+        g_rec_mutex_unlock (&rtc_lock);
+
+        return ret;
+}
+
+static gboolean
+rtc_rezone (GError **error)
+{
+        ParsedAdjtime adjtime;
+        time_t now;
+
+        get_adjtime_or_default (&adjtime);
+        if (adjtime.utc)
+                return TRUE;
+
+        now = time (NULL);
+        if (!rtc_write (FALSE, now, error))
+                return FALSE;
+
+        /* What the RTC said was in the old zone, so it tells nothing of
+         * the drift; that is measured again from here */
+        adjtime.last_adjust = now;
+        adjtime.adjust = 0.0;
+        adjtime.last_calibration = now;
+
+        return write_adjtime (&adjtime, error);
+}
+
+gboolean
+datetime_rtc_rezone (GError **error)
+{
+        gboolean ret;
+
+        g_rec_mutex_lock (&rtc_lock);
+        ret = rtc_rezone (error);
+        g_rec_mutex_unlock (&rtc_lock);
+
+        return ret;
+}
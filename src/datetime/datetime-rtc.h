@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __DATETIME_RTC_H__
+#define __DATETIME_RTC_H__
+
+#include <glib.h>
+
+#include "parsers.h"
+
+G_BEGIN_DECLS
+
+/* Reads and sets the RTC through /dev/rtc, the way hwclock does, using
+ * and maintaining the drift factor kept in /etc/adjtime */
+
+typedef enum
+{
+        DATETIME_RTC_MODE_KEEP,
+        DATETIME_RTC_MODE_LOCAL,
+        DATETIME_RTC_MODE_UTC
+} DatetimeRtcMode;
+
+/* Cached for as long as stat() of /etc/adjtime says the same */
+gboolean datetime_rtc_get_adjtime (ParsedAdjtime    *adjtime,
+                                   GError          **error);
+
+gboolean datetime_rtc_available   (void);
+
+/* Set the system time from the RTC, corrected for drift, unless they are
+ * no more than tolerance seconds apart. The RTC and /etc/adjtime are left
+ * alone, as with hwclock --hctosys. */
+gboolean datetime_rtc_hctosys     (guint             tolerance,
+                                   GError          **error);
+
+/* Set the RTC from the system time, in the given mode, and update the
+ * drift factor from how far the RTC had gone, as with hwclock --systohc */
+gboolean datetime_rtc_systohc     (DatetimeRtcMode   mode,
+                                   GError          **error);
+
+/* After the system zone changed: a local RTC is set again, in the new
+ * zone. A UTC one is left alone. */
+gboolean datetime_rtc_rezone      (GError          **error);
+
+G_END_DECLS
+
+#endif /* __DATETIME_RTC_H__ */
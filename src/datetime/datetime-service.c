@@ -0,0 +1,284 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2007 David Zeuthen <david@fubar.dk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+
+#include "datetime.h"
+#include "datetime-peer.h"
+#include "datetime-rtc.h"
+#include "datetime-service.h"
+#include "datetime-stamp.h"
+#include "system-timezone.h"
+
+static DBusGProxy *
+get_bus_proxy (DBusGConnection *connection)
+{
+        DBusGProxy *bus_proxy;
+
+	bus_proxy = dbus_g_proxy_new_for_name (connection,
+                                               DBUS_SERVICE_DBUS,
+                                               DBUS_PATH_DBUS,
+                                               DBUS_INTERFACE_DBUS);
+        return bus_proxy;
+}
+
+#define BUS_NAME "org.opensettings.DateTimeMechanism"
+
+static double rate_limit = 0.0;
+static gint rate_burst = 10;
+static double total_rate_limit = 0.0;
+static gboolean hctosys = FALSE;
+static gint rtc_sync_interval = 0;
+static gboolean restore_clock = FALSE;
+static gint clock_stamp_interval = 0;
+static gboolean persistent = FALSE;
+static char *p2p_socket = NULL;
+static char *roots_timezone = NULL;
+static gboolean hard_links = FALSE;
+
+static GOptionEntry entries[] = {
+        { "rate-limit", 'r', 0, G_OPTION_ARG_DOUBLE, &rate_limit, "Let each client make RATE expensive requests per second (default: no limit)", "RATE" },
+        { "rate-burst", 'b', 0, G_OPTION_ARG_INT, &rate_burst, "Let each client make up to N requests at once", "N" },
+        { "total-rate-limit", 't', 0, G_OPTION_ARG_DOUBLE, &total_rate_limit, "Serve RATE expensive requests per second in all (default: no limit)", "RATE" },
+        { "hctosys", 0, 0, G_OPTION_ARG_NONE, &hctosys, "Set the system time from the RTC, corrected for drift, and exit", NULL },
+        { "rtc-sync-interval", 0, 0, G_OPTION_ARG_INT, &rtc_sync_interval, "Set the system time from the RTC every SEC seconds, and stay running", "SEC" },
+        { "restore-clock", 0, 0, G_OPTION_ARG_NONE, &restore_clock, "Move the system time forward to the last time saved, and exit", NULL },
+        { "clock-stamp-interval", 0, 0, G_OPTION_ARG_INT, &clock_stamp_interval, "Save the time every SEC seconds, and stay running", "SEC" },
+        { "persistent", 0, 0, G_OPTION_ARG_NONE, &persistent, "Don't exit when idle, so TimeChanged and TimezoneOffsetChanged are always sent", NULL },
+        { "p2p-socket", 'p', 0, G_OPTION_ARG_FILENAME, &p2p_socket, "Also serve peer-to-peer connections on the unix socket at PATH, and stay running", "PATH" },
+        { "set-timezone-for-roots", 0, 0, G_OPTION_ARG_STRING, &roots_timezone, "Set the timezone to TZ in each system tree ROOT given, and exit", "TZ" },
+        { "hard-links", 0, 0, G_OPTION_ARG_NONE, &hard_links, "Have the trees' copies of the zone file share data as hard links, not reflinks", NULL },
+        { NULL }
+};
+
+static gboolean
+acquire_name_on_proxy (DBusGProxy *bus_proxy)
+{
+        GError     *error;
+        guint       result;
+        gboolean    res;
+        gboolean    ret;
+
+        ret = FALSE;
+
+        if (bus_proxy == NULL) {
+                goto out;
+        }
+
+        error = NULL;
+	res = dbus_g_proxy_call (bus_proxy,
+                                 "RequestName",
+                                 &error,
+                                 G_TYPE_STRING, BUS_NAME,
+                                 G_TYPE_UINT, 0,
+                                 G_TYPE_INVALID,
+                                 G_TYPE_UINT, &result,
+                                 G_TYPE_INVALID);
+        if (! res) {
+                if (error != NULL) {
+                        g_warning ("Failed to acquire %s: %s", BUS_NAME, error->message);
+                        g_error_free (error);
+                } else {
+                        g_warning ("Failed to acquire %s", BUS_NAME);
+                }
+                goto out;
+	}
+
+ 	if (result != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+                if (error != NULL) {
+                        g_warning ("Failed to acquire %s: %s", BUS_NAME, error->message);
+                        g_error_free (error);
+                } else {
+                        g_warning ("Failed to acquire %s", BUS_NAME);
+                }
+                goto out;
+        }
+
+        ret = TRUE;
+
+ out:
+        return ret;
+}
+
+/* Prints a line per root, and returns whether they were all set */
+static gboolean
+set_timezone_for_roots (const char  *tz,
+                        char       **roots,
+                        int          n_roots)
+{
+        GError **errors;
+        GError  *error = NULL;
+        gboolean ret;
+        char    *zone;
+        int      i;
+
+        if (n_roots <= 0) {
+                g_warning ("No root given");
+                return FALSE;
+        }
+
+        while (*tz == '/')
+                tz++;
+
+        zone = system_timezone_canonicalize (tz, &error);
+        if (zone == NULL) {
+                g_warning ("%s", error->message);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        errors = g_new0 (GError *, n_roots);
+        system_timezone_set_for_roots (zone, (const char * const *) roots,
+                                       n_roots, hard_links, errors);
+
+        ret = TRUE;
+        for (i = 0; i < n_roots; i++) {
+                if (errors[i] == NULL) {
+                        g_print ("%s: %s\n", roots[i], zone);
+                        continue;
+                }
+                g_printerr ("%s: %s\n", roots[i], errors[i]->message);
+                g_error_free (errors[i]);
+                ret = FALSE;
+        }
+
+        g_free (errors);
+        g_free (zone);
+
+        return ret;
+}
+
+static DBusGConnection *
+get_system_bus (void)
+{
+        GError          *error;
+        DBusGConnection *bus;
+
+        error = NULL;
+        bus = dbus_g_bus_get (DBUS_BUS_SYSTEM, &error);
+        if (bus == NULL) {
+                g_warning ("Couldn't connect to system bus: %s", error->message);
+                g_error_free (error);
+        }
+        return bus;
+}
+
+const GOptionEntry *
+datetime_service_get_options (void)
+{
+        return entries;
+}
+
+gboolean
+datetime_service_run_once (int   argc,
+                           char **argv,
+                           int  *status)
+{
+        GError *error = NULL;
+
+        /* For building images: nothing but files to write */
+        if (roots_timezone != NULL) {
+                *status = set_timezone_for_roots (roots_timezone, argv + 1, argc - 1) ? 0 : 1;
+                return TRUE;
+        }
+
+        /* Boot modes, no need for the bus. With both, the saved time is a
+         * floor for what the RTC says. */
+        if (hctosys || restore_clock) {
+                *status = 0;
+                if (hctosys && !datetime_rtc_hctosys (0, &error)) {
+                        g_warning ("%s", error->message);
+                        g_clear_error (&error);
+                        *status = 1;
+                }
+                if (restore_clock && !datetime_stamp_restore (&error)) {
+                        g_warning ("%s", error->message);
+                        g_clear_error (&error);
+                        *status = 1;
+                }
+                return TRUE;
+        }
+
+        return FALSE;
+}
+
+GsdDatetimeMechanism *
+datetime_service_start (gboolean stay)
+{
+        GsdDatetimeMechanism  *mechanism;
+        DBusGProxy            *bus_proxy;
+        DBusGConnection       *connection;
+        GError                *error = NULL;
+
+        connection = get_system_bus ();
+        if (connection == NULL) {
+                return NULL;
+        }
+
+        bus_proxy = get_bus_proxy (connection);
+        if (bus_proxy == NULL) {
+                g_warning ("Could not construct bus_proxy object; bailing out");
+                return NULL;
+        }
+
+        if (!acquire_name_on_proxy (bus_proxy) ) {
+                g_warning ("Could not acquire name; bailing out");
+                return NULL;
+        }
+
+        mechanism = gsd_datetime_mechanism_new ();
+
+        if (mechanism == NULL) {
+                return NULL;
+        }
+
+        gsd_datetime_mechanism_set_rate_limit (mechanism, rate_limit, MAX (rate_burst, 1), total_rate_limit);
+        gsd_datetime_mechanism_set_rtc_sync_interval (mechanism, MAX (rtc_sync_interval, 0));
+        gsd_datetime_mechanism_set_clock_stamp_interval (mechanism, MAX (clock_stamp_interval, 0));
+        /* Peers can't start us the way the bus does */
+        gsd_datetime_mechanism_set_persistent (mechanism, stay || persistent || p2p_socket != NULL);
+
+        if (p2p_socket != NULL &&
+            !datetime_peer_listen (p2p_socket, G_OBJECT (mechanism), &error)) {
+                g_warning ("%s", error->message);
+                g_clear_error (&error);
+        }
+
+        return mechanism;
+}
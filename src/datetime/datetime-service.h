@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __DATETIME_SERVICE_H__
+#define __DATETIME_SERVICE_H__
+
+#include <glib.h>
+
+#include "datetime.h"
+
+G_BEGIN_DECLS
+
+/* The datetime mechanism, for whatever main loop runs it: this daemon's
+ * own, or the one it shares with the others in opensettings-daemon */
+
+const GOptionEntry   *datetime_service_get_options (void);
+
+/* Does the work of the modes that don't serve anything, like --hctosys,
+ * returning TRUE if one was asked for, with the exit status in status.
+ * argv holds what the options left. */
+gboolean              datetime_service_run_once    (int                   argc,
+                                                    char                **argv,
+                                                    int                  *status);
+
+/* Owns the name on the system bus and exports the mechanism. With stay,
+ * it never exits when idle. */
+GsdDatetimeMechanism *datetime_service_start       (gboolean              stay);
+
+G_END_DECLS
+
+#endif /* __DATETIME_SERVICE_H__ */
@@ -0,0 +1,119 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "datetime.h"
+#include "datetime-stamp.h"
+
+/* Kept open, so saving is a single syscall */
+static int stamp_fd = -1;
+G_LOCK_DEFINE_STATIC (stamp);
+
+gboolean
+datetime_stamp_save (gboolean   backwards,
+                     GError   **error)
+{
+        struct stat st;
+        struct timespec now;
+        char *dir;
+        int ret;
+
+        G_LOCK (stamp);
+
+        if (stamp_fd < 0) {
+                dir = g_path_get_dirname (DATETIME_STAMP_FILE);
+                g_mkdir_with_parents (dir, 0755);
+                g_free (dir);
+                stamp_fd = open (DATETIME_STAMP_FILE, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        }
+
+        if (stamp_fd < 0) {
+                ret = -1;
+        } else if (!backwards && fstat (stamp_fd, &st) == 0 &&
+                   clock_gettime (CLOCK_REALTIME, &now) == 0 &&
+                   (now.tv_sec < st.st_mtim.tv_sec ||
+                    (now.tv_sec == st.st_mtim.tv_sec && now.tv_nsec <= st.st_mtim.tv_nsec))) {
+                g_debug ("The time is behind " DATETIME_STAMP_FILE ", leaving it");
+                ret = 0;
+        } else {
+                ret = futimens (stamp_fd, NULL);
+        }
+
+        G_UNLOCK (stamp);
+
+        if (ret != 0) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error saving the time to " DATETIME_STAMP_FILE ": %s",
+                             strerror (errno));
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+gboolean
+datetime_stamp_restore (GError **error)
+{
+        struct stat st;
+        struct timeval tv;
+
+        if (g_stat (DATETIME_STAMP_FILE, &st) != 0) {
+                /* Nothing saved yet */
+                if (errno == ENOENT)
+                        return TRUE;
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error reading " DATETIME_STAMP_FILE ": %s",
+                             strerror (errno));
+                return FALSE;
+        }
+
+        gettimeofday (&tv, NULL);
+        if (tv.tv_sec >= st.st_mtim.tv_sec)
+                return TRUE;
+
+        g_debug ("Moving the time forward to the last known good time");
+
+        tv.tv_sec = st.st_mtim.tv_sec;
+        tv.tv_usec = st.st_mtim.tv_nsec / 1000;
+        if (settimeofday (&tv, NULL) != 0) {
+                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
+                             "Error calling settimeofday(): %s", strerror (errno));
+                return FALSE;
+        }
+
+        return TRUE;
+}
@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __DATETIME_STAMP_H__
+#define __DATETIME_STAMP_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The last known good time, kept as the modification time of an empty
+ * file, for hosts without a battery-backed RTC: saved whenever the time
+ * is set and periodically, restored at boot */
+#define DATETIME_STAMP_FILE "/var/lib/opensettings/clock"
+
+/* One fstat() and futimens() once the file is open. Safe from any
+ * thread. Unless backwards is set, for when the time was set on purpose,
+ * the stamp only ever moves forward: a clock that hasn't been restored
+ * yet mustn't overwrite the last known good time. */
+gboolean datetime_stamp_save    (gboolean   backwards,
+                                 GError   **error);
+
+/* Move the system time forward to the stamp, never backwards */
+gboolean datetime_stamp_restore (GError   **error);
+
+G_END_DECLS
+
+#endif /* __DATETIME_STAMP_H__ */
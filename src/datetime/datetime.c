@@ -28,11 +28,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <sys/time.h>
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
@@ -43,15 +45,42 @@
 
 #include "datetime.h"
 #include "datetime-glue.h"
+#include "datetime-clock.h"
+#include "datetime-job.h"
+#include "datetime-peer.h"
+#include "datetime-rtc.h"
+#include "datetime-stamp.h"
+#include "fair-queue.h"
 
 /* NTP helper functions for various distributions */
 #include "datetime-ataraxia.h"
 #include "datetime-devuan.h"
 
+/* Writes running in a thread, see SetTimezone and Apply */
+static guint n_threads = 0;
+
+/* Calls waiting for their turn, see _admit () */
+static guint n_deferred = 0;
+
+/* Periodic work that keeps the daemon around, see
+ * gsd_datetime_mechanism_set_rtc_sync_interval () and
+ * gsd_datetime_mechanism_set_clock_stamp_interval (), or being told to
+ * stay for the sake of TimeChanged listeners */
+static guint rtc_sync_id = 0;
+static guint clock_stamp_id = 0;
+static gboolean persistent = FALSE;
+
 static gboolean
 do_exit (gpointer user_data)
 {
+        /* Not while a reply is still owed */
+        if (persistent || rtc_sync_id > 0 || clock_stamp_id > 0 ||
+            datetime_job_get_n_running () > 0 || n_threads > 0 || n_deferred > 0 ||
+            datetime_peer_get_n_connections () > 0)
+                return TRUE;
+
         g_debug ("Exiting due to inactivity");
+        datetime_stamp_save (FALSE, NULL);
         exit (1);
         return FALSE;
 }
@@ -73,9 +102,64 @@ struct GsdDatetimeMechanismPrivate
         DBusGConnection *system_bus_connection;
         DBusGProxy      *system_bus_proxy;
         PolkitAuthority *auth;
+
+        /* Per-sender rate limits, NULL for none */
+        FairQueue       *limiter;
+
+        /* SetUsingNtp requests only move the target; one job at a time
+           converges the system to the latest target, and every caller
+           waiting meanwhile gets the outcome of the last job */
+        gboolean         ntp_target;
+        gboolean         ntp_job_target;
+        gboolean         ntp_busy;
+        GSList          *ntp_waiters;  /* NtpWaiter */
+
+        /* Timezone writes, SetTimezone's and Apply's, run one at a time
+           in the order they came in; the first is running. The last one
+           is the zone the system is headed for. */
+        GQueue          *tz_writes;  /* TimezoneWrite */
+
+        /* Zone last found in /etc/localtime, good for as long as lstat()
+           of it gives the same result */
+        char            *tz_current;
+        struct stat      tz_current_stat;
+};
+
+typedef void (*NtpDoneFunc) (const GError *error,
+                             gpointer      user_data);
+
+typedef struct
+{
+        NtpDoneFunc  func;
+        gpointer     user_data;
+} NtpWaiter;
+
+typedef struct
+{
+        GTask                *task;
+        GTaskThreadFunc       func;
+        char                 *zone;
+} TimezoneWrite;
+
+/* A SetTimezone write, which callers asking for the same zone right after
+   it join */
+typedef struct
+{
+        char                 *zone;
+        GSList               *waiters;
+} TimezoneFlight;
+
+enum {
+        JOB_PROGRESS,
+        TIME_CHANGED,
+        TIMEZONE_OFFSET_CHANGED,
+        LAST_SIGNAL
 };
 
+static guint signals[LAST_SIGNAL] = { 0 };
+
 static void     gsd_datetime_mechanism_finalize    (GObject     *object);
+static void     timezone_write_free                (gpointer     data);
 
 G_DEFINE_TYPE (GsdDatetimeMechanism, gsd_datetime_mechanism, G_TYPE_OBJECT)
 
@@ -108,6 +192,7 @@ gsd_datetime_mechanism_error_get_type (void)
                                 ENUM_ENTRY (GSD_DATETIME_MECHANISM_ERROR_GENERAL, "GeneralError"),
                                 ENUM_ENTRY (GSD_DATETIME_MECHANISM_ERROR_NOT_PRIVILEGED, "NotPrivileged"),
                                 ENUM_ENTRY (GSD_DATETIME_MECHANISM_ERROR_INVALID_TIMEZONE_FILE, "InvalidTimezoneFile"),
+                                ENUM_ENTRY (GSD_DATETIME_MECHANISM_ERROR_LIMITS_EXCEEDED, "LimitsExceeded"),
                                 { 0, 0, 0 }
                         };
                 
@@ -145,6 +230,33 @@ gsd_datetime_mechanism_class_init (GsdDatetimeMechanismClass *klass)
 
         g_type_class_add_private (klass, sizeof (GsdDatetimeMechanismPrivate));
 
+        signals[JOB_PROGRESS] = g_signal_new ("job-progress",
+                                              G_TYPE_FROM_CLASS (klass),
+                                              G_SIGNAL_RUN_LAST,
+                                              0,
+                                              NULL, NULL,
+                                              g_cclosure_marshal_generic,
+                                              G_TYPE_NONE, 3,
+                                              G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT);
+
+        signals[TIME_CHANGED] = g_signal_new ("time-changed",
+                                              G_TYPE_FROM_CLASS (klass),
+                                              G_SIGNAL_RUN_LAST,
+                                              0,
+                                              NULL, NULL,
+                                              g_cclosure_marshal_generic,
+                                              G_TYPE_NONE, 2,
+                                              G_TYPE_INT64, G_TYPE_INT64);
+
+        signals[TIMEZONE_OFFSET_CHANGED] = g_signal_new ("timezone-offset-changed",
+                                                         G_TYPE_FROM_CLASS (klass),
+                                                         G_SIGNAL_RUN_LAST,
+                                                         0,
+                                                         NULL, NULL,
+                                                         g_cclosure_marshal_generic,
+                                                         G_TYPE_NONE, 3,
+                                                         G_TYPE_INT, G_TYPE_INT, G_TYPE_STRING);
+
         dbus_g_object_type_install_info (GSD_DATETIME_TYPE_MECHANISM, &dbus_glib_gsd_datetime_mechanism_object_info);
 
         dbus_g_error_domain_register (GSD_DATETIME_MECHANISM_ERROR, NULL, GSD_DATETIME_MECHANISM_TYPE_ERROR);
@@ -156,6 +268,8 @@ gsd_datetime_mechanism_init (GsdDatetimeMechanism *mechanism)
 {
         mechanism->priv = GSD_DATETIME_MECHANISM_GET_PRIVATE (mechanism);
 
+        mechanism->priv->tz_writes = g_queue_new ();
+
 }
 
 static void
@@ -171,10 +285,41 @@ gsd_datetime_mechanism_finalize (GObject *object)
         g_return_if_fail (mechanism->priv != NULL);
 
         g_object_unref (mechanism->priv->system_bus_proxy);
+        g_queue_free_full (mechanism->priv->tz_writes, timezone_write_free);
+        g_free (mechanism->priv->tz_current);
+        datetime_clock_watch_stop ();
+        datetime_offset_watch_stop ();
+        if (mechanism->priv->limiter != NULL)
+                fair_queue_free (mechanism->priv->limiter);
 
         G_OBJECT_CLASS (gsd_datetime_mechanism_parent_class)->finalize (object);
 }
 
+static void
+clock_changed_cb (gint64   old_realtime,
+                  gint64   new_realtime,
+                  gpointer user_data)
+{
+        GsdDatetimeMechanism *mechanism = user_data;
+
+        g_signal_emit (mechanism, signals[TIME_CHANGED], 0, old_realtime, new_realtime);
+
+        /* The time may be on the other side of a transition now */
+        datetime_offset_watch_update ();
+}
+
+static void
+offset_changed_cb (gint32      old_offset,
+                   gint32      new_offset,
+                   const char *abbrev,
+                   gpointer    user_data)
+{
+        GsdDatetimeMechanism *mechanism = user_data;
+
+        g_signal_emit (mechanism, signals[TIMEZONE_OFFSET_CHANGED], 0,
+                       old_offset, new_offset, abbrev);
+}
+
 static gboolean
 register_mechanism (GsdDatetimeMechanism *mechanism)
 {
@@ -206,6 +351,16 @@ register_mechanism (GsdDatetimeMechanism *mechanism)
                                                                       DBUS_PATH_DBUS,
                                                                       DBUS_INTERFACE_DBUS);
 
+        /* Covers changes made by anyone, us included */
+        if (!datetime_clock_watch_start (clock_changed_cb, mechanism, &error)) {
+                g_warning ("%s", error->message);
+                g_clear_error (&error);
+        }
+        if (!datetime_offset_watch_start (offset_changed_cb, mechanism, &error)) {
+                g_warning ("%s", error->message);
+                g_clear_error (&error);
+        }
+
         reset_killtimer ();
 
         return TRUE;
@@ -232,11 +387,71 @@ gsd_datetime_mechanism_new (void)
         return GSD_DATETIME_MECHANISM (object);
 }
 
+/* The caller is its bus name on the bus, and the process at the other
+ * end of the socket on a peer-to-peer connection */
+static PolkitSubject *
+_polkit_subject (DBusGMethodInvocation *context)
+{
+        DBusConnection *connection;
+        PolkitSubject *subject;
+        unsigned long pid, uid;
+        guint64 start_time;
+        char *sender;
+
+        sender = dbus_g_method_get_sender (context);
+        if (sender != NULL) {
+                subject = polkit_system_bus_name_new (sender);
+                g_free (sender);
+                return subject;
+        }
+
+        /* With the start time, polkit refuses a process that merely got
+         * the same PID after the peer exited */
+        connection = dbus_g_connection_get_connection (dbus_g_method_invocation_get_g_connection (context));
+        if (!dbus_connection_get_unix_process_id (connection, &pid) ||
+            !dbus_connection_get_unix_user (connection, &uid) ||
+            !datetime_peer_get_start_time (connection, &start_time))
+                return NULL;
+
+        return polkit_unix_process_new_for_owner (pid, start_time, uid);
+}
+
+/* Who the limiter counts a call against */
+static char *
+_client_key (DBusGMethodInvocation *context)
+{
+        DBusConnection *connection;
+        unsigned long pid;
+        char *sender;
+
+        sender = dbus_g_method_get_sender (context);
+        if (sender != NULL)
+                return sender;
+
+        connection = dbus_g_connection_get_connection (dbus_g_method_invocation_get_g_connection (context));
+        if (!dbus_connection_get_unix_process_id (connection, &pid))
+                return g_strdup ("pid:unknown");
+
+        return g_strdup_printf ("pid:%lu", pid);
+}
+
+static void
+_return_unknown_caller (DBusGMethodInvocation *context)
+{
+        GError *error;
+
+        error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_NOT_PRIVILEGED,
+                             "Cannot tell who the caller is");
+        dbus_g_method_return_error (context, error);
+        g_error_free (error);
+}
+
 static gboolean
-_check_polkit_for_action (GsdDatetimeMechanism *mechanism, DBusGMethodInvocation *context)
+_check_polkit_for (GsdDatetimeMechanism  *mechanism,
+                   const char            *action,
+                   DBusGMethodInvocation *context)
 {
-        const char *action = "org.opensettings.datetimemechanism.configure";
-        const char *sender;
         GError *error;
         PolkitSubject *subject;
         PolkitAuthorizationResult *result;
@@ -244,8 +459,11 @@ _check_polkit_for_action (GsdDatetimeMechanism *mechanism, DBusGMethodInvocation
         error = NULL;
 
         /* Check that caller is privileged */
-        sender = dbus_g_method_get_sender (context);
-        subject = polkit_system_bus_name_new (sender);
+        subject = _polkit_subject (context);
+        if (subject == NULL) {
+                _return_unknown_caller (context);
+                return FALSE;
+        }
 
         result = polkit_authority_check_authorization_sync (mechanism->priv->auth,
                                                             subject,
@@ -279,36 +497,110 @@ _check_polkit_for_action (GsdDatetimeMechanism *mechanism, DBusGMethodInvocation
 }
 
 static gboolean
-_sync_hwclock (DBusGMethodInvocation *context)
+_check_polkit_for_action (GsdDatetimeMechanism *mechanism, DBusGMethodInvocation *context)
 {
-        GError *error;
+        return _check_polkit_for (mechanism,
+                                  "org.opensettings.datetimemechanism.configure",
+                                  context);
+}
 
-        error = NULL;
+static void
+job_progress_cb (DatetimeJob *job,
+                 guint        step,
+                 guint        n_steps,
+                 gpointer     user_data)
+{
+        GsdDatetimeMechanism *mechanism = user_data;
 
-        if (g_file_test ("/sbin/hwclock",
-                         G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR | G_FILE_TEST_IS_EXECUTABLE)) {
-                int exit_status;
-                if (!g_spawn_command_line_sync ("/sbin/hwclock --systohc", NULL, NULL, &exit_status, &error)) {
-                        GError *error2;
-                        error2 = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                              GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                              "Error spawning /sbin/hwclock: %s", error->message);
-                        g_error_free (error);
-                        dbus_g_method_return_error (context, error2);
-                        g_error_free (error2);
-                        return FALSE;
-                }
-                if (WEXITSTATUS (exit_status) != 0) {
-                        error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                             "/sbin/hwclock returned %d", exit_status);
-                        dbus_g_method_return_error (context, error);
-                        g_error_free (error);
-                        return FALSE;
-                }
+        g_signal_emit (mechanism, signals[JOB_PROGRESS], 0,
+                       datetime_job_get_name (job), step, n_steps);
+}
+
+static void
+job_reply_cb (GObject      *source,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+        DBusGMethodInvocation *context = user_data;
+        GError *error = NULL;
+
+        if (datetime_job_finish (result, NULL, &error))
+                dbus_g_method_return (context);
+        else {
+                dbus_g_method_return_error (context, error);
+                g_error_free (error);
         }
 
-        return TRUE;
+        reset_killtimer ();
+}
+
+/* Replies to context, which takes no out arguments, once the job is done */
+static void
+_run_job (GsdDatetimeMechanism  *mechanism,
+          DatetimeJob           *job,
+          DBusGMethodInvocation *context)
+{
+        datetime_job_set_progress_func (job, job_progress_cb, mechanism);
+        datetime_job_run (job, job_reply_cb, context);
+}
+
+static gboolean
+rtc_systohc_step (gpointer   user_data,
+                  GError   **error)
+{
+        return datetime_rtc_systohc (GPOINTER_TO_INT (user_data), error);
+}
+
+/* A local RTC follows the zone */
+static gboolean
+rtc_rezone_step (gpointer   user_data,
+                 GError   **error)
+{
+        return datetime_rtc_rezone (error);
+}
+
+static gboolean
+stamp_step (gpointer   user_data,
+            GError   **error)
+{
+        return datetime_stamp_save (TRUE, error);
+}
+
+/* Not worth failing a call over */
+static void
+_add_stamp_step (DatetimeJob *job)
+{
+        datetime_job_add_func_step (job, TRUE, stamp_step, NULL);
+}
+
+static void
+_add_hwclock_step (DatetimeJob *job,
+                   const char  *mode)
+{
+        DatetimeRtcMode rtc_mode;
+
+        /* No need to spawn hwclock when the RTC can be set from here */
+        if (datetime_rtc_available ()) {
+                if (mode == NULL)
+                        rtc_mode = DATETIME_RTC_MODE_KEEP;
+                else if (strcmp (mode, "--utc") == 0)
+                        rtc_mode = DATETIME_RTC_MODE_UTC;
+                else
+                        rtc_mode = DATETIME_RTC_MODE_LOCAL;
+                datetime_job_add_func_step (job, FALSE, rtc_systohc_step, GINT_TO_POINTER (rtc_mode));
+                return;
+        }
+
+        if (!g_file_test ("/sbin/hwclock",
+                          G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR | G_FILE_TEST_IS_EXECUTABLE))
+                return;
+
+        if (mode != NULL)
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, FALSE,
+                                       "/sbin/hwclock", mode, "--systohc", NULL);
+        else
+                datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, FALSE,
+                                       "/sbin/hwclock", "--systohc", NULL);
 }
 
 static gboolean
@@ -316,6 +608,7 @@ _set_time (GsdDatetimeMechanism  *mechanism,
            const struct timeval  *tv,
            DBusGMethodInvocation *context)
 {
+        DatetimeJob *job;
         GError *error;
 
         if (!_check_polkit_for_action (mechanism, context))
@@ -332,10 +625,11 @@ _set_time (GsdDatetimeMechanism  *mechanism,
                 return FALSE;
         }
 
-        if (!_sync_hwclock (context))
-                return FALSE;
+        job = datetime_job_new ("SetTime");
+        _add_stamp_step (job);
+        _add_hwclock_step (job, NULL);
+        _run_job (mechanism, job, context);
 
-        dbus_g_method_return (context);
         return TRUE;
 }
 
@@ -347,55 +641,41 @@ _set_date (GsdDatetimeMechanism  *mechanism,
            DBusGMethodInvocation *context)
 {
         GDateTime *time;
+        DatetimeJob *job;
         char *date_str, *time_str;
-        char *date_cmd;
-        int exit_status;
-        GError *error;
+        char *date_arg;
+
+        if (!_check_polkit_for_action (mechanism, context))
+                return FALSE;
 
         date_str = g_strdup_printf ("%02d/%02d/%d", month, day, year);
-        error = NULL;
 
         time = g_date_time_new_now_local ();
         time_str = g_date_time_format (time, "%R:%S");
         g_date_time_unref (time);
 
-        date_cmd = g_strdup_printf ("/bin/date -s \"%s %s\" +\"%%D %%R:%%S\"", date_str, time_str);
+        date_arg = g_strdup_printf ("%s %s", date_str, time_str);
         g_free (date_str);
         g_free (time_str);
 
-        if (!g_spawn_command_line_sync (date_cmd, NULL, NULL, &exit_status, &error)) {
-                GError *error2;
-                error2 = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                      GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                      "Error spawning /bin/date: %s", error->message);
-                g_error_free (error);
-                dbus_g_method_return_error (context, error2);
-                g_error_free (error2);
-                g_free (date_cmd);
-                return FALSE;
-        }
-        g_free (date_cmd);
-        if (WEXITSTATUS (exit_status) != 0) {
-                error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                     GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                     "/bin/date returned %d", exit_status);
-                dbus_g_method_return_error (context, error);
-                g_error_free (error);
-                return FALSE;
-        }
+        job = datetime_job_new ("SetDate");
+        datetime_job_add_step (job, DATETIME_JOB_TIMEOUT_QUICK, FALSE,
+                               "/bin/date", "-s", date_arg, "+%D %R:%S", NULL);
+        _add_stamp_step (job);
+        _add_hwclock_step (job, NULL);
+        g_free (date_arg);
 
-        if (!_sync_hwclock (context))
-                return FALSE;
+        _run_job (mechanism, job, context);
 
         return TRUE;
 }
 
-/* exported methods */
+/* method handlers, reached through _admit () */
 
-gboolean
-gsd_datetime_mechanism_set_time (GsdDatetimeMechanism  *mechanism,
-                                 gint64                 seconds_since_epoch,
-                                 DBusGMethodInvocation *context)
+static gboolean
+handle_set_time (GsdDatetimeMechanism  *mechanism,
+                 gint64                 seconds_since_epoch,
+                 DBusGMethodInvocation *context)
 {
         struct timeval tv;
 
@@ -407,12 +687,12 @@ gsd_datetime_mechanism_set_time (GsdDatetimeMechanism  *mechanism,
         return _set_time (mechanism, &tv, context);
 }
 
-gboolean
-gsd_datetime_mechanism_set_date (GsdDatetimeMechanism  *mechanism,
-                                 guint                  day,
-                                 guint                  month,
-                                 guint                  year,
-                                 DBusGMethodInvocation *context)
+static gboolean
+handle_set_date (GsdDatetimeMechanism  *mechanism,
+                 guint                  day,
+                 guint                  month,
+                 guint                  year,
+                 DBusGMethodInvocation *context)
 {
         reset_killtimer ();
         g_debug ("SetDate(%d, %d, %d) called", day, month, year);
@@ -420,10 +700,10 @@ gsd_datetime_mechanism_set_date (GsdDatetimeMechanism  *mechanism,
         return _set_date (mechanism, day, month, year, context);
 }
 
-gboolean
-gsd_datetime_mechanism_adjust_time (GsdDatetimeMechanism  *mechanism,
-                                    gint64                 seconds_to_add,
-                                    DBusGMethodInvocation *context)
+static gboolean
+handle_adjust_time (GsdDatetimeMechanism  *mechanism,
+                    gint64                 seconds_to_add,
+                    DBusGMethodInvocation *context)
 {
         struct timeval tv;
 
@@ -444,232 +724,641 @@ gsd_datetime_mechanism_adjust_time (GsdDatetimeMechanism  *mechanism,
         return _set_time (mechanism, &tv, context);
 }
 
+/* "/Europe/Paris" and "Europe/Paris" name the same file, and
+ * "Asia/Calcutta" is the same zone as "Asia/Kolkata" */
+static char *
+_canonical_tz_name (const char  *tz,
+                    GError     **error)
+{
+        GError *our_error = NULL;
+        char *zone;
+
+        while (*tz == '/')
+                tz++;
+
+        zone = system_timezone_canonicalize (tz, &our_error);
+        if (zone == NULL) {
+                g_set_error_literal (error, GSD_DATETIME_MECHANISM_ERROR,
+                                     GSD_DATETIME_MECHANISM_ERROR_INVALID_TIMEZONE_FILE,
+                                     our_error->message);
+                g_error_free (our_error);
+        }
+
+        return zone;
+}
+
 static gboolean
-gsd_datetime_check_tz_name (const char *tz,
-                            GError    **error)
+_same_stat (const struct stat *a,
+            const struct stat *b)
 {
-        GFile *file;
-        char *tz_path, *actual_path;
-        gboolean retval;
+        return a->st_dev == b->st_dev &&
+               a->st_ino == b->st_ino &&
+               a->st_size == b->st_size &&
+               a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+               a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+               a->st_ctim.tv_sec == b->st_ctim.tv_sec &&
+               a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
 
-        retval = TRUE;
-        tz_path = g_build_filename (SYSTEM_ZONEINFODIR, tz, NULL);
+static void
+_lstat_localtime (struct stat *st)
+{
+        if (lstat ("/etc/localtime", st) != 0)
+                memset (st, 0, sizeof (struct stat));
+}
 
-        /* Get the actual resolved path */
-        file = g_file_new_for_path (tz_path);
-        actual_path = g_file_get_path (file);
-        g_object_unref (file);
+/* Replacing /etc/localtime, as a link or a copy, always changes what
+ * lstat() says about it, so the zone is only looked up again then. It's
+ * reported under its canonical name, whatever the system calls it. */
+static const char *
+_get_current_timezone (GsdDatetimeMechanism *mechanism)
+{
+        GsdDatetimeMechanismPrivate *priv = mechanism->priv;
+        struct stat st;
+        char *tz;
+
+        _lstat_localtime (&st);
+        if (priv->tz_current != NULL && _same_stat (&st, &priv->tz_current_stat))
+                return priv->tz_current;
+
+        g_free (priv->tz_current);
+        tz = system_timezone_find ();
+        priv->tz_current = system_timezone_canonicalize (tz, NULL);
+        if (priv->tz_current == NULL)
+                priv->tz_current = tz;
+        else
+                g_free (tz);
+        priv->tz_current_stat = st;
+
+        return priv->tz_current;
+}
 
-        /* The tz name passed had relative paths in it */
-        if (g_strcmp0 (tz_path, actual_path) != 0) {
-                g_set_error (error, GSD_DATETIME_MECHANISM_ERROR,
-                             GSD_DATETIME_MECHANISM_ERROR_INVALID_TIMEZONE_FILE,
-                             "Timezone file '%s' was invalid.",
-                             tz);
-                retval = FALSE;
-        }
+/* The zone the system will be in once the queued writes are done */
+static const char *
+_get_target_timezone (GsdDatetimeMechanism *mechanism)
+{
+        TimezoneWrite *write;
 
-        g_free (tz_path);
-        g_free (actual_path);
+        write = g_queue_peek_tail (mechanism->priv->tz_writes);
+        if (write != NULL)
+                return write->zone;
 
-        return retval;
+        return _get_current_timezone (mechanism);
 }
 
-gboolean
-gsd_datetime_mechanism_set_timezone (GsdDatetimeMechanism  *mechanism,
-                                     const char            *tz,
-                                     DBusGMethodInvocation *context)
+static void
+timezone_write_free (gpointer data)
 {
-        GError *error;
+        TimezoneWrite *write = data;
 
-        reset_killtimer ();
-        g_debug ("SetTimezone('%s') called", tz);
+        g_object_unref (write->task);
+        g_free (write->zone);
+        g_free (write);
+}
 
-        if (!_check_polkit_for_action (mechanism, context))
-                return FALSE;
+static void
+_timezone_write_push (GsdDatetimeMechanism *mechanism,
+                      GTask                *task,
+                      GTaskThreadFunc       func,
+                      const char           *zone)
+{
+        TimezoneWrite *write;
 
-        error = NULL;
+        write = g_new0 (TimezoneWrite, 1);
+        write->task = g_object_ref (task);
+        write->func = func;
+        write->zone = g_strdup (zone);
+        g_queue_push_tail (mechanism->priv->tz_writes, write);
 
-        if (!gsd_datetime_check_tz_name (tz, &error))
-                return FALSE;
+        if (g_queue_get_length (mechanism->priv->tz_writes) == 1)
+                g_task_run_in_thread (task, func);
+}
 
-        if (!system_timezone_set (tz, &error)) {
-                GError *error2;
-                int     code;
+/* Called when task is done, to start the write after it */
+static void
+_timezone_write_done (GsdDatetimeMechanism *mechanism,
+                      GTask                *task)
+{
+        TimezoneWrite *write;
 
-                if (error->code == SYSTEM_TIMEZONE_ERROR_INVALID_TIMEZONE_FILE)
-                        code = GSD_DATETIME_MECHANISM_ERROR_INVALID_TIMEZONE_FILE;
-                else
-                        code = GSD_DATETIME_MECHANISM_ERROR_GENERAL;
+        write = g_queue_peek_head (mechanism->priv->tz_writes);
+        if (write == NULL || write->task != task)
+                return;
 
-                error2 = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                      code, "%s", error->message);
+        timezone_write_free (g_queue_pop_head (mechanism->priv->tz_writes));
 
-                g_error_free (error);
+        write = g_queue_peek_head (mechanism->priv->tz_writes);
+        if (write != NULL)
+                g_task_run_in_thread (write->task, write->func);
+}
 
-                dbus_g_method_return_error (context, error2);
-                g_error_free (error2);
+static GError *
+_timezone_error (const GError *error)
+{
+        int code;
 
-                return FALSE;
-        }
+        if (error->domain == SYSTEM_TIMEZONE_ERROR &&
+            error->code == SYSTEM_TIMEZONE_ERROR_INVALID_TIMEZONE_FILE)
+                code = GSD_DATETIME_MECHANISM_ERROR_INVALID_TIMEZONE_FILE;
+        else
+                code = GSD_DATETIME_MECHANISM_ERROR_GENERAL;
 
-        dbus_g_method_return (context);
-        return TRUE;
+        return g_error_new (GSD_DATETIME_MECHANISM_ERROR, code, "%s", error->message);
 }
 
+static void
+set_timezone_thread (GTask        *task,
+                     gpointer      source_object,
+                     gpointer      task_data,
+                     GCancellable *cancellable)
+{
+        TimezoneFlight *flight = task_data;
+        GError *error = NULL;
+
+        if (!system_timezone_set (flight->zone, &error)) {
+                g_task_return_error (task, error);
+                return;
+        }
 
-gboolean
-gsd_datetime_mechanism_get_timezone (GsdDatetimeMechanism   *mechism,
-                                     DBusGMethodInvocation  *context)
+        /* A local RTC follows the zone; not worth failing the call over */
+        if (datetime_rtc_available () && !datetime_rtc_rezone (&error)) {
+                g_warning ("%s", error->message);
+                g_error_free (error);
+        }
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+set_timezone_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
 {
-  gchar *timezone;
+        GsdDatetimeMechanism *mechanism = GSD_DATETIME_MECHANISM (source);
+        GsdDatetimeMechanismPrivate *priv = mechanism->priv;
+        TimezoneFlight *flight = g_task_get_task_data (G_TASK (result));
+        GError *error = NULL;
+        GError *error2 = NULL;
+        GSList *l;
 
-  reset_killtimer ();
+        _timezone_write_done (mechanism, G_TASK (result));
+        n_threads--;
 
-  timezone = system_timezone_find ();
+        if (g_task_propagate_boolean (G_TASK (result), &error)) {
+                g_free (priv->tz_current);
+                priv->tz_current = g_strdup (flight->zone);
+                _lstat_localtime (&priv->tz_current_stat);
+                datetime_offset_watch_update ();
+        } else {
+                error2 = _timezone_error (error);
+                g_error_free (error);
+        }
 
-  dbus_g_method_return (context, timezone);
+        flight->waiters = g_slist_reverse (flight->waiters);
+        for (l = flight->waiters; l != NULL; l = l->next) {
+                if (error2 == NULL)
+                        dbus_g_method_return (l->data);
+                else
+                        dbus_g_method_return_error (l->data, error2);
+        }
 
-  return TRUE;
+        g_clear_error (&error2);
+        reset_killtimer ();
 }
 
-gboolean
-gsd_datetime_mechanism_get_hardware_clock_using_utc (GsdDatetimeMechanism  *mechanism,
-                                                     DBusGMethodInvocation *context)
+static void
+timezone_flight_free (gpointer data)
+{
+        TimezoneFlight *flight = data;
+
+        g_slist_free (flight->waiters);
+        g_free (flight->zone);
+        g_free (flight);
+}
+
+static gboolean
+handle_set_timezone (GsdDatetimeMechanism  *mechanism,
+                     const char            *tz,
+                     DBusGMethodInvocation *context)
 {
-        char **lines;
-        char *data;
-        gsize len;
+        GsdDatetimeMechanismPrivate *priv = mechanism->priv;
+        TimezoneWrite *write;
+        TimezoneFlight *flight;
+        GTask *task;
         GError *error;
-        gboolean is_utc;
+        char *zone;
 
-        error = NULL;
+        reset_killtimer ();
+        g_debug ("SetTimezone('%s') called", tz);
 
-        if (!g_file_get_contents ("/etc/adjtime", &data, &len, &error)) {
-                GError *error2;
-                error2 = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                      GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                      "Error reading /etc/adjtime file: %s", error->message);
-                g_error_free (error);
-                dbus_g_method_return_error (context, error2);
-                g_error_free (error2);
+        if (!_check_polkit_for_action (mechanism, context))
                 return FALSE;
-        }
 
-        lines = g_strsplit (data, "\n", 0);
-        g_free (data);
+        error = NULL;
 
-        if (g_strv_length (lines) < 3) {
-                error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                     GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                     "Cannot parse /etc/adjtime");
+        zone = _canonical_tz_name (tz, &error);
+        if (zone == NULL) {
                 dbus_g_method_return_error (context, error);
                 g_error_free (error);
-                g_strfreev (lines);
                 return FALSE;
         }
 
-        if (strcmp (lines[2], "UTC") == 0) {
-                is_utc = TRUE;
-        } else if (strcmp (lines[2], "LOCAL") == 0) {
-                is_utc = FALSE;
-        } else {
-                error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                     GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                     "Expected UTC or LOCAL at line 3 of /etc/adjtime; found '%s'", lines[2]);
-                dbus_g_method_return_error (context, error);
-                g_error_free (error);
-                g_strfreev (lines);
-                return FALSE;
+        /* Only the last queued write says where the zone is headed: for
+           A, B, A the second A has to be written again */
+        write = g_queue_peek_tail (priv->tz_writes);
+        if (write == NULL && g_strcmp0 (_get_current_timezone (mechanism), zone) == 0) {
+                g_debug ("Timezone is already '%s'", zone);
+                dbus_g_method_return (context);
+                g_free (zone);
+                return TRUE;
+        }
+        if (write != NULL && strcmp (write->zone, zone) == 0 &&
+            g_task_get_source_tag (write->task) == handle_set_timezone) {
+                g_debug ("Joining SetTimezone('%s') in flight", zone);
+                flight = g_task_get_task_data (write->task);
+                flight->waiters = g_slist_prepend (flight->waiters, context);
+                g_free (zone);
+                return TRUE;
         }
-        g_strfreev (lines);
-        dbus_g_method_return (context, is_utc);
+
+        flight = g_new0 (TimezoneFlight, 1);
+        flight->zone = zone;
+        flight->waiters = g_slist_prepend (NULL, context);
+        n_threads++;
+
+        task = g_task_new (mechanism, NULL, set_timezone_cb, NULL);
+        g_task_set_source_tag (task, handle_set_timezone);
+        g_task_set_task_data (task, flight, timezone_flight_free);
+        _timezone_write_push (mechanism, task, set_timezone_thread, zone);
+        g_object_unref (task);
+
         return TRUE;
 }
 
-gboolean
-gsd_datetime_mechanism_set_hardware_clock_using_utc (GsdDatetimeMechanism  *mechanism,
-                                                     gboolean               using_utc,
-                                                     DBusGMethodInvocation *context)
+/* SetTimezoneForRoots: the zone is set in other system trees, such as
+ * container images, under an action of its own since it writes wherever
+ * the caller says. Each root gets a result, "" meaning success. */
+
+typedef struct
 {
-        GError *error;
+        DBusGMethodInvocation *context;
+        char                  *zone;
+        char                 **roots;
+} TimezoneRoots;
 
-        error = NULL;
+static void
+timezone_roots_free (gpointer data)
+{
+        TimezoneRoots *roots = data;
 
-        if (!_check_polkit_for_action (mechanism, context))
-                return FALSE;
+        g_free (roots->zone);
+        g_strfreev (roots->roots);
+        g_free (roots);
+}
 
-        if (g_file_test ("/sbin/hwclock", 
-                         G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR | G_FILE_TEST_IS_EXECUTABLE)) {
-                int exit_status;
-                char *cmd;
-                cmd = g_strdup_printf ("/sbin/hwclock %s --systohc", using_utc ? "--utc" : "--localtime");
-                if (!g_spawn_command_line_sync (cmd, NULL, NULL, &exit_status, &error)) {
-                        GError *error2;
-                        error2 = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                              GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                              "Error spawning /sbin/hwclock: %s", error->message);
-                        g_error_free (error);
-                        dbus_g_method_return_error (context, error2);
-                        g_error_free (error2);
-                        g_free (cmd);
-                        return FALSE;
-                }
-                g_free (cmd);
-                if (WEXITSTATUS (exit_status) != 0) {
-                        error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
-                                             GSD_DATETIME_MECHANISM_ERROR_GENERAL,
-                                             "/sbin/hwclock returned %d", exit_status);
-                        dbus_g_method_return_error (context, error);
-                        g_error_free (error);
-                        return FALSE;
+static void
+set_timezone_for_roots_thread (GTask        *task,
+                               gpointer      source_object,
+                               gpointer      task_data,
+                               GCancellable *cancellable)
+{
+        TimezoneRoots *roots = task_data;
+        GHashTable *results;
+        GPtrArray *todo;
+        GError **errors;
+        guint i;
+
+        results = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+        /* Relative paths mean nothing to us, and a root listed twice is
+         * only done once */
+        todo = g_ptr_array_new ();
+        for (i = 0; roots->roots[i] != NULL; i++) {
+                const char *root = roots->roots[i];
+
+                if (g_hash_table_contains (results, root))
+                        continue;
+                if (!g_path_is_absolute (root)) {
+                        g_hash_table_insert (results, g_strdup (root),
+                                             g_strdup ("Not an absolute path"));
+                        continue;
                 }
+                g_hash_table_insert (results, g_strdup (root), g_strdup (""));
+                g_ptr_array_add (todo, (gpointer) root);
         }
-        dbus_g_method_return (context);
-        return TRUE;
+
+        errors = g_new0 (GError *, MAX (todo->len, 1));
+        system_timezone_set_for_roots (roots->zone,
+                                       (const char * const *) todo->pdata,
+                                       todo->len, FALSE, errors);
+
+        for (i = 0; i < todo->len; i++) {
+                if (errors[i] == NULL)
+                        continue;
+                g_hash_table_replace (results, g_strdup (g_ptr_array_index (todo, i)),
+                                      g_strdup (errors[i]->message));
+                g_error_free (errors[i]);
+        }
+        g_free (errors);
+        g_ptr_array_free (todo, TRUE);
+
+        g_task_return_pointer (task, results, (GDestroyNotify) g_hash_table_unref);
 }
 
-gboolean
-gsd_datetime_mechanism_get_using_ntp  (GsdDatetimeMechanism    *mechanism,
-                                       DBusGMethodInvocation   *context)
+static void
+set_timezone_for_roots_cb (GObject      *source,
+                           GAsyncResult *result,
+                           gpointer      user_data)
 {
+        TimezoneRoots *roots = g_task_get_task_data (G_TASK (result));
+        GHashTable *results;
+
+        n_threads--;
+
+        results = g_task_propagate_pointer (G_TASK (result), NULL);
+        dbus_g_method_return (roots->context, results);
+        g_hash_table_unref (results);
+
+        reset_killtimer ();
+}
+
+static gboolean
+handle_set_timezone_for_roots (GsdDatetimeMechanism  *mechanism,
+                               const char            *tz,
+                               char                 **roots,
+                               DBusGMethodInvocation *context)
+{
+        TimezoneRoots *data;
+        GTask *task;
+        GError *error;
+        char *zone;
+
+        reset_killtimer ();
+        g_debug ("SetTimezoneForRoots('%s') called for %u roots", tz,
+                 roots != NULL ? g_strv_length (roots) : 0);
+
+        if (!_check_polkit_for (mechanism,
+                                "org.opensettings.datetimemechanism.configure-roots",
+                                context))
+                return FALSE;
+
+        error = NULL;
+
+        zone = _canonical_tz_name (tz, &error);
+        if (zone == NULL) {
+                dbus_g_method_return_error (context, error);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        data = g_new0 (TimezoneRoots, 1);
+        data->context = context;
+        data->zone = zone;
+        data->roots = roots != NULL ? g_strdupv (roots) : g_new0 (char *, 1);
+        n_threads++;
+
+        task = g_task_new (mechanism, NULL, set_timezone_for_roots_cb, NULL);
+        g_task_set_task_data (task, data, timezone_roots_free);
+        g_task_run_in_thread (task, set_timezone_for_roots_thread);
+        g_object_unref (task);
+
+        return TRUE;
+}
+
+
+gboolean
+gsd_datetime_mechanism_get_timezone (GsdDatetimeMechanism   *mechanism,
+                                     DBusGMethodInvocation  *context)
+{
+        reset_killtimer ();
+
+        dbus_g_method_return (context, _get_current_timezone (mechanism));
+
+        return TRUE;
+}
+
+gboolean
+gsd_datetime_mechanism_get_hardware_clock_using_utc (GsdDatetimeMechanism  *mechanism,
+                                                     DBusGMethodInvocation *context)
+{
+        ParsedAdjtime adjtime;
         GError *error = NULL;
-        gboolean ret;
+
+        if (!datetime_rtc_get_adjtime (&adjtime, &error)) {
+                dbus_g_method_return_error (context, error);
+                g_error_free (error);
+                return FALSE;
+        }
+
+        dbus_g_method_return (context, adjtime.utc);
+        return TRUE;
+}
+
+static gboolean
+handle_set_hardware_clock_using_utc (GsdDatetimeMechanism  *mechanism,
+                                     gboolean               using_utc,
+                                     DBusGMethodInvocation *context)
+{
+        DatetimeJob *job;
+
+        if (!_check_polkit_for_action (mechanism, context))
+                return FALSE;
+
+        job = datetime_job_new ("SetHardwareClockUsingUtc");
+        _add_hwclock_step (job, using_utc ? "--utc" : "--localtime");
+        _run_job (mechanism, job, context);
+
+        return TRUE;
+}
+
+typedef struct
+{
+        DBusGMethodInvocation *context;
+        gboolean               can_use;
+        gboolean               is_using;
+} GetUsingNtpData;
+
+static void
+get_using_ntp_cb (GObject      *source,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+        GetUsingNtpData *data = user_data;
+        GError *error = NULL;
+        int exit_status;
+
+        if (datetime_job_finish (result, &exit_status, &error)) {
+                if (exit_status == 0)
+                        data->is_using = TRUE;
+                dbus_g_method_return (data->context, data->can_use, data->is_using);
+        } else {
+                dbus_g_method_return_error (data->context, error);
+                g_error_free (error);
+        }
+
+        g_free (data);
+        reset_killtimer ();
+}
+
+static gboolean
+handle_get_using_ntp  (GsdDatetimeMechanism    *mechanism,
+                       DBusGMethodInvocation   *context)
+{
+        GetUsingNtpData *data;
+        DatetimeJob *job;
+        GError *error = NULL;
+
+        data = g_new0 (GetUsingNtpData, 1);
+        data->context = context;
 
         if (g_file_test ("/usr/sbin/update-rc.d", G_FILE_TEST_EXISTS)) /* Debian */
-                ret = _get_using_ntp_debian (context);
+                job = _get_using_ntp_debian (&data->can_use, &data->is_using);
 	else if (g_file_test ("/etc/ataraxia-release", G_FILE_TEST_EXISTS)) /* SUSE variant */
-                ret = _get_using_ntp_ataraxia (context);
+                job = _get_using_ntp_ataraxia (&data->can_use, &data->is_using);
         else {
                 error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
                                      GSD_DATETIME_MECHANISM_ERROR_GENERAL,
                                      "Error enabling NTP: OS variant not supported");
                 dbus_g_method_return_error (context, error);
                 g_error_free (error);
+                g_free (data);
                 return FALSE;
         }
 
-        return ret;
+        /* Nothing to ask a service about */
+        if (job == NULL) {
+                dbus_g_method_return (context, data->can_use, data->is_using);
+                g_free (data);
+                return TRUE;
+        }
+
+        datetime_job_set_progress_func (job, job_progress_cb, mechanism);
+        datetime_job_run (job, get_using_ntp_cb, data);
+
+        return TRUE;
 }
 
-gboolean
-gsd_datetime_mechanism_set_using_ntp  (GsdDatetimeMechanism    *mechanism,
-                                       gboolean                 using_ntp,
-                                       DBusGMethodInvocation   *context)
+static DatetimeJob *
+_set_using_ntp_job (gboolean using_ntp)
+{
+        if (g_file_test ("/usr/sbin/update-rc.d", G_FILE_TEST_EXISTS)) /* Debian */
+                return _set_using_ntp_debian (using_ntp);
+	else if (g_file_test ("/etc/ataraxia-release", G_FILE_TEST_EXISTS)) /* SUSE variant */
+                return _set_using_ntp_ataraxia (using_ntp);
+
+        return NULL;
+}
+
+static void _ntp_converge (GsdDatetimeMechanism *mechanism);
+
+static void
+ntp_converge_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+        GsdDatetimeMechanism *mechanism = user_data;
+        GsdDatetimeMechanismPrivate *priv = mechanism->priv;
+        GError *error = NULL;
+        GSList *waiters, *l;
+
+        datetime_job_finish (result, NULL, &error);
+
+        /* Superseded while running: whatever this job did, the outcome
+           callers care about is that of the next one */
+        if (priv->ntp_target != priv->ntp_job_target) {
+                g_debug ("SetUsingNtp(%d) superseded by SetUsingNtp(%d)",
+                         priv->ntp_job_target, priv->ntp_target);
+                g_clear_error (&error);
+                _ntp_converge (mechanism);
+                return;
+        }
+
+        priv->ntp_busy = FALSE;
+        waiters = g_slist_reverse (priv->ntp_waiters);
+        priv->ntp_waiters = NULL;
+
+        for (l = waiters; l != NULL; l = l->next) {
+                NtpWaiter *waiter = l->data;
+
+                waiter->func (error, waiter->user_data);
+        }
+
+        g_slist_free_full (waiters, g_free);
+        g_clear_error (&error);
+        g_object_unref (mechanism);
+        reset_killtimer ();
+}
+
+static void
+_ntp_converge (GsdDatetimeMechanism *mechanism)
+{
+        GsdDatetimeMechanismPrivate *priv = mechanism->priv;
+        DatetimeJob *job;
+
+        priv->ntp_job_target = priv->ntp_target;
+        job = _set_using_ntp_job (priv->ntp_job_target);
+        datetime_job_set_progress_func (job, job_progress_cb, mechanism);
+        datetime_job_run (job, ntp_converge_cb, mechanism);
+}
+
+static gboolean
+_ntp_supported (void)
+{
+        return g_file_test ("/usr/sbin/update-rc.d", G_FILE_TEST_EXISTS) ||
+               g_file_test ("/etc/ataraxia-release", G_FILE_TEST_EXISTS);
+}
+
+/* func is called once the system has converged to the latest target */
+static void
+_ntp_request (GsdDatetimeMechanism *mechanism,
+              gboolean              using_ntp,
+              NtpDoneFunc           func,
+              gpointer              user_data)
+{
+        GsdDatetimeMechanismPrivate *priv = mechanism->priv;
+        NtpWaiter *waiter;
+
+        waiter = g_new0 (NtpWaiter, 1);
+        waiter->func = func;
+        waiter->user_data = user_data;
+
+        priv->ntp_target = using_ntp ? TRUE : FALSE;
+        priv->ntp_waiters = g_slist_prepend (priv->ntp_waiters, waiter);
+
+        /* A running job picks up the new target when it's done */
+        if (!priv->ntp_busy) {
+                priv->ntp_busy = TRUE;
+                g_object_ref (mechanism);
+                _ntp_converge (mechanism);
+        }
+}
+
+static void
+set_using_ntp_done (const GError *error,
+                    gpointer      user_data)
+{
+        DBusGMethodInvocation *context = user_data;
+
+        if (error == NULL)
+                dbus_g_method_return (context);
+        else
+                dbus_g_method_return_error (context, (GError *) error);
+}
+
+static gboolean
+handle_set_using_ntp  (GsdDatetimeMechanism    *mechanism,
+                       gboolean                 using_ntp,
+                       DBusGMethodInvocation   *context)
 {
         GError *error;
-        gboolean ret;
 
-        error = NULL;
+        reset_killtimer ();
+        g_debug ("SetUsingNtp(%d) called", using_ntp);
 
         if (!_check_polkit_for_action (mechanism, context))
                 return FALSE;
 
-        if (g_file_test ("/usr/sbin/update-rc.d", G_FILE_TEST_EXISTS)) /* Debian */
-                ret = _set_using_ntp_debian (context, using_ntp);
-	else if (g_file_test ("/etc/ataraxia-release", G_FILE_TEST_EXISTS)) /* SUSE variant */
-                ret = _set_using_ntp_ataraxia (context, using_ntp);
-        else {
+        if (!_ntp_supported ()) {
                 error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
                                      GSD_DATETIME_MECHANISM_ERROR_GENERAL,
                                      "Error enabling NTP: OS variant not supported");
@@ -678,22 +1367,360 @@ gsd_datetime_mechanism_set_using_ntp  (GsdDatetimeMechanism    *mechanism,
                 return FALSE;
         }
 
+        _ntp_request (mechanism, using_ntp, set_using_ntp_done, context);
+
+        return TRUE;
+}
+
+/* Apply: everything is authorized once, then applied in this order:
+ * timezone and date/time (natively, in a thread), NTP (through the same
+ * reconciler as SetUsingNtp), and finally a single RTC sync, which also
+ * sets the RTC mode. Each field gets a result, "" meaning success. */
+
+#define APPLY_TIMEZONE  "Timezone"
+#define APPLY_DATE      "Date"
+#define APPLY_TIME      "Time"
+#define APPLY_NTP       "UsingNtp"
+#define APPLY_RTC_UTC   "HardwareClockUsingUtc"
+#define APPLY_RTC_SYNC  "HardwareClockSync"
+
+typedef struct
+{
+        GsdDatetimeMechanism  *mechanism;
+        DBusGMethodInvocation *context;
+        GHashTable            *results;
+
+        char                  *timezone;
+        char                  *date_zone;
+        gboolean               has_date;
+        guint                  year, month, day;
+        gboolean               has_time;
+        gint64                 time;
+        gboolean               has_ntp;
+        gboolean               ntp;
+        gboolean               has_rtc_utc;
+        gboolean               rtc_utc;
+        gboolean               sync_rtc;
+} ApplyData;
+
+static void
+apply_result (ApplyData   *apply,
+              const char  *field,
+              const char  *message)
+{
+        g_hash_table_replace (apply->results, g_strdup (field), g_strdup (message));
+}
+
+static void
+apply_data_free (ApplyData *apply)
+{
+        g_hash_table_unref (apply->results);
+        g_free (apply->timezone);
+        g_free (apply->date_zone);
+        g_object_unref (apply->mechanism);
+        g_free (apply);
+}
+
+static void
+apply_finish (ApplyData *apply)
+{
+        dbus_g_method_return (apply->context, apply->results);
+        apply_data_free (apply);
+        reset_killtimer ();
+}
+
+static void
+apply_rtc_cb (GObject      *source,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+        ApplyData *apply = user_data;
+        GError *error = NULL;
+
+        datetime_job_finish (result, NULL, &error);
+        apply_result (apply, apply->has_rtc_utc ? APPLY_RTC_UTC : APPLY_RTC_SYNC,
+                      error != NULL ? error->message : "");
+        g_clear_error (&error);
+
+        apply_finish (apply);
+}
+
+static void
+apply_rtc (ApplyData *apply)
+{
+        DatetimeJob *job;
+        gboolean rezone;
+
+        /* A new zone only needs a local RTC set again in it; the RTC is
+         * set from the system time only for a new time or RTC mode */
+        rezone = apply->timezone != NULL && datetime_rtc_available ();
+        if (!apply->has_rtc_utc && !apply->sync_rtc && !rezone) {
+                apply_finish (apply);
+                return;
+        }
+
+        job = datetime_job_new ("Apply");
+        /* What a local RTC says was in the old zone; set it in the new one
+         * before it is read for the drift */
+        if (rezone)
+                datetime_job_add_func_step (job, FALSE, rtc_rezone_step, NULL);
+        if (apply->has_rtc_utc || apply->sync_rtc)
+                _add_hwclock_step (job, !apply->has_rtc_utc ? NULL :
+                                        apply->rtc_utc ? "--utc" : "--localtime");
+        datetime_job_set_progress_func (job, job_progress_cb, apply->mechanism);
+        datetime_job_run (job, apply_rtc_cb, apply);
+}
+
+static void
+apply_ntp_done (const GError *error,
+                gpointer      user_data)
+{
+        ApplyData *apply = user_data;
+
+        apply_result (apply, APPLY_NTP, error != NULL ? error->message : "");
+        apply_rtc (apply);
+}
+
+static void
+apply_ntp (ApplyData *apply)
+{
+        if (!apply->has_ntp) {
+                apply_rtc (apply);
+                return;
+        }
+
+        if (!_ntp_supported ()) {
+                apply_result (apply, APPLY_NTP, "OS variant not supported");
+                apply_rtc (apply);
+                return;
+        }
+
+        _ntp_request (apply->mechanism, apply->ntp, apply_ntp_done, apply);
+}
+
+static gboolean
+_settime (gint64   seconds_since_epoch,
+          char   **message)
+{
+        struct timeval tv;
+
+        tv.tv_sec = (time_t) seconds_since_epoch;
+        tv.tv_usec = 0;
+
+        if (settimeofday (&tv, NULL) != 0) {
+                *message = g_strdup_printf ("Error calling settimeofday(): %s", strerror (errno));
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* The date changes, the local time of day doesn't */
+static gboolean
+_setdate (const char  *zone,
+          guint        year,
+          guint        month,
+          guint        day,
+          char       **message)
+{
+        GTimeZone *tz;
+        GDateTime *now, *then;
+        gboolean ret;
+
+        tz = g_time_zone_new (zone);
+        now = g_date_time_new_now (tz);
+        then = g_date_time_new (tz, year, month, day,
+                                g_date_time_get_hour (now),
+                                g_date_time_get_minute (now),
+                                g_date_time_get_seconds (now));
+        g_date_time_unref (now);
+        g_time_zone_unref (tz);
+
+        if (then == NULL) {
+                *message = g_strdup_printf ("Invalid date %04u-%02u-%02u", year, month, day);
+                return FALSE;
+        }
+
+        ret = _settime (g_date_time_to_unix (then), message);
+        g_date_time_unref (then);
+
         return ret;
 }
 
+static void
+apply_thread (GTask        *task,
+              gpointer      source_object,
+              gpointer      task_data,
+              GCancellable *cancellable)
+{
+        ApplyData *apply = task_data;
+        GError *error = NULL;
+        char *message = NULL;
+        gboolean time_set = FALSE;
+
+        if (apply->timezone != NULL) {
+                /* A local RTC then follows it, see apply_rtc () */
+                if (system_timezone_set (apply->timezone, &error)) {
+                        apply_result (apply, APPLY_TIMEZONE, "");
+                } else {
+                        apply_result (apply, APPLY_TIMEZONE, error->message);
+                        g_clear_error (&error);
+                        g_clear_pointer (&apply->timezone, g_free);
+                }
+        }
+
+        if (apply->has_date) {
+                if (_setdate (apply->date_zone, apply->year, apply->month, apply->day, &message))
+                        apply->sync_rtc = time_set = TRUE;
+                apply_result (apply, APPLY_DATE, message != NULL ? message : "");
+                g_clear_pointer (&message, g_free);
+        }
+
+        /* After the date, so that an absolute time wins */
+        if (apply->has_time) {
+                if (_settime (apply->time, &message))
+                        apply->sync_rtc = time_set = TRUE;
+                apply_result (apply, APPLY_TIME, message != NULL ? message : "");
+                g_clear_pointer (&message, g_free);
+        }
+
+        if (apply->sync_rtc)
+                datetime_stamp_save (time_set, NULL);
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+apply_thread_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+        ApplyData *apply = user_data;
+        GsdDatetimeMechanismPrivate *priv = apply->mechanism->priv;
+
+        _timezone_write_done (apply->mechanism, G_TASK (result));
+        n_threads--;
+
+        if (apply->timezone != NULL) {
+                g_free (priv->tz_current);
+                priv->tz_current = g_strdup (apply->timezone);
+                _lstat_localtime (&priv->tz_current_stat);
+                datetime_offset_watch_update ();
+        }
+
+        apply_ntp (apply);
+}
+
+static gboolean
+_apply_parse (GsdDatetimeMechanism *mechanism,
+              ApplyData            *apply,
+              const char           *field,
+              const GValue         *value)
+{
+        GError *error = NULL;
+        char *zone;
+
+        if (strcmp (field, APPLY_TIMEZONE) == 0 && G_VALUE_HOLDS_STRING (value)) {
+                zone = _canonical_tz_name (g_value_get_string (value), &error);
+                if (zone == NULL) {
+                        apply_result (apply, field, error->message);
+                        g_error_free (error);
+                        return TRUE;
+                }
+                /* Against where the queued writes leave it, not the disk,
+                   or a zone changed back would stay changed */
+                if (g_strcmp0 (_get_target_timezone (mechanism), zone) == 0) {
+                        apply_result (apply, field, "");
+                        g_free (zone);
+                } else {
+                        g_free (apply->timezone);
+                        apply->timezone = zone;
+                }
+        } else if (strcmp (field, APPLY_DATE) == 0 && G_VALUE_HOLDS_STRING (value)) {
+                if (sscanf (g_value_get_string (value), "%u-%u-%u",
+                            &apply->year, &apply->month, &apply->day) != 3) {
+                        apply_result (apply, field, "Expected YYYY-MM-DD");
+                        return TRUE;
+                }
+                apply->has_date = TRUE;
+        } else if (strcmp (field, APPLY_TIME) == 0 && G_VALUE_HOLDS_INT64 (value)) {
+                apply->has_time = TRUE;
+                apply->time = g_value_get_int64 (value);
+        } else if (strcmp (field, APPLY_NTP) == 0 && G_VALUE_HOLDS_BOOLEAN (value)) {
+                apply->has_ntp = TRUE;
+                apply->ntp = g_value_get_boolean (value);
+        } else if (strcmp (field, APPLY_RTC_UTC) == 0 && G_VALUE_HOLDS_BOOLEAN (value)) {
+                apply->has_rtc_utc = TRUE;
+                apply->rtc_utc = g_value_get_boolean (value);
+        } else
+                return FALSE;
+
+        return TRUE;
+}
+
+static gboolean
+handle_apply (GsdDatetimeMechanism  *mechanism,
+              GHashTable            *settings,
+              DBusGMethodInvocation *context)
+{
+        ApplyData *apply;
+        GHashTableIter iter;
+        gpointer key, value;
+        GTask *task;
+
+        reset_killtimer ();
+        g_debug ("Apply() called with %u settings", g_hash_table_size (settings));
+
+        if (!_check_polkit_for_action (mechanism, context))
+                return FALSE;
+
+        apply = g_new0 (ApplyData, 1);
+        apply->mechanism = g_object_ref (mechanism);
+        apply->context = context;
+        apply->results = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+        g_hash_table_iter_init (&iter, settings);
+        while (g_hash_table_iter_next (&iter, &key, &value))
+                if (!_apply_parse (mechanism, apply, key, value))
+                        apply_result (apply, key, "Unknown setting or wrong type");
+
+        if (apply->timezone == NULL && !apply->has_date && !apply->has_time) {
+                apply_ntp (apply);
+                return TRUE;
+        }
+
+        /* The new date is in the new timezone */
+        apply->date_zone = g_strdup (apply->timezone != NULL ?
+                                     apply->timezone : _get_target_timezone (mechanism));
+
+        n_threads++;
+        task = g_task_new (NULL, NULL, apply_thread_cb, apply);
+        g_task_set_task_data (task, apply, NULL);
+        /* One with a zone waits its turn behind the other timezone writes */
+        if (apply->timezone != NULL)
+                _timezone_write_push (mechanism, task, apply_thread, apply->timezone);
+        else
+                g_task_run_in_thread (task, apply_thread);
+        g_object_unref (task);
+
+        return TRUE;
+}
+
 static void
 check_can_do (GsdDatetimeMechanism  *mechanism,
               const char            *action,
               DBusGMethodInvocation *context)
 {
-        const char *sender;
         PolkitSubject *subject;
         PolkitAuthorizationResult *result;
         GError *error;
 
         /* Check that caller is privileged */
-        sender = dbus_g_method_get_sender (context);
-        subject = polkit_system_bus_name_new (sender);
+        subject = _polkit_subject (context);
+        if (subject == NULL) {
+                _return_unknown_caller (context);
+                return;
+        }
 
         error = NULL;
         result = polkit_authority_check_authorization_sync (mechanism->priv->auth,
@@ -724,36 +1751,454 @@ check_can_do (GsdDatetimeMechanism  *mechanism,
         g_object_unref (result);
 }
 
+/* Everything that costs a helper, a thread or a polkit round trip goes
+ * through the limiter, so that one client can't keep the others waiting.
+ * Cheap reads, GetTimezone, GetHardwareClockUsingUtc and GetStatistics,
+ * are answered right away. The arguments of a call that has to wait are
+ * kept here. */
+
+typedef struct _DeferredCall DeferredCall;
+
+typedef void (*DeferredFunc) (DeferredCall *call);
+
+struct _DeferredCall
+{
+        GsdDatetimeMechanism  *mechanism;
+        DBusGMethodInvocation *context;
+        DeferredFunc           func;
+
+        gint64                 seconds;
+        gboolean               flag;
+        guint                  day, month, year;
+        char                  *string;
+        char                 **strv;
+        GHashTable            *settings;
+};
+
+static DeferredCall *
+deferred_call_new (GsdDatetimeMechanism  *mechanism,
+                   DBusGMethodInvocation *context,
+                   DeferredFunc           func)
+{
+        DeferredCall *call;
+
+        call = g_new0 (DeferredCall, 1);
+        call->mechanism = g_object_ref (mechanism);
+        call->context = context;
+        call->func = func;
+
+        return call;
+}
+
+static void
+deferred_call_free (DeferredCall *call)
+{
+        g_object_unref (call->mechanism);
+        g_free (call->string);
+        g_strfreev (call->strv);
+        if (call->settings != NULL)
+                g_hash_table_unref (call->settings);
+        g_free (call);
+}
+
+static void
+deferred_call_run (DeferredCall *call)
+{
+        call->func (call);
+        deferred_call_free (call);
+}
+
+static void
+deferred_call_resume (gpointer user_data)
+{
+        n_deferred--;
+        reset_killtimer ();
+        deferred_call_run (user_data);
+}
+
+/* The limiter went away with the call still waiting */
+static void
+deferred_call_drop (gpointer user_data)
+{
+        DeferredCall *call = user_data;
+        GError *error;
+
+        n_deferred--;
+        error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
+                             GSD_DATETIME_MECHANISM_ERROR_LIMITS_EXCEEDED,
+                             "Too many requests");
+        dbus_g_method_return_error (call->context, error);
+        g_error_free (error);
+        deferred_call_free (call);
+}
+
+static gboolean
+_admit (DeferredCall *call)
+{
+        FairQueue *limiter = call->mechanism->priv->limiter;
+        FairQueueVerdict verdict;
+        GError *error;
+        char *sender;
+
+        if (limiter == NULL) {
+                deferred_call_run (call);
+                return TRUE;
+        }
+
+        sender = _client_key (call->context);
+        verdict = fair_queue_admit (limiter, sender, deferred_call_resume, call);
+        g_free (sender);
+
+        switch (verdict) {
+        case FAIR_QUEUE_RUN:
+                deferred_call_run (call);
+                break;
+        case FAIR_QUEUE_QUEUED:
+                n_deferred++;
+                break;
+        case FAIR_QUEUE_REJECTED:
+                error = g_error_new (GSD_DATETIME_MECHANISM_ERROR,
+                                     GSD_DATETIME_MECHANISM_ERROR_LIMITS_EXCEEDED,
+                                     "Too many requests");
+                dbus_g_method_return_error (call->context, error);
+                g_error_free (error);
+                deferred_call_free (call);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static void
+run_set_time (DeferredCall *call)
+{
+        handle_set_time (call->mechanism, call->seconds, call->context);
+}
+
+static void
+run_set_date (DeferredCall *call)
+{
+        handle_set_date (call->mechanism, call->day, call->month, call->year, call->context);
+}
+
+static void
+run_adjust_time (DeferredCall *call)
+{
+        handle_adjust_time (call->mechanism, call->seconds, call->context);
+}
+
+static void
+run_set_timezone (DeferredCall *call)
+{
+        handle_set_timezone (call->mechanism, call->string, call->context);
+}
+
+static void
+run_set_timezone_for_roots (DeferredCall *call)
+{
+        handle_set_timezone_for_roots (call->mechanism, call->string, call->strv, call->context);
+}
+
+static void
+run_set_hardware_clock_using_utc (DeferredCall *call)
+{
+        handle_set_hardware_clock_using_utc (call->mechanism, call->flag, call->context);
+}
+
+static void
+run_get_using_ntp (DeferredCall *call)
+{
+        handle_get_using_ntp (call->mechanism, call->context);
+}
+
+static void
+run_set_using_ntp (DeferredCall *call)
+{
+        handle_set_using_ntp (call->mechanism, call->flag, call->context);
+}
+
+static void
+run_apply (DeferredCall *call)
+{
+        handle_apply (call->mechanism, call->settings, call->context);
+}
+
+static void
+run_can_set (DeferredCall *call)
+{
+        check_can_do (call->mechanism,
+                      "org.opensettings.datetimemechanism.configure",
+                      call->context);
+}
+
+/* exported methods */
 
 gboolean
-gsd_datetime_mechanism_can_set_time (GsdDatetimeMechanism  *mechanism,
+gsd_datetime_mechanism_set_time (GsdDatetimeMechanism  *mechanism,
+                                 gint64                 seconds_since_epoch,
+                                 DBusGMethodInvocation *context)
+{
+        DeferredCall *call;
+
+        call = deferred_call_new (mechanism, context, run_set_time);
+        call->seconds = seconds_since_epoch;
+        return _admit (call);
+}
+
+gboolean
+gsd_datetime_mechanism_set_date (GsdDatetimeMechanism  *mechanism,
+                                 guint                  day,
+                                 guint                  month,
+                                 guint                  year,
+                                 DBusGMethodInvocation *context)
+{
+        DeferredCall *call;
+
+        call = deferred_call_new (mechanism, context, run_set_date);
+        call->day = day;
+        call->month = month;
+        call->year = year;
+        return _admit (call);
+}
+
+gboolean
+gsd_datetime_mechanism_adjust_time (GsdDatetimeMechanism  *mechanism,
+                                    gint64                 seconds_to_add,
+                                    DBusGMethodInvocation *context)
+{
+        DeferredCall *call;
+
+        call = deferred_call_new (mechanism, context, run_adjust_time);
+        call->seconds = seconds_to_add;
+        return _admit (call);
+}
+
+gboolean
+gsd_datetime_mechanism_set_timezone (GsdDatetimeMechanism  *mechanism,
+                                     const char            *tz,
                                      DBusGMethodInvocation *context)
 {
-        check_can_do (mechanism,
-                      "org.opensettings.datetimemechanism.configure",
-                      context);
+        DeferredCall *call;
 
-        return TRUE;
+        call = deferred_call_new (mechanism, context, run_set_timezone);
+        call->string = g_strdup (tz);
+        return _admit (call);
+}
+
+gboolean
+gsd_datetime_mechanism_set_timezone_for_roots (GsdDatetimeMechanism  *mechanism,
+                                               const char            *tz,
+                                               char                 **roots,
+                                               DBusGMethodInvocation *context)
+{
+        DeferredCall *call;
+
+        call = deferred_call_new (mechanism, context, run_set_timezone_for_roots);
+        call->string = g_strdup (tz);
+        call->strv = g_strdupv (roots);
+        return _admit (call);
+}
+
+gboolean
+gsd_datetime_mechanism_set_hardware_clock_using_utc (GsdDatetimeMechanism  *mechanism,
+                                                     gboolean               using_utc,
+                                                     DBusGMethodInvocation *context)
+{
+        DeferredCall *call;
+
+        call = deferred_call_new (mechanism, context, run_set_hardware_clock_using_utc);
+        call->flag = using_utc;
+        return _admit (call);
+}
+
+gboolean
+gsd_datetime_mechanism_get_using_ntp  (GsdDatetimeMechanism    *mechanism,
+                                       DBusGMethodInvocation   *context)
+{
+        return _admit (deferred_call_new (mechanism, context, run_get_using_ntp));
+}
+
+gboolean
+gsd_datetime_mechanism_set_using_ntp  (GsdDatetimeMechanism    *mechanism,
+                                       gboolean                 using_ntp,
+                                       DBusGMethodInvocation   *context)
+{
+        DeferredCall *call;
+
+        call = deferred_call_new (mechanism, context, run_set_using_ntp);
+        call->flag = using_ntp;
+        return _admit (call);
+}
+
+gboolean
+gsd_datetime_mechanism_apply (GsdDatetimeMechanism  *mechanism,
+                              GHashTable            *settings,
+                              DBusGMethodInvocation *context)
+{
+        DeferredCall *call;
+
+        call = deferred_call_new (mechanism, context, run_apply);
+        call->settings = g_hash_table_ref (settings);
+        return _admit (call);
+}
+
+gboolean
+gsd_datetime_mechanism_can_set_time (GsdDatetimeMechanism  *mechanism,
+                                     DBusGMethodInvocation *context)
+{
+        return _admit (deferred_call_new (mechanism, context, run_can_set));
 }
 
 gboolean
 gsd_datetime_mechanism_can_set_timezone (GsdDatetimeMechanism  *mechanism,
                                          DBusGMethodInvocation *context)
 {
-        check_can_do (mechanism,
-                      "org.opensettings.datetimemechanism.configure",
-                      context);
-
-        return TRUE;
+        return _admit (deferred_call_new (mechanism, context, run_can_set));
 }
 
 gboolean
 gsd_datetime_mechanism_can_set_using_ntp (GsdDatetimeMechanism  *mechanism,
                                           DBusGMethodInvocation *context)
 {
-        check_can_do (mechanism,
-                      "org.opensettings.datetimemechanism.configure",
-                      context);
+        return _admit (deferred_call_new (mechanism, context, run_can_set));
+}
+
+static void
+free_gvalue (gpointer data)
+{
+        GValue *value = data;
+
+        g_value_unset (value);
+        g_free (value);
+}
+
+static void
+add_uint64 (GHashTable *statistics,
+            const char *name,
+            guint64     value)
+{
+        GValue *gvalue;
+
+        gvalue = g_new0 (GValue, 1);
+        g_value_init (gvalue, G_TYPE_UINT64);
+        g_value_set_uint64 (gvalue, value);
+        g_hash_table_insert (statistics, (gpointer) name, gvalue);
+}
+
+gboolean
+gsd_datetime_mechanism_get_statistics (GsdDatetimeMechanism  *mechanism,
+                                       DBusGMethodInvocation *context)
+{
+        FairQueueStatistics limits = { 0, };
+        GHashTable *statistics;
+
+        reset_killtimer ();
+
+        if (mechanism->priv->limiter != NULL)
+                fair_queue_get_statistics (mechanism->priv->limiter, &limits);
+
+        statistics = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, free_gvalue);
+        add_uint64 (statistics, "RequestsAdmitted", limits.admitted);
+        add_uint64 (statistics, "RequestsThrottled", limits.throttled);
+        add_uint64 (statistics, "RequestsRejected", limits.rejected);
+        add_uint64 (statistics, "RequestsQueued", limits.queued);
+        add_uint64 (statistics, "Clients", limits.clients);
+        add_uint64 (statistics, "JobsRunning", datetime_job_get_n_running ());
+        add_uint64 (statistics, "PeerConnections", datetime_peer_get_n_connections ());
+
+        dbus_g_method_return (context, statistics);
+        g_hash_table_unref (statistics);
+
+        return TRUE;
+}
+
+void
+gsd_datetime_mechanism_set_rate_limit (GsdDatetimeMechanism *mechanism,
+                                       double                rate,
+                                       guint                 burst,
+                                       double                total_rate)
+{
+        GsdDatetimeMechanismPrivate *priv = mechanism->priv;
+
+        if (priv->limiter != NULL) {
+                fair_queue_free (priv->limiter);
+                priv->limiter = NULL;
+        }
+
+        if (rate > 0 || total_rate > 0)
+                priv->limiter = fair_queue_new (rate, burst, total_rate, deferred_call_drop);
+}
+
+static gboolean
+rtc_sync_cb (gpointer user_data)
+{
+        GError *error = NULL;
+
+        /* Never against NTP, nor against a call that set the time or the
+         * zone and hasn't set the RTC to match yet */
+        if (datetime_clock_is_synchronized () ||
+            n_threads > 0 || datetime_job_get_n_running () > 0)
+                return TRUE;
+
+        /* The RTC only counts whole seconds */
+        if (!datetime_rtc_hctosys (1, &error)) {
+                g_warning ("%s", error->message);
+                g_error_free (error);
+        }
+
+        return TRUE;
+}
+
+/* For hosts that keep time with the RTC alone: every interval seconds,
+ * the system time is set from the RTC, corrected for drift, when they
+ * disagree and NTP isn't keeping it. The daemon then stays around. */
+void
+gsd_datetime_mechanism_set_rtc_sync_interval (GsdDatetimeMechanism *mechanism,
+                                              guint                 interval)
+{
+        if (rtc_sync_id > 0) {
+                g_source_remove (rtc_sync_id);
+                rtc_sync_id = 0;
+        }
+
+        if (interval > 0)
+                rtc_sync_id = g_timeout_add_seconds (interval, rtc_sync_cb, NULL);
+}
+
+/* With nothing else to do, the daemon exits after a while, and signals
+ * like TimeChanged go unsent. This keeps it around. */
+void
+gsd_datetime_mechanism_set_persistent (GsdDatetimeMechanism *mechanism,
+                                       gboolean              is_persistent)
+{
+        persistent = is_persistent;
+}
+
+static gboolean
+clock_stamp_cb (gpointer user_data)
+{
+        GError *error = NULL;
+
+        if (!datetime_stamp_save (FALSE, &error)) {
+                g_warning ("%s", error->message);
+                g_error_free (error);
+        }
 
         return TRUE;
 }
+
+/* Besides every time the time is set, save it every interval seconds. The
+ * timer runs on the monotonic clock, so setting the time doesn't make it
+ * fire early or late. The daemon then stays around. */
+void
+gsd_datetime_mechanism_set_clock_stamp_interval (GsdDatetimeMechanism *mechanism,
+                                                 guint                 interval)
+{
+        if (clock_stamp_id > 0) {
+                g_source_remove (clock_stamp_id);
+                clock_stamp_id = 0;
+        }
+
+        if (interval > 0)
+                clock_stamp_id = g_timeout_add_seconds (interval, clock_stamp_cb, NULL);
+}
@@ -51,6 +51,7 @@ typedef enum
         GSD_DATETIME_MECHANISM_ERROR_GENERAL,
         GSD_DATETIME_MECHANISM_ERROR_NOT_PRIVILEGED,
         GSD_DATETIME_MECHANISM_ERROR_INVALID_TIMEZONE_FILE,
+        GSD_DATETIME_MECHANISM_ERROR_LIMITS_EXCEEDED,
         GSD_DATETIME_MECHANISM_NUM_ERRORS
 } GsdDatetimeMechanismError;
 
@@ -64,6 +65,19 @@ GQuark                     gsd_datetime_mechanism_error_quark         (void);
 GType                      gsd_datetime_mechanism_get_type            (void);
 GsdDatetimeMechanism      *gsd_datetime_mechanism_new                 (void);
 
+/* Requests per second for each sender and for all of them, 0 for no
+ * limit; burst is how many requests a sender may make at once */
+void                       gsd_datetime_mechanism_set_rate_limit      (GsdDatetimeMechanism *mechanism,
+                                                                       double                rate,
+                                                                       guint                 burst,
+                                                                       double                total_rate);
+void                       gsd_datetime_mechanism_set_rtc_sync_interval (GsdDatetimeMechanism *mechanism,
+                                                                         guint                 interval);
+void                       gsd_datetime_mechanism_set_clock_stamp_interval (GsdDatetimeMechanism *mechanism,
+                                                                            guint                 interval);
+void                       gsd_datetime_mechanism_set_persistent      (GsdDatetimeMechanism *mechanism,
+                                                                       gboolean              is_persistent);
+
 /* exported methods */
 gboolean            gsd_datetime_mechanism_get_timezone (GsdDatetimeMechanism   *mechanism,
                                                          DBusGMethodInvocation  *context);
@@ -71,6 +85,11 @@ gboolean            gsd_datetime_mechanism_set_timezone (GsdDatetimeMechanism
                                                          const char             *zone_file,
                                                          DBusGMethodInvocation  *context);
 
+gboolean            gsd_datetime_mechanism_set_timezone_for_roots (GsdDatetimeMechanism  *mechanism,
+                                                                   const char            *tz,
+                                                                   char                 **roots,
+                                                                   DBusGMethodInvocation *context);
+
 gboolean            gsd_datetime_mechanism_can_set_timezone (GsdDatetimeMechanism  *mechanism,
                                                              DBusGMethodInvocation *context);
 
@@ -107,6 +126,13 @@ gboolean            gsd_datetime_mechanism_set_using_ntp  (GsdDatetimeMechanism
 
 gboolean            gsd_datetime_mechanism_can_set_using_ntp (GsdDatetimeMechanism  *mechanism,
                                                               DBusGMethodInvocation *context);
+
+gboolean            gsd_datetime_mechanism_apply (GsdDatetimeMechanism  *mechanism,
+                                                  GHashTable            *settings,
+                                                  DBusGMethodInvocation *context);
+
+gboolean            gsd_datetime_mechanism_get_statistics (GsdDatetimeMechanism  *mechanism,
+                                                           DBusGMethodInvocation *context);
 G_END_DECLS
 
 #endif /* GSD_DATETIME_MECHANISM_H */
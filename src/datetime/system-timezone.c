@@ -40,18 +40,23 @@
  * Largely based on Michael Fulbright's work on Anaconda.
  */
 
-/* FIXME: it'd be nice to filter out the timezones that we might get when
- * parsing config files that are not in zone.tab. Note that it's also wrong
- * in some cases: eg, in tzdata2008b, Asia/Calcutta got renamed to
- * Asia/Kolkata and the old name is not in zone.tab. */
+/* Names found in config files are checked against tzdata's own list of
+ * zones and links (see system_timezone_canonicalize()), not zone.tab, so
+ * that renamed zones like Asia/Calcutta, now Asia/Kolkata, are known. */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <gio/gio.h>
 
+#include "config-writer.h"
+#include "parsers.h"
 #include "system-timezone.h"
 
 /* Files that we look at */
@@ -62,6 +67,13 @@
 #define ETC_CONF_D_CLOCK    "/etc/conf.d/clock"
 #define ETC_LOCALTIME       "/etc/localtime"
 
+/* tzdata's lists of zones and links, most complete first */
+#define TZDATA_ZI           SYSTEM_ZONEINFODIR"/tzdata.zi"
+#define TZDATA_ZONE1970_TAB SYSTEM_ZONEINFODIR"/zone1970.tab"
+#define TZDATA_ZONE_TAB     SYSTEM_ZONEINFODIR"/zone.tab"
+#define TZDATA_BACKWARD     SYSTEM_ZONEINFODIR"/backward"
+#define TZDATA_ETCETERA     SYSTEM_ZONEINFODIR"/etcetera"
+
 /* The first 4 characters in a timezone file, from tzfile.h */
 #define TZ_MAGIC "TZif"
 
@@ -240,30 +252,21 @@ system_timezone_read_etc_timezone (void)
 }
 
 static gboolean
-system_timezone_write_etc_timezone (const char  *tz,
-                                    GError     **error)
+system_timezone_write_etc_timezone (ConfigTransaction  *transaction,
+                                    const char         *tz,
+                                    GError            **error)
 {
         char     *content;
-        GError   *our_error;
         gboolean  retval;
 
         if (!g_file_test (ETC_TIMEZONE, G_FILE_TEST_IS_REGULAR))
                 return TRUE;
 
         content = g_strdup_printf ("%s\n", tz);
-
-        our_error = NULL;
-        retval = g_file_set_contents (ETC_TIMEZONE, content, -1, &our_error);
+        retval = config_transaction_set_contents (transaction, ETC_TIMEZONE,
+                                                  content, -1, error);
         g_free (content);
 
-        if (!retval) {
-                g_set_error (error, SYSTEM_TIMEZONE_ERROR,
-                             SYSTEM_TIMEZONE_ERROR_GENERAL,
-                             ETC_TIMEZONE" cannot be overwritten: %s",
-                             our_error->message);
-                g_error_free (our_error);
-        }
-
         return retval;
 }
 
@@ -274,136 +277,15 @@ static char *
 system_timezone_read_key_file (const char *filename,
                                const char *key)
 {
-        GIOChannel *channel;
-        char       *key_eq;
-        char       *line;
-        char       *retval;
-
-        if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR))
-                return NULL;
+        char *contents;
+        char *retval;
 
-        channel = g_io_channel_new_file (filename, "r", NULL);
-        if (!channel)
+        if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR) ||
+            !g_file_get_contents (filename, &contents, NULL, NULL))
                 return NULL;
 
-        key_eq = g_strdup_printf ("%s=", key);
-        retval = NULL;
-
-        while (g_io_channel_read_line (channel, &line, NULL,
-                                       NULL, NULL) == G_IO_STATUS_NORMAL) {
-                if (g_str_has_prefix (line, key_eq)) {
-                        char *value;
-                        int   len;
-
-                        value = line + strlen (key_eq);
-                        g_strstrip (value);
-
-                        len = strlen (value);
-
-                        if (value[0] == '\"') {
-                                if (value[len - 1] == '\"') {
-                                        if (retval)
-                                                g_free (retval);
-
-                                        retval = g_strndup (value + 1,
-                                                            len - 2);
-                                }
-                        } else {
-                                if (retval)
-                                        g_free (retval);
-
-                                retval = g_strdup (line + strlen (key_eq));
-                        }
-
-                        g_strstrip (retval);
-                }
-
-                g_free (line);
-        }
-
-        g_free (key_eq);
-        g_io_channel_unref (channel);
-
-        return retval;
-}
-
-static gboolean
-system_timezone_write_key_file (const char  *filename,
-                                const char  *key,
-                                const char  *value,
-                                GError     **error)
-{
-        GError    *our_error;
-        char      *content;
-        gsize      len;
-        char      *key_eq;
-        char     **lines;
-        gboolean   replaced;
-        gboolean   retval;
-        int        n;
-        
-        if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR))
-                return TRUE;
-
-        our_error = NULL;
-
-        if (!g_file_get_contents (filename, &content, &len, &our_error)) {
-                g_set_error (error, SYSTEM_TIMEZONE_ERROR,
-                             SYSTEM_TIMEZONE_ERROR_GENERAL,
-                             "%s cannot be read: %s",
-                             filename, our_error->message);
-                g_error_free (our_error);
-                return FALSE;
-        }
-
-        lines = g_strsplit (content, "\n", 0);
-        g_free (content);
-
-        key_eq = g_strdup_printf ("%s=", key);
-        replaced = FALSE;
-
-        for (n = 0; lines[n] != NULL; n++) {
-                if (g_str_has_prefix (lines[n], key_eq)) {
-                        char     *old_value;
-                        gboolean  use_quotes;
-
-                        old_value = lines[n] + strlen (key_eq);
-                        g_strstrip (old_value);
-                        use_quotes = old_value[0] == '\"';
-
-                        g_free (lines[n]);
-
-                        if (use_quotes)
-                                lines[n] = g_strdup_printf ("%s\"%s\"",
-                                                            key_eq, value);
-                        else
-                                lines[n] = g_strdup_printf ("%s%s",
-                                                            key_eq, value);
-
-                        replaced = TRUE;
-                }
-        }
-
-        g_free (key_eq);
-
-        if (!replaced) {
-                g_strfreev (lines);
-                return TRUE;
-        }
-
-        content = g_strjoinv ("\n", lines);
-        g_strfreev (lines);
-
-        retval = g_file_set_contents (filename, content, -1, &our_error);
-        g_free (content);
-
-        if (!retval) {
-                g_set_error (error, SYSTEM_TIMEZONE_ERROR,
-                             SYSTEM_TIMEZONE_ERROR_GENERAL,
-                             "%s cannot be overwritten: %s",
-                             filename, our_error->message);
-                g_error_free (our_error);
-        }
+        retval = parse_key_file_value (contents, key);
+        g_free (contents);
 
         return retval;
 }
@@ -417,11 +299,12 @@ system_timezone_read_etc_TIMEZONE (void)
 }
 
 static gboolean
-system_timezone_write_etc_TIMEZONE (const char  *tz,
-                                    GError     **error)
+system_timezone_write_etc_TIMEZONE (ConfigTransaction  *transaction,
+                                    const char         *tz,
+                                    GError            **error)
 {
-        return system_timezone_write_key_file (ETC_TIMEZONE_MAJ,
-                                               "TZ", tz, error);
+        return config_transaction_set_key (transaction, ETC_TIMEZONE_MAJ,
+                                           "TZ", tz, FALSE, error);
 }
 
 /* This works for Fedora and Mandriva */
@@ -433,11 +316,12 @@ system_timezone_read_etc_sysconfig_clock (void)
 }
 
 static gboolean
-system_timezone_write_etc_sysconfig_clock (const char  *tz,
-                                           GError     **error)
+system_timezone_write_etc_sysconfig_clock (ConfigTransaction  *transaction,
+                                           const char         *tz,
+                                           GError            **error)
 {
-        return system_timezone_write_key_file (ETC_SYSCONFIG_CLOCK,
-                                               "ZONE", tz, error);
+        return config_transaction_set_key (transaction, ETC_SYSCONFIG_CLOCK,
+                                           "ZONE", tz, FALSE, error);
 }
 
 /* This works for openSUSE */
@@ -449,11 +333,12 @@ system_timezone_read_etc_sysconfig_clock_alt (void)
 }
 
 static gboolean
-system_timezone_write_etc_sysconfig_clock_alt (const char  *tz,
-                                               GError     **error)
+system_timezone_write_etc_sysconfig_clock_alt (ConfigTransaction  *transaction,
+                                               const char         *tz,
+                                               GError            **error)
 {
-        return system_timezone_write_key_file (ETC_SYSCONFIG_CLOCK,
-                                               "TIMEZONE", tz, error);
+        return config_transaction_set_key (transaction, ETC_SYSCONFIG_CLOCK,
+                                           "TIMEZONE", tz, FALSE, error);
 }
 
 /* This works for old Gentoo */
@@ -465,11 +350,12 @@ system_timezone_read_etc_conf_d_clock (void)
 }
 
 static gboolean
-system_timezone_write_etc_conf_d_clock (const char  *tz,
-                                        GError     **error)
+system_timezone_write_etc_conf_d_clock (ConfigTransaction  *transaction,
+                                        const char         *tz,
+                                        GError            **error)
 {
-        return system_timezone_write_key_file (ETC_CONF_D_CLOCK,
-                                               "TIMEZONE", tz, error);
+        return config_transaction_set_key (transaction, ETC_CONF_D_CLOCK,
+                                           "TIMEZONE", tz, FALSE, error);
 }
 
 /* This works for Ataraxia GNU/Linux-Libre */
@@ -481,11 +367,12 @@ system_timezone_read_etc_rc_conf (void)
 }
 
 static gboolean
-system_timezone_write_etc_rc_conf (const char  *tz,
-                                   GError     **error)
+system_timezone_write_etc_rc_conf (ConfigTransaction  *transaction,
+                                   const char         *tz,
+                                   GError            **error)
 {
-        return system_timezone_write_key_file (ETC_RC_CONF,
-                                               "timezone", tz, error);
+        return config_transaction_set_key (transaction, ETC_RC_CONF,
+                                           "timezone", tz, FALSE, error);
 }
 
 /*
@@ -497,23 +384,7 @@ system_timezone_write_etc_rc_conf (const char  *tz,
 static char *
 system_timezone_strip_path_if_valid (const char *filename)
 {
-        int skip;
-
-        if (!filename || !g_str_has_prefix (filename, SYSTEM_ZONEINFODIR"/"))
-                return NULL;
-
-        /* Timezone data files also live under posix/ and right/ for some
-         * reason.
-         * FIXME: make sure accepting those files is valid. I think "posix" is
-         * okay, not sure about "right" */
-        if (g_str_has_prefix (filename, SYSTEM_ZONEINFODIR"/posix/"))
-                skip = strlen (SYSTEM_ZONEINFODIR"/posix/");
-        else if (g_str_has_prefix (filename, SYSTEM_ZONEINFODIR"/right/"))
-                skip = strlen (SYSTEM_ZONEINFODIR"/right/");
-        else
-                skip = strlen (SYSTEM_ZONEINFODIR"/");
-
-        return g_strdup (filename + skip);
+        return parse_zoneinfo_path (filename, SYSTEM_ZONEINFODIR);
 }
 
 /* Read the soft symlink from /etc/localtime */
@@ -710,18 +581,7 @@ static GetSystemTimezone get_system_timezone_methods[] = {
 static gboolean
 system_timezone_is_valid (const char *tz)
 {
-        const char *c;
-
-        if (!tz)
-                return FALSE;
-
-        for (c = tz; *c != '\0'; c++) {
-                if (!(g_ascii_isalnum (*c) ||
-                      *c == '/' || *c == '-' || *c == '_'))
-                        return FALSE;
-        }
-
-        return TRUE;
+        return parse_tz_name_is_valid (tz);
 }
 
 char *
@@ -742,6 +602,262 @@ system_timezone_find (void)
         return g_strdup ("UTC");
 }
 
+/*
+ *
+ * Zone names.
+ *
+ */
+
+/* Every zone and link name, mapped to the name of the zone itself: the
+ * value of a zone is its own key, the value of a link is the key of its
+ * zone. Loaded once, and again only when a lookup misses and the file it
+ * was loaded from changed. */
+static GHashTable *tzdb = NULL;
+static char       *tzdb_source = NULL;
+static struct stat tzdb_stat;
+G_LOCK_DEFINE_STATIC (tzdb);
+
+static void
+tzdb_add_zone (GHashTable *zones,
+               const char *name)
+{
+        if (!g_hash_table_contains (zones, name))
+                g_hash_table_add (zones, g_strdup (name));
+}
+
+/* Zone lines are "Z name ..." in tzdata.zi and "Zone name ..." in the
+ * source files; link lines are "L target name" and "Link target name".
+ * zone.tab and zone1970.tab have the zone name in their third column. */
+static void
+tzdb_parse (const char *contents,
+            gboolean    tab,
+            GHashTable *zones,
+            GHashTable *links)
+{
+        char **lines;
+        char **fields;
+        int i, j, n;
+
+        lines = g_strsplit (contents, "\n", -1);
+        for (i = 0; lines[i] != NULL; i++) {
+                if (lines[i][0] == '#' || lines[i][0] == '\0')
+                        continue;
+
+                if (tab) {
+                        fields = g_strsplit (lines[i], "\t", 4);
+                        if (g_strv_length (fields) >= 3)
+                                tzdb_add_zone (zones, fields[2]);
+                        g_strfreev (fields);
+                        continue;
+                }
+
+                /* The source files align columns with runs of tabs */
+                fields = g_strsplit_set (lines[i], " \t", -1);
+                for (j = 0, n = 0; fields[j] != NULL; j++) {
+                        if (fields[j][0] == '\0')
+                                g_free (fields[j]);
+                        else
+                                fields[n++] = fields[j];
+                }
+                fields[n] = NULL;
+
+                if (n >= 2 && (strcmp (fields[0], "Z") == 0 || strcmp (fields[0], "Zone") == 0))
+                        tzdb_add_zone (zones, fields[1]);
+                else if (n >= 3 && (strcmp (fields[0], "L") == 0 || strcmp (fields[0], "Link") == 0))
+                        g_hash_table_insert (links, g_strdup (fields[2]), g_strdup (fields[1]));
+                g_strfreev (fields);
+        }
+        g_strfreev (lines);
+}
+
+static gboolean
+tzdb_parse_file (const char *filename,
+                 gboolean    tab,
+                 GHashTable *zones,
+                 GHashTable *links)
+{
+        char *contents;
+
+        if (!g_file_get_contents (filename, &contents, NULL, NULL))
+                return FALSE;
+
+        tzdb_parse (contents, tab, zones, links);
+        g_free (contents);
+
+        return TRUE;
+}
+
+/* Called locked */
+static void
+tzdb_load (void)
+{
+        GHashTable *zones, *links;
+        GHashTableIter iter;
+        gpointer name, target;
+        gpointer zone;
+        int hops;
+
+        if (tzdb != NULL)
+                g_hash_table_unref (tzdb);
+        tzdb = NULL;
+        g_free (tzdb_source);
+        tzdb_source = NULL;
+
+        zones = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        links = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+        if (tzdb_parse_file (TZDATA_ZI, FALSE, zones, links))
+                tzdb_source = g_strdup (TZDATA_ZI);
+        else if (tzdb_parse_file (TZDATA_ZONE1970_TAB, TRUE, zones, links))
+                tzdb_source = g_strdup (TZDATA_ZONE1970_TAB);
+        else if (tzdb_parse_file (TZDATA_ZONE_TAB, TRUE, zones, links))
+                tzdb_source = g_strdup (TZDATA_ZONE_TAB);
+
+        /* The tables don't list links, nor UTC and the other Etc/ zones */
+        if (tzdb_source != NULL && strcmp (tzdb_source, TZDATA_ZI) != 0) {
+                tzdb_parse_file (TZDATA_ETCETERA, FALSE, zones, links);
+                tzdb_parse_file (TZDATA_BACKWARD, FALSE, zones, links);
+                tzdb_add_zone (zones, "UTC");
+        }
+
+        if (tzdb_source == NULL || g_stat (tzdb_source, &tzdb_stat) != 0) {
+                g_hash_table_unref (zones);
+                g_hash_table_unref (links);
+                g_free (tzdb_source);
+                tzdb_source = NULL;
+                return;
+        }
+
+        /* Zones were added mapped to themselves. Links point to zones, but
+         * follow a few hops anyway. */
+        g_hash_table_iter_init (&iter, links);
+        while (g_hash_table_iter_next (&iter, &name, &target)) {
+                zone = NULL;
+                for (hops = 0; hops < 8 && target != NULL && zone == NULL; hops++) {
+                        zone = g_hash_table_lookup (zones, target);
+                        target = g_hash_table_lookup (links, target);
+                }
+                if (zone != NULL && !g_hash_table_contains (zones, name))
+                        g_hash_table_insert (zones, g_strdup (name), zone);
+        }
+        g_hash_table_unref (links);
+
+        tzdb = zones;
+}
+
+/* Called locked */
+static gboolean
+tzdb_is_stale (void)
+{
+        struct stat st;
+
+        if (tzdb_source == NULL)
+                return TRUE;
+
+        if (g_stat (tzdb_source, &st) != 0)
+                return TRUE;
+
+        return st.st_ino != tzdb_stat.st_ino ||
+               st.st_size != tzdb_stat.st_size ||
+               st.st_mtime != tzdb_stat.st_mtime;
+}
+
+/* Without tzdata's lists, at least make sure the name stays under
+ * SYSTEM_ZONEINFODIR */
+static gboolean
+system_timezone_name_is_safe (const char *tz)
+{
+        char **parts;
+        gboolean retval;
+        int i;
+
+        if (tz[0] == '\0' || tz[0] == '/')
+                return FALSE;
+
+        retval = TRUE;
+        parts = g_strsplit (tz, "/", -1);
+        for (i = 0; parts[i] != NULL; i++) {
+                if (parts[i][0] == '\0' ||
+                    strcmp (parts[i], ".") == 0 ||
+                    strcmp (parts[i], "..") == 0) {
+                        retval = FALSE;
+                        break;
+                }
+        }
+        g_strfreev (parts);
+
+        return retval;
+}
+
+static gboolean system_timezone_is_zone_file_valid (const char  *zone_file,
+                                                    GError     **error);
+
+char *
+system_timezone_canonicalize (const char  *tz,
+                              GError     **error)
+{
+        const char *zone = NULL;
+        gboolean known;
+
+        g_return_val_if_fail (tz != NULL, NULL);
+
+        G_LOCK (tzdb);
+
+        if (tzdb_source == NULL)
+                tzdb_load ();
+
+        known = tzdb != NULL;
+        if (known) {
+                zone = g_hash_table_lookup (tzdb, tz);
+                /* Maybe tzdata was updated since */
+                if (zone == NULL && tzdb_is_stale ()) {
+                        tzdb_load ();
+                        known = tzdb != NULL;
+                        if (known)
+                                zone = g_hash_table_lookup (tzdb, tz);
+                }
+        }
+
+        if (zone != NULL) {
+                char *ret = g_strdup (zone);
+
+                G_UNLOCK (tzdb);
+                return ret;
+        }
+
+        G_UNLOCK (tzdb);
+
+        /* The lists may leave out zones that tzdata installs anyway, so a
+         * name they don't have is still good if its zone file is */
+        if (known) {
+                char *zone_file;
+                gboolean valid;
+
+                zone_file = g_build_filename (SYSTEM_ZONEINFODIR, tz, NULL);
+                valid = system_timezone_name_is_safe (tz) &&
+                        system_timezone_is_zone_file_valid (zone_file, NULL);
+                g_free (zone_file);
+
+                if (!valid) {
+                        g_set_error (error, SYSTEM_TIMEZONE_ERROR,
+                                     SYSTEM_TIMEZONE_ERROR_INVALID_TIMEZONE_FILE,
+                                     "Unknown timezone '%s'", tz);
+                        return NULL;
+                }
+
+                return g_strdup (tz);
+        }
+
+        if (!system_timezone_name_is_safe (tz)) {
+                g_set_error (error, SYSTEM_TIMEZONE_ERROR,
+                             SYSTEM_TIMEZONE_ERROR_INVALID_TIMEZONE_FILE,
+                             "Timezone file '%s' was invalid.", tz);
+                return NULL;
+        }
+
+        return g_strdup (tz);
+}
+
 /*
  *
  * Now, setting the timezone.
@@ -807,25 +923,19 @@ system_timezone_is_zone_file_valid (const char  *zone_file,
 }
 
 static gboolean
-system_timezone_set_etc_timezone (const char  *zone_file,
-                                  GError     **error)
+system_timezone_set_etc_timezone (ConfigTransaction  *transaction,
+                                  const char         *zone_file,
+                                  GError            **error)
 {
-        GError *our_error;
-        char   *content;
-        gsize   len;
-
-        if (!system_timezone_is_zone_file_valid (zone_file, error))
-                return FALSE;
+        GError   *our_error;
+        char     *content;
+        gsize     len;
+        gboolean  retval;
 
         /* If /etc/localtime is a symlink, write a symlink */
-        if (g_file_test (ETC_LOCALTIME, G_FILE_TEST_IS_SYMLINK)) {
-                if (g_unlink (ETC_LOCALTIME) == 0 &&
-                    symlink (zone_file, ETC_LOCALTIME) == 0)
-                        return TRUE;
-
-                /* If we couldn't symlink the file, we'll just fallback on
-                 * copying it */
-        }
+        if (g_file_test (ETC_LOCALTIME, G_FILE_TEST_IS_SYMLINK))
+                return config_transaction_set_symlink (transaction, ETC_LOCALTIME,
+                                                       zone_file, error);
 
         /* Else copy the file to /etc/localtime. We explicitly avoid doing
          * hard links since they break with different partitions */
@@ -839,23 +949,16 @@ system_timezone_set_etc_timezone (const char  *zone_file,
                 return FALSE;
         }
 
-        if (!g_file_set_contents (ETC_LOCALTIME, content, len, &our_error)) {
-                g_set_error (error, SYSTEM_TIMEZONE_ERROR,
-                             SYSTEM_TIMEZONE_ERROR_GENERAL,
-                             ETC_LOCALTIME" cannot be overwritten: %s",
-                             our_error->message);
-                g_error_free (our_error);
-                g_free (content);
-                return FALSE;
-        }
-
+        retval = config_transaction_set_contents (transaction, ETC_LOCALTIME,
+                                                  content, len, error);
         g_free (content);
 
-        return TRUE;
+        return retval;
 }
 
-typedef gboolean (*SetSystemTimezone) (const char  *tz,
-                                       GError     **error);
+typedef gboolean (*SetSystemTimezone) (ConfigTransaction  *transaction,
+                                       const char         *tz,
+                                       GError            **error);
 /* The order here does not matter too much: we'll try to change all files
  * that already have a timezone configured. It matters in case of error,
  * since the process will be stopped and the last methods won't be called.
@@ -875,13 +978,14 @@ static SetSystemTimezone set_system_timezone_methods[] = {
 };
 
 static gboolean
-system_timezone_update_config (const char  *tz,
-                               GError     **error)
+system_timezone_update_config (ConfigTransaction  *transaction,
+                               const char         *tz,
+                               GError            **error)
 {
         int i;
 
         for (i = 0; set_system_timezone_methods[i] != NULL; i++) {
-                if (!set_system_timezone_methods[i] (tz, error))
+                if (!set_system_timezone_methods[i] (transaction, tz, error))
                         return FALSE;
                 /* FIXME: maybe continue to change all config files if
                  * possible? */
@@ -894,23 +998,315 @@ gboolean
 system_timezone_set (const char  *tz,
                      GError     **error)
 {
-        char     *zone_file;
-        gboolean  retval;
+        ConfigTransaction *transaction;
+        GError            *our_error;
+        char              *zone_file;
+        gboolean           retval;
 
         g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
         zone_file = g_build_filename (SYSTEM_ZONEINFODIR, tz, NULL);
 
-        /* FIXME: is it right to return FALSE even when /etc/localtime was
-         * changed but not the config files? */
-        retval = system_timezone_set_etc_timezone (zone_file, error) &&
-                 system_timezone_update_config (tz, error);
+        if (!system_timezone_is_zone_file_valid (zone_file, error)) {
+                g_free (zone_file);
+                return FALSE;
+        }
+
+        /* /etc/localtime and the config files are all replaced in one go,
+         * or left as they were */
+        transaction = config_transaction_new ();
+        our_error = NULL;
+        retval = system_timezone_set_etc_timezone (transaction, zone_file, &our_error) &&
+                 system_timezone_update_config (transaction, tz, &our_error) &&
+                 config_transaction_commit (transaction, &our_error);
+        config_transaction_free (transaction);
 
         g_free (zone_file);
 
+        if (!retval) {
+                g_set_error (error, SYSTEM_TIMEZONE_ERROR,
+                             SYSTEM_TIMEZONE_ERROR_GENERAL,
+                             "%s", our_error->message);
+                g_error_free (our_error);
+        }
+
         return retval;
 }
 
+/*
+ *
+ * And setting it in other system trees, like container images. Each tree
+ * is worked on from a thread jailed in it, so that its paths, and the
+ * symlinks in it, resolve the way they will when it runs.
+ *
+ */
+
+typedef struct {
+        const char          *tz;
+        char                *zone_file;
+        char                *contents;
+        gsize                len;
+        gboolean             share_link;
+        int                  host_root;
+        int                  host_cwd;
+
+        const char * const  *roots;
+        GError             **errors;
+
+        /* st_dev -> 1 + fd of a /etc/localtime on that filesystem that
+         * held contents when it was last looked at */
+        GMutex               lock;
+        GHashTable          *seeds;
+} RootsData;
+
+static void
+close_seed (gpointer data)
+{
+        close (GPOINTER_TO_INT (data) - 1);
+}
+
+/* Whether the file open as fd holds the zone, byte for byte. A seed is
+ * in a tree that others can write to, so it's checked each time before
+ * its data is shared with another tree. */
+static gboolean
+system_timezone_seed_matches (RootsData *data,
+                              int        fd)
+{
+        struct stat st;
+        char        buf[4096];
+        gsize       done;
+        ssize_t     n;
+
+        if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) ||
+            (gsize) st.st_size != data->len)
+                return FALSE;
+
+        for (done = 0; done < data->len; done += n) {
+                n = pread (fd, buf, MIN (sizeof (buf), data->len - done), done);
+                if (n < 0 && errno == EINTR) {
+                        n = 0;
+                        continue;
+                }
+                if (n <= 0 || memcmp (buf, data->contents + done, n) != 0)
+                        return FALSE;
+        }
+
+        return TRUE;
+}
+
+static int
+system_timezone_get_seed (RootsData *data,
+                          dev_t      dev)
+{
+        gint64 key = dev;
+        int    fd;
+
+        g_mutex_lock (&data->lock);
+        fd = GPOINTER_TO_INT (g_hash_table_lookup (data->seeds, &key)) - 1;
+        g_mutex_unlock (&data->lock);
+
+        if (fd >= 0 && !system_timezone_seed_matches (data, fd))
+                return -1;
+
+        return fd;
+}
+
+/* Let the next trees on the filesystem share this one's copy, keyed by
+ * the filesystem the copy is on */
+static void
+system_timezone_add_seed (RootsData *data)
+{
+        struct stat st;
+        gint64     *key;
+        int         fd;
+
+        fd = open (ETC_LOCALTIME, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+                return;
+
+        if (fstat (fd, &st) != 0 || !system_timezone_seed_matches (data, fd)) {
+                close (fd);
+                return;
+        }
+
+        key = g_new (gint64, 1);
+        *key = st.st_dev;
+
+        g_mutex_lock (&data->lock);
+        if (!g_hash_table_contains (data->seeds, key)) {
+                g_hash_table_insert (data->seeds, key, GINT_TO_POINTER (fd + 1));
+                fd = -1;
+        }
+        g_mutex_unlock (&data->lock);
+
+        if (fd >= 0) {
+                close (fd);
+                g_free (key);
+        }
+}
+
+/* Called jailed in the tree */
+static gboolean
+system_timezone_set_jailed (RootsData  *data,
+                            GError    **error)
+{
+        ConfigTransaction *transaction;
+        GError            *our_error;
+        struct stat        st;
+        gboolean           keep_link;
+        gboolean           retval;
+
+        if (stat ("/etc", &st) != 0 || !S_ISDIR (st.st_mode)) {
+                g_set_error (error, SYSTEM_TIMEZONE_ERROR,
+                             SYSTEM_TIMEZONE_ERROR_GENERAL,
+                             "No /etc directory");
+                return FALSE;
+        }
+
+        /* A symlink stays one if the tree has the zone in its own tzdata,
+         * else the running system's zone file is copied in */
+        keep_link = g_file_test (ETC_LOCALTIME, G_FILE_TEST_IS_SYMLINK) &&
+                    system_timezone_is_zone_file_valid (data->zone_file, NULL);
+
+        transaction = config_transaction_new ();
+        our_error = NULL;
+        if (keep_link)
+                retval = config_transaction_set_symlink (transaction, ETC_LOCALTIME,
+                                                         data->zone_file, &our_error);
+        else
+                retval = config_transaction_set_contents_shared (transaction, ETC_LOCALTIME,
+                                                                 data->contents, data->len,
+                                                                 system_timezone_get_seed (data, st.st_dev),
+                                                                 data->share_link,
+                                                                 &our_error);
+        retval = retval &&
+                 system_timezone_update_config (transaction, data->tz, &our_error) &&
+                 config_transaction_commit (transaction, &our_error);
+        config_transaction_free (transaction);
+
+        if (!retval) {
+                g_set_error (error, SYSTEM_TIMEZONE_ERROR,
+                             SYSTEM_TIMEZONE_ERROR_GENERAL,
+                             "%s", our_error->message);
+                g_error_free (our_error);
+                return FALSE;
+        }
+
+        if (!keep_link && system_timezone_get_seed (data, st.st_dev) < 0)
+                system_timezone_add_seed (data);
+
+        return TRUE;
+}
+
+static void
+system_timezone_set_root_thread (gpointer item,
+                                 gpointer user_data)
+{
+        RootsData  *data = user_data;
+        guint       i = GPOINTER_TO_UINT (item) - 1;
+        const char *root = data->roots[i];
+        int         fd;
+
+        fd = open (root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0 ||
+            unshare (CLONE_FS) != 0 ||
+            fchdir (fd) != 0 ||
+            chroot (".") != 0) {
+                g_set_error (&data->errors[i], SYSTEM_TIMEZONE_ERROR,
+                             SYSTEM_TIMEZONE_ERROR_GENERAL,
+                             "Cannot enter %s: %s", root, g_strerror (errno));
+                if (fd >= 0)
+                        close (fd);
+        } else {
+                close (fd);
+                system_timezone_set_jailed (data, &data->errors[i]);
+        }
+
+        /* Come back out, for the next tree and in case GLib hands the
+         * thread to someone else; one that can't mustn't go on */
+        if (fchdir (data->host_root) != 0 ||
+            chroot (".") != 0 ||
+            fchdir (data->host_cwd) != 0)
+                g_error ("Cannot leave %s: %s", root, g_strerror (errno));
+}
+
+void
+system_timezone_set_for_roots (const char          *tz,
+                               const char * const  *roots,
+                               guint                n_roots,
+                               gboolean             share_link,
+                               GError             **errors)
+{
+        RootsData    data = { 0, };
+        GThreadPool *pool;
+        GError      *error;
+        guint        i;
+
+        g_return_if_fail (tz != NULL);
+
+        if (n_roots == 0)
+                return;
+
+        data.tz = tz;
+        data.host_root = -1;
+        data.host_cwd = -1;
+        data.share_link = share_link;
+        data.roots = roots;
+        data.errors = errors;
+        data.zone_file = g_build_filename (SYSTEM_ZONEINFODIR, tz, NULL);
+
+        /* The zone file is read once, for all of them */
+        error = NULL;
+        if (!system_timezone_is_zone_file_valid (data.zone_file, &error))
+                goto out;
+        if (!g_file_get_contents (data.zone_file, &data.contents, &data.len, &error)) {
+                g_clear_error (&error);
+                g_set_error (&error, SYSTEM_TIMEZONE_ERROR,
+                             SYSTEM_TIMEZONE_ERROR_GENERAL,
+                             "Timezone file %s cannot be read",
+                             data.zone_file);
+                goto out;
+        }
+
+        data.host_root = open ("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        data.host_cwd = open (".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (data.host_root < 0 || data.host_cwd < 0) {
+                g_set_error (&error, SYSTEM_TIMEZONE_ERROR,
+                             SYSTEM_TIMEZONE_ERROR_GENERAL,
+                             "Cannot open the current directories: %s",
+                             g_strerror (errno));
+                goto out;
+        }
+
+        g_mutex_init (&data.lock);
+        data.seeds = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                            g_free, close_seed);
+
+        pool = g_thread_pool_new (system_timezone_set_root_thread, &data,
+                                  MIN (n_roots, g_get_num_processors ()),
+                                  TRUE, NULL);
+        for (i = 0; i < n_roots; i++)
+                g_thread_pool_push (pool, GUINT_TO_POINTER (i + 1), NULL);
+        g_thread_pool_free (pool, FALSE, TRUE);
+
+        g_hash_table_destroy (data.seeds);
+        g_mutex_clear (&data.lock);
+
+out:
+        if (error != NULL) {
+                for (i = 0; i < n_roots; i++)
+                        errors[i] = g_error_copy (error);
+                g_error_free (error);
+        }
+
+        if (data.host_root >= 0)
+                close (data.host_root);
+        if (data.host_cwd >= 0)
+                close (data.host_cwd);
+        g_free (data.contents);
+        g_free (data.zone_file);
+}
+
 GQuark
 system_timezone_error_quark (void)
 {
@@ -73,8 +73,23 @@ typedef enum
 
 char *system_timezone_find (void);
 
+/* The name of the zone tz is, or is a link to, per tzdata */
+char *system_timezone_canonicalize (const char  *tz,
+                                    GError     **error);
+
 gboolean system_timezone_set (const char  *tz,
                               GError     **error);
 
+/* Set tz in each of the system trees under roots, several at a time.
+ * Where a tree's /etc/localtime is a copy, the copies on one filesystem
+ * share their data, as reflinks or, with share_link, hard links. errors
+ * has n_roots slots, and those of the trees that were set are left NULL.
+ * Needs CAP_SYS_CHROOT. */
+void     system_timezone_set_for_roots (const char          *tz,
+                                        const char * const  *roots,
+                                        guint                n_roots,
+                                        gboolean             share_link,
+                                        GError             **errors);
+
 G_END_DECLS
 #endif /* __SYSTEM_TIMEZONE_H__ */
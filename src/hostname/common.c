@@ -4,273 +4,191 @@
 
 */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <glib.h>
 #include <gio/gio.h>
 #include <dbus/dbus-protocol.h>
 #include <polkit/polkit.h>
 
 #include "common.h"
+#include "parsers.h"
+#include "peer.h"
 
-#define READ_ERROR 1
-#define READ_ERROR_GENERAL 1
 #define PIDFILE "/run/hostname1.pid"
 
-struct check_polkit_data {
-	const gchar *unique_name;
-	const gchar *action_id;
-	gboolean user_interaction;
-	GAsyncReadyCallback callback;
-	gpointer user_data;
+#define SUBJECT_CACHE_SIZE 32
 
-	PolkitAuthority *authority;
+/* Bus names, which are never reused, and the subject made for each, so
+ * a client setting several keys costs one subject. Fixed-size, oldest
+ * use replaced. */
+typedef struct {
+	gchar name[256];
 	PolkitSubject *subject;
-};
+	guint64 used;
+} SubjectCacheEntry;
+
+static SubjectCacheEntry subject_cache[SUBJECT_CACHE_SIZE];
+static guint64 subject_cache_clock = 0;
+
+G_LOCK_DEFINE_STATIC (authority);
+G_LOCK_DEFINE_STATIC (subject_cache);
 
 char *read_key_file (const char *filename,
                                const char *key)
 {
-        GIOChannel *channel;
-        char       *key_eq;
-        char       *line;
-        char       *retval;
-
-        if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR))
-                return NULL;
+        char *contents;
+        char *retval;
 
-        channel = g_io_channel_new_file (filename, "r", NULL);
-        if (!channel)
+        if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR) ||
+            !g_file_get_contents (filename, &contents, NULL, NULL))
                 return NULL;
 
-        key_eq = g_strdup_printf ("%s=", key);
-        retval = NULL;
-
-        while (g_io_channel_read_line (channel, &line, NULL,
-                                       NULL, NULL) == G_IO_STATUS_NORMAL) {
-                if (g_str_has_prefix (line, key_eq)) {
-                        char *value;
-                        int   len;
-
-                        value = line + strlen (key_eq);
-                        g_strstrip (value);
-
-                        len = strlen (value);
-
-                        if (value[0] == '\"') {
-                                if (value[len - 1] == '\"') {
-                                        if (retval)
-                                                g_free (retval);
-
-                                        retval = g_strndup (value + 1,
-                                                            len - 2);
-                                }
-                        } else {
-                                if (retval)
-                                        g_free (retval);
-
-                                retval = g_strdup (line + strlen (key_eq));
-                        }
-
-                        g_strstrip (retval);
-                }
-
-                g_free (line);
-        }
-
-        g_free (key_eq);
-        g_io_channel_unref (channel);
+        retval = parse_key_file_value (contents, key);
+        g_free (contents);
 
         return retval;
 }
 
-gboolean write_key_file (const char  *filename,
-                                const char  *key,
-                                const char  *value,
-                                GError     **error)
+/* Every key of a KEY=VALUE file in one pass, same rules as read_key_file ().
+ * A missing file gives an empty table. */
+GHashTable *
+read_env_file (const char *filename)
 {
-        GError    *our_error;
-        char      *content;
-        gsize      len;
-        char      *key_eq;
-        char     **lines;
-        gboolean   replaced;
-        gboolean   retval;
-        int        n;
-        
-        if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR))
-                return TRUE;
-
-        our_error = NULL;
-
-        if (!g_file_get_contents (filename, &content, &len, &our_error)) {
-                g_set_error (error, READ_ERROR,
-                             READ_ERROR_GENERAL,
-                             "%s cannot be read: %s",
-                             filename, our_error->message);
-                g_error_free (our_error);
-                return FALSE;
-        }
-
-        lines = g_strsplit (content, "\n", 0);
-        g_free (content);
-
-        key_eq = g_strdup_printf ("%s=", key);
-        replaced = FALSE;
-
-        for (n = 0; lines[n] != NULL; n++) {
-                if (g_str_has_prefix (lines[n], key_eq)) {
-                        char     *old_value;
-                        gboolean  use_quotes;
-
-                        old_value = lines[n] + strlen (key_eq);
-                        g_strstrip (old_value);
-                        use_quotes = old_value[0] == '\"';
-
-                        g_free (lines[n]);
-
-                        if (use_quotes)
-                                lines[n] = g_strdup_printf ("%s\"%s\"",
-                                                            key_eq, value);
-                        else
-                                lines[n] = g_strdup_printf ("%s%s",
-                                                            key_eq, value);
-
-                        replaced = TRUE;
-                }
-        }
-
-        g_free (key_eq);
-
-        if (!replaced) {
-                g_strfreev (lines);
-                return TRUE;
-        }
-
-        content = g_strjoinv ("\n", lines);
-        g_strfreev (lines);
-
-        retval = g_file_set_contents (filename, content, -1, &our_error);
-        g_free (content);
-
-        if (!retval) {
-                g_set_error (error, READ_ERROR,
-                             READ_ERROR_GENERAL,
-                             "%s cannot be overwritten: %s",
-                             filename, our_error->message);
-                g_error_free (our_error);
-        }
+	GHashTable *values;
+	gchar *contents = NULL;
 
-        return retval;
+	if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR) ||
+	    !g_file_get_contents (filename, &contents, NULL, NULL))
+		return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	values = parse_env_file (contents);
+	g_free (contents);
+
+	return values;
 }
 
+/* Called once the name is acquired, so keep it to plain syscalls */
 void component_started() {
-	gchar *pidstring = NULL;
-	GError *err = NULL;
-	GFile *pidfile = NULL;
-
-	pidfile = g_file_new_for_path(PIDFILE);
-	pidstring = g_strdup_printf ("%lu", (gulong)getpid ());
-	if (!g_file_replace_contents (pidfile, pidstring, strlen(pidstring), NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, &err)) {
-		g_critical ("Failed to write " PIDFILE ": %s", err->message);
+	gchar pidstring[32];
+	gint fd, len;
+
+	len = g_snprintf (pidstring, sizeof (pidstring), "%lu\n", (gulong)getpid ());
+	fd = open (PIDFILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 || write (fd, pidstring, len) != len) {
+		g_critical ("Failed to write " PIDFILE ": %s", g_strerror (errno));
 		exit(1);
 	}
+	close (fd);
 }
 
-void
-check_polkit_data_free (struct check_polkit_data *data)
+/* One authority for the life of the process, shared by every handler
+ * thread */
+static PolkitAuthority *
+get_polkit_authority (GError **error)
 {
-	if (data == NULL)
-		return;
-
-	if (data->subject != NULL)
-		g_object_unref (data->subject);
-	if (data->authority != NULL)
-		g_object_unref (data->authority);
-    
-	g_free (data);
+	static PolkitAuthority *authority = NULL;
+	PolkitAuthority *ret;
+
+	G_LOCK (authority);
+	if (authority == NULL)
+		authority = polkit_authority_get_sync (NULL, error);
+	ret = authority;
+	G_UNLOCK (authority);
+
+	return ret;
 }
 
-gboolean
-check_polkit_finish (GAsyncResult *res,
-                     GError **error)
+static PolkitSubject *
+get_bus_name_subject (const gchar *sender)
 {
-	GSimpleAsyncResult *simple;
-
-	simple = G_SIMPLE_ASYNC_RESULT (res);
-	if (g_simple_async_result_propagate_error (simple, error))
-		return FALSE;
+	SubjectCacheEntry *entry = NULL;
+	PolkitSubject *ret;
+	guint i;
+
+	if (strlen (sender) >= sizeof (entry->name))
+		return polkit_system_bus_name_new (sender);
+
+	G_LOCK (subject_cache);
+	for (i = 0; i < SUBJECT_CACHE_SIZE; i++) {
+		if (subject_cache[i].subject != NULL && strcmp (subject_cache[i].name, sender) == 0) {
+			entry = &subject_cache[i];
+			break;
+		}
+		if (entry == NULL || subject_cache[i].used < entry->used)
+			entry = &subject_cache[i];
+	}
+	if (entry->subject == NULL || strcmp (entry->name, sender) != 0) {
+		if (entry->subject != NULL)
+			g_object_unref (entry->subject);
+		strcpy (entry->name, sender);
+		entry->subject = polkit_system_bus_name_new (sender);
+	}
+	entry->used = ++subject_cache_clock;
+	ret = g_object_ref (entry->subject);
+	G_UNLOCK (subject_cache);
 
-	return g_simple_async_result_get_op_res_gboolean (simple);
+	return ret;
 }
 
-void
-check_polkit_async (const gchar *unique_name,
-                    const gchar *action_id,
-                    const gboolean user_interaction,
-                    GAsyncReadyCallback callback,
-                    gpointer user_data)
+/* The caller is its bus name on the bus, and the process at the other
+ * end of the socket on a peer-to-peer connection, which isn't cached */
+static PolkitSubject *
+get_polkit_subject (GDBusMethodInvocation *invocation)
 {
-	struct check_polkit_data *data;
+	const gchar *sender;
+	pid_t pid;
+	uid_t uid;
+	guint64 start_time;
+
+	sender = g_dbus_method_invocation_get_sender (invocation);
+	if (sender != NULL)
+		return get_bus_name_subject (sender);
 
-	data = g_new0 (struct check_polkit_data, 1);
-	data->unique_name = unique_name;
-	data->action_id = action_id;
-	data->user_interaction = user_interaction;
-	data->callback = callback;
-	data->user_data = user_data;
+	/* With the start time, polkit refuses a process that merely got
+	 * the same PID after the peer exited */
+	if (!peer_get_process (g_dbus_method_invocation_get_connection (invocation), &pid, &uid, &start_time))
+		return NULL;
 
-	polkit_authority_get_async (NULL, check_polkit_authority_cb, data);
+	return polkit_unix_process_new_for_owner (pid, start_time, uid);
 }
 
-static void
-check_polkit_authorization_cb (GObject *source_object,
-				GAsyncResult *res,
-				gpointer _data)
+/* Blocks until the user answers any authentication dialog, so this is
+ * only meant to be called from method handler threads */
+gboolean
+check_polkit_sync (GDBusMethodInvocation *invocation,
+                   const gchar *action_id,
+                   const gboolean user_interaction,
+                   GError **error)
 {
-	struct check_polkit_data *data;
+	PolkitAuthority *authority;
+	PolkitSubject *subject;
 	PolkitAuthorizationResult *result;
-	GSimpleAsyncResult *simple;
-	GError *err = NULL;
+	gboolean ret = FALSE;
 
-	data = (struct check_polkit_data *) _data;
-	if ((result = polkit_authority_check_authorization_finish (data->authority, res, &err)) == NULL) {
-		g_simple_async_report_take_gerror_in_idle (NULL, data->callback, data->user_data, err);
-		goto out;
-	}
- 
-	if (!polkit_authorization_result_get_is_authorized (result)) {
-		g_simple_async_report_error_in_idle (NULL, data->callback, data->user_data, POLKIT_ERROR, POLKIT_ERROR_NOT_AUTHORIZED, "Authorizing for '%s': not authorized", data->action_id);
-		goto out;
-	}
-	simple = g_simple_async_result_new (NULL, data->callback, data->user_data, check_polkit_async);
-	g_simple_async_result_set_op_res_gboolean (simple, TRUE);
-	g_simple_async_result_complete_in_idle (simple);
-	g_object_unref (simple);
-
-	out:
-		check_polkit_data_free (data);
-		if (result != NULL)
-			g_object_unref (result);
-}
+	if ((authority = get_polkit_authority (error)) == NULL)
+		return FALSE;
 
-static void
-check_polkit_authority_cb (GObject *source_object,
-			GAsyncResult *res,
-			gpointer _data)
-{
-	struct check_polkit_data *data;
-	GError *err = NULL;
-
-	data = (struct check_polkit_data *) _data;
-	if ((data->authority = polkit_authority_get_finish (res, &err)) == NULL) {
-		g_simple_async_report_take_gerror_in_idle (NULL, data->callback, data->user_data, err);
-		check_polkit_data_free (data);
-		return;
-	}
-	if (data->unique_name == NULL || data->action_id == NULL || 
-		(data->subject = polkit_system_bus_name_new (data->unique_name)) == NULL) {
-		g_simple_async_report_error_in_idle (NULL, data->callback, data->user_data, POLKIT_ERROR, POLKIT_ERROR_FAILED, "Authorizing for '%s': failed sanity check", data->action_id);
-		check_polkit_data_free (data);
-		return;
+	if (action_id == NULL ||
+		(subject = get_polkit_subject (invocation)) == NULL) {
+		g_set_error (error, POLKIT_ERROR, POLKIT_ERROR_FAILED, "Authorizing for '%s': failed sanity check", action_id);
+		return FALSE;
 	}
-	polkit_authority_check_authorization (data->authority, data->subject, data->action_id, NULL, (PolkitCheckAuthorizationFlags) data->user_interaction, NULL, check_polkit_authorization_cb, data);
+
+	result = polkit_authority_check_authorization_sync (authority, subject, action_id, NULL, (PolkitCheckAuthorizationFlags) user_interaction, NULL, error);
+	g_object_unref (subject);
+	if (result == NULL)
+		return FALSE;
+
+	if (!polkit_authorization_result_get_is_authorized (result))
+		g_set_error (error, POLKIT_ERROR, POLKIT_ERROR_NOT_AUTHORIZED, "Authorizing for '%s': not authorized", action_id);
+	else
+		ret = TRUE;
+
+	g_object_unref (result);
+
+	return ret;
 }
@@ -0,0 +1,202 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* A container is served through a thread of its own, which leaves the
+ * filesystem context it shares with the rest of the daemon, chroots into
+ * the root of the container's leader and joins its UTS namespace. Code
+ * run there sees the container's /etc and hostname through the same
+ * paths and calls as the host's, and symlinks in the container resolve
+ * inside it. Calls are run one at a time, in order, and the caller waits
+ * for each. The namespaces and root are pinned when the container is
+ * created, so the leader may exit or its pid be reused meanwhile. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "container.h"
+
+struct _Container {
+	GThread *thread;
+	GAsyncQueue *calls;
+	gint uts_fd;
+	gint root_fd;
+	/* Set by the thread once it's in, or failed to get in */
+	gboolean started;
+	gint setup_errno;
+	const gchar *setup_step;
+	GMutex lock;
+	GCond cond;
+};
+
+typedef struct {
+	ContainerFunc func;
+	gpointer user_data;
+	gboolean done;
+} ContainerCall;
+
+static gboolean
+container_enter (Container *container)
+{
+	if (unshare (CLONE_FS) != 0) {
+		container->setup_step = "unshare";
+		return FALSE;
+	}
+	if (fchdir (container->root_fd) != 0 || chroot (".") != 0) {
+		container->setup_step = "chroot";
+		return FALSE;
+	}
+	if (setns (container->uts_fd, CLONE_NEWUTS) != 0) {
+		container->setup_step = "setns";
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gpointer
+container_thread (gpointer data)
+{
+	Container *container = (Container *) data;
+	ContainerCall *call;
+	gboolean entered;
+
+	entered = container_enter (container);
+
+	g_mutex_lock (&container->lock);
+	container->setup_errno = entered ? 0 : errno;
+	container->started = TRUE;
+	g_cond_broadcast (&container->cond);
+	g_mutex_unlock (&container->lock);
+
+	if (!entered)
+		return NULL;
+
+	/* A call without a function asks the thread to exit */
+	while ((call = g_async_queue_pop (container->calls))->func != NULL) {
+		call->func (call->user_data);
+
+		g_mutex_lock (&container->lock);
+		call->done = TRUE;
+		g_cond_broadcast (&container->cond);
+		g_mutex_unlock (&container->lock);
+	}
+
+	return NULL;
+}
+
+static gint
+open_proc (pid_t leader,
+           const gchar *entry,
+           gint flags,
+           GError **error)
+{
+	gchar path[64];
+	gint fd;
+
+	g_snprintf (path, sizeof (path), "/proc/%d/%s", (gint) leader, entry);
+	fd = open (path, flags | O_CLOEXEC);
+	if (fd < 0) {
+		int errsv = errno;
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+			     "Cannot open %s: %s", path, strerror (errsv));
+	}
+
+	return fd;
+}
+
+Container *
+container_new (pid_t leader,
+               GError **error)
+{
+	Container *container;
+
+	container = g_new0 (Container, 1);
+	container->uts_fd = -1;
+	container->root_fd = -1;
+	g_mutex_init (&container->lock);
+	g_cond_init (&container->cond);
+
+	if ((container->uts_fd = open_proc (leader, "ns/uts", O_RDONLY, error)) < 0 ||
+	    (container->root_fd = open_proc (leader, "root", O_PATH | O_DIRECTORY, error)) < 0) {
+		container_free (container);
+		return NULL;
+	}
+
+	container->calls = g_async_queue_new ();
+	container->thread = g_thread_new ("container", container_thread, container);
+
+	g_mutex_lock (&container->lock);
+	while (!container->started)
+		g_cond_wait (&container->cond, &container->lock);
+	g_mutex_unlock (&container->lock);
+
+	if (container->setup_errno != 0) {
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (container->setup_errno),
+			     "Cannot enter the container of process %d (%s): %s",
+			     (gint) leader, container->setup_step, strerror (container->setup_errno));
+		container_free (container);
+		return NULL;
+	}
+
+	/* The thread holds on to the namespace by now; the root stays
+	 * open for container_get_root_fd () */
+	close (container->uts_fd);
+	container->uts_fd = -1;
+
+	return container;
+}
+
+/* Runs func in the container and returns once it has. Never call this
+ * from func itself. */
+void
+container_run (Container *container,
+               ContainerFunc func,
+               gpointer user_data)
+{
+	ContainerCall call = { func, user_data, FALSE };
+
+	g_async_queue_push (container->calls, &call);
+
+	g_mutex_lock (&container->lock);
+	while (!call.done)
+		g_cond_wait (&container->cond, &container->lock);
+	g_mutex_unlock (&container->lock);
+}
+
+/* The container's root as the daemon sees it, for as long as the
+ * container is there, which /proc/<leader>/root is only while the leader
+ * lives */
+gint
+container_get_root_fd (Container *container)
+{
+	return container->root_fd;
+}
+
+void
+container_free (Container *container)
+{
+	ContainerCall stop = { NULL, NULL, FALSE };
+
+	if (container->thread != NULL) {
+		if (container->setup_errno == 0)
+			g_async_queue_push (container->calls, &stop);
+		g_thread_join (container->thread);
+	}
+	if (container->calls != NULL)
+		g_async_queue_unref (container->calls);
+	if (container->uts_fd >= 0)
+		close (container->uts_fd);
+	if (container->root_fd >= 0)
+		close (container->root_fd);
+	g_mutex_clear (&container->lock);
+	g_cond_clear (&container->cond);
+
+	g_free (container);
+}
@@ -0,0 +1,24 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#ifndef OPENSETTINGS_HOSTNAME_CONTAINER_H
+#define OPENSETTINGS_HOSTNAME_CONTAINER_H
+
+#include <sys/types.h>
+
+#include <glib.h>
+
+typedef struct _Container Container;
+
+typedef void (*ContainerFunc) (gpointer user_data);
+
+Container *container_new (pid_t leader,
+                          GError **error);
+void container_run (Container *container,
+                    ContainerFunc func,
+                    gpointer user_data);
+gint container_get_root_fd (Container *container);
+void container_free (Container *container);
+
+#endif /* OPENSETTINGS_HOSTNAME_CONTAINER_H */
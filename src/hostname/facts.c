@@ -0,0 +1,457 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* Facts about the machine that don't come from our own configuration:
+ * the running kernel, os-release and DMI. Nothing is read before somebody
+ * asks. Kernel and DMI values cannot change while we run, so they are
+ * read once and kept for the life of the process, for every Facts. The
+ * os-release of each Facts, read through its own read function so that a
+ * container's comes from the container, is kept until facts_invalidate (),
+ * which is hooked to the watches on it.
+ *
+ * Describe () replies are cached per Facts as well and rebuilt only when
+ * either the state snapshot (by serial) or the os-release variant (by
+ * identity) changed since the last one. A Facts goes with one state
+ * cell, whose serials it compares. */
+
+#include <string.h>
+#include <sys/utsname.h>
+
+#include <glib.h>
+
+#include "facts.h"
+
+#define DMI_ID "/sys/class/dmi/id/"
+
+typedef enum {
+	SOURCE_KERNEL,
+	SOURCE_OS_RELEASE,
+	SOURCE_DMI,
+} FactSource;
+
+/* Facts exported as properties, by GObject property name */
+static const struct {
+	const gchar *property;
+	const gchar *name;
+	FactSource source;
+} fact_properties[] = {
+	{ "kernel-name", "KernelName", SOURCE_KERNEL },
+	{ "kernel-release", "KernelRelease", SOURCE_KERNEL },
+	{ "kernel-version", "KernelVersion", SOURCE_KERNEL },
+	{ "operating-system-pretty-name", "OperatingSystemPrettyName", SOURCE_OS_RELEASE },
+	{ "operating-system-cpename", "OperatingSystemCPEName", SOURCE_OS_RELEASE },
+	{ "hardware-vendor", "HardwareVendor", SOURCE_DMI },
+	{ "hardware-model", "HardwareModel", SOURCE_DMI },
+};
+
+static const struct {
+	const gchar *key;
+	const gchar *name;
+} os_release_keys[] = {
+	{ "NAME", "OperatingSystemName" },
+	{ "PRETTY_NAME", "OperatingSystemPrettyName" },
+	{ "ID", "OperatingSystemId" },
+	{ "VERSION_ID", "OperatingSystemVersionId" },
+	{ "CPE_NAME", "OperatingSystemCPEName" },
+	{ "HOME_URL", "OperatingSystemHomeURL" },
+};
+
+static const struct {
+	const gchar *file;
+	const gchar *name;
+} dmi_keys[] = {
+	{ "sys_vendor", "HardwareVendor" },
+	{ "product_name", "HardwareModel" },
+	{ "bios_vendor", "FirmwareVendor" },
+	{ "bios_version", "FirmwareVersion" },
+};
+
+/* D-Bus names of the state fields, for Describe () */
+static const gchar *state_names[HOSTNAME_STATE_N_FIELDS] = {
+	"Hostname",
+	"StaticHostname",
+	"PrettyHostname",
+	"IconName",
+	"Chassis",
+	"Deployment",
+	"Location",
+};
+
+struct _Facts {
+	FactsReadFunc read;
+	gpointer user_data;
+
+	GVariant *os_release;
+	GMutex os_release_lock;
+
+	GVariant *description;
+	GVariant *description_os_release;
+	guint64 description_serial;
+	GMutex description_lock;
+};
+
+static void
+add_string (GVariantBuilder *builder,
+            const gchar *name,
+            const gchar *value)
+{
+	if (value != NULL && *value != 0)
+		g_variant_builder_add (builder, "{sv}", name, g_variant_new_string (value));
+}
+
+static GVariant *
+kernel_facts (void)
+{
+	static GVariant *kernel = NULL;
+
+	if (g_once_init_enter (&kernel)) {
+		GVariantBuilder builder;
+		struct utsname u;
+
+		g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+		if (uname (&u) == 0) {
+			add_string (&builder, "KernelName", u.sysname);
+			add_string (&builder, "KernelRelease", u.release);
+			add_string (&builder, "KernelVersion", u.version);
+			add_string (&builder, "Architecture", u.machine);
+		}
+		g_once_init_leave (&kernel, g_variant_ref_sink (g_variant_builder_end (&builder)));
+	}
+
+	return kernel;
+}
+
+static GVariant *
+dmi_facts (void)
+{
+	static GVariant *dmi = NULL;
+
+	if (g_once_init_enter (&dmi)) {
+		GVariantBuilder builder;
+		guint i;
+
+		g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+		for (i = 0; i < G_N_ELEMENTS (dmi_keys); i++) {
+			gchar *path, *value = NULL;
+
+			path = g_strconcat (DMI_ID, dmi_keys[i].file, NULL);
+			if (g_file_get_contents (path, &value, NULL, NULL))
+				add_string (&builder, dmi_keys[i].name, g_strstrip (value));
+			g_free (value);
+			g_free (path);
+		}
+		g_once_init_leave (&dmi, g_variant_ref_sink (g_variant_builder_end (&builder)));
+	}
+
+	return dmi;
+}
+
+static gboolean
+read_file (const gchar *path,
+           gchar **contents,
+           gpointer user_data)
+{
+	return g_file_get_contents (path, contents, NULL, NULL);
+}
+
+/* A NULL read function reads from the daemon's own root */
+Facts *
+facts_new (FactsReadFunc read,
+           gpointer user_data)
+{
+	Facts *facts;
+
+	facts = g_new0 (Facts, 1);
+	facts->read = read != NULL ? read : read_file;
+	facts->user_data = user_data;
+	g_mutex_init (&facts->os_release_lock);
+	g_mutex_init (&facts->description_lock);
+
+	return facts;
+}
+
+static GVariant *
+os_release_build (Facts *facts)
+{
+	GVariantBuilder builder;
+	gchar *contents = NULL;
+	gchar **lines;
+	guint i, j;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+	if (!facts->read ("/etc/os-release", &contents, facts->user_data) &&
+	    !facts->read ("/usr/lib/os-release", &contents, facts->user_data))
+		return g_variant_ref_sink (g_variant_builder_end (&builder));
+
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		gchar *eq, *value;
+
+		eq = strchr (lines[i], '=');
+		if (eq == NULL)
+			continue;
+		*eq = 0;
+
+		for (j = 0; j < G_N_ELEMENTS (os_release_keys); j++) {
+			if (strcmp (lines[i], os_release_keys[j].key) != 0)
+				continue;
+
+			/* Values follow shell quoting rules */
+			value = g_shell_unquote (g_strstrip (eq + 1), NULL);
+			add_string (&builder, os_release_keys[j].name, value);
+			g_free (value);
+			break;
+		}
+	}
+
+	g_strfreev (lines);
+	g_free (contents);
+
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static GVariant *
+os_release_facts (Facts *facts)
+{
+	GVariant *ret;
+
+	g_mutex_lock (&facts->os_release_lock);
+	if (facts->os_release == NULL)
+		facts->os_release = os_release_build (facts);
+	ret = g_variant_ref (facts->os_release);
+	g_mutex_unlock (&facts->os_release_lock);
+
+	return ret;
+}
+
+void
+facts_invalidate (Facts *facts)
+{
+	g_mutex_lock (&facts->os_release_lock);
+	g_clear_pointer (&facts->os_release, g_variant_unref);
+	g_mutex_unlock (&facts->os_release_lock);
+}
+
+static const gchar *chassis = NULL;
+
+/* The chassis type DMI reports, in machine-info CHASSIS terms, or "".
+ * Without read, NULL until someone else has read it. */
+static const gchar *
+dmi_chassis (gboolean read)
+{
+	if (!read)
+		return g_atomic_pointer_get (&chassis);
+
+	if (g_once_init_enter (&chassis)) {
+		const gchar *ret = "";
+#if defined(__i386__) || defined(__x86_64__)
+		gchar *filebuf = NULL;
+
+		if (g_file_get_contents (DMI_ID "chassis_type", &filebuf, NULL, NULL)) {
+			switch (g_ascii_strtoull (filebuf, NULL, 10)) {
+				case 0x3: /* Desktop */
+				case 0x4: /* Low Profile Desktop */
+				case 0x6: /* Mini Tower */
+				case 0x7: /* Tower */
+					ret = "desktop";
+					break;
+
+				case 0x8: /* Portable */
+				case 0x9: /* Laptop */
+				case 0xA: /* Notebook */
+				case 0xE: /* Sub Notebook */
+					ret = "laptop";
+					break;
+
+				case 0xB: /* Hand Held */
+					ret = "handset";
+					break;
+
+				case 0x11: /* Main Server Chassis */
+				case 0x1C: /* Blade */
+				case 0x1D: /* Blade Enclosure */
+					ret = "server";
+					break;
+
+				case 0x1E: /* Tablet */
+					ret = "tablet";
+					break;
+
+				case 0x1F: /* Convertible */
+				case 0x20: /* Detachable */
+					ret = "convertible";
+					break;
+			}
+		}
+		g_free (filebuf);
+#endif
+		g_once_init_leave (&chassis, ret);
+	}
+
+	return chassis;
+}
+
+static gchar *
+state_value (HostnameState *state,
+             HostnameStateField field,
+             gboolean read)
+{
+	const gchar *value = state->fields[field];
+	const gchar *chassis;
+
+	if (value != NULL && *value != 0)
+		return g_strdup (value);
+
+	switch (field) {
+		case HOSTNAME_STATE_CHASSIS:
+			chassis = dmi_chassis (read);
+			return g_strdup (chassis != NULL ? chassis : value);
+
+		case HOSTNAME_STATE_ICON_NAME:
+			chassis = state->fields[HOSTNAME_STATE_CHASSIS];
+			if (chassis == NULL || *chassis == 0)
+				chassis = dmi_chassis (read);
+			if (chassis == NULL)
+				return g_strdup (value);
+			if (*chassis == 0)
+				return g_strdup ("computer");
+			if (strcmp (chassis, "tablet") == 0)
+				return g_strdup ("tablet");
+			return g_strconcat ("computer-", chassis, NULL);
+
+		default:
+			return g_strdup (value);
+	}
+}
+
+/* The value a state field is read with: an unset chassis falls back to
+ * what DMI says and an unset icon name to one matching the chassis. Only
+ * then is DMI read. */
+gchar *
+facts_state_value (HostnameState *state,
+                   HostnameStateField field)
+{
+	return state_value (state, field, TRUE);
+}
+
+/* The same without reading anything, for the change notifications: until
+ * a read has looked DMI up, a field is left as it is configured */
+gchar *
+facts_state_value_cached (HostnameState *state,
+                          HostnameStateField field)
+{
+	return state_value (state, field, FALSE);
+}
+
+/* Returns FALSE if property is not a fact. A fact the system doesn't
+ * provide comes back as NULL. */
+gboolean
+facts_lookup (Facts *facts,
+              const gchar *property,
+              gchar **value)
+{
+	GVariant *source;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (fact_properties); i++) {
+		if (strcmp (fact_properties[i].property, property) != 0)
+			continue;
+
+		switch (fact_properties[i].source) {
+			case SOURCE_KERNEL:
+				source = g_variant_ref (kernel_facts ());
+				break;
+			case SOURCE_DMI:
+				source = g_variant_ref (dmi_facts ());
+				break;
+			default:
+				source = os_release_facts (facts);
+				break;
+		}
+
+		*value = NULL;
+		g_variant_lookup (source, fact_properties[i].name, "s", value);
+		g_variant_unref (source);
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+add_all (GVariantBuilder *builder,
+         GVariant *source)
+{
+	GVariantIter iter;
+	GVariant *entry;
+
+	g_variant_iter_init (&iter, source);
+	while ((entry = g_variant_iter_next_value (&iter)) != NULL) {
+		g_variant_builder_add_value (builder, entry);
+		g_variant_unref (entry);
+	}
+}
+
+GVariant *
+facts_describe (Facts *facts,
+                HostnameState *state)
+{
+	GVariantBuilder builder;
+	GVariant *current, *ret;
+	gint i;
+
+	current = os_release_facts (facts);
+
+	g_mutex_lock (&facts->description_lock);
+	if (facts->description != NULL && facts->description_serial == state->serial &&
+	    facts->description_os_release == current) {
+		ret = g_variant_ref (facts->description);
+		g_mutex_unlock (&facts->description_lock);
+		g_variant_unref (current);
+		return ret;
+	}
+	g_mutex_unlock (&facts->description_lock);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	for (i = 0; i < HOSTNAME_STATE_N_FIELDS; i++) {
+		gchar *value = facts_state_value (state, i);
+
+		g_variant_builder_add (&builder, "{sv}", state_names[i],
+		                       g_variant_new_string (value != NULL ? value : ""));
+		g_free (value);
+	}
+	add_all (&builder, kernel_facts ());
+	add_all (&builder, current);
+	add_all (&builder, dmi_facts ());
+	ret = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+	/* A slower caller may come back with an older snapshot */
+	g_mutex_lock (&facts->description_lock);
+	if (facts->description == NULL || state->serial >= facts->description_serial) {
+		g_clear_pointer (&facts->description, g_variant_unref);
+		g_clear_pointer (&facts->description_os_release, g_variant_unref);
+		facts->description = g_variant_ref (ret);
+		facts->description_os_release = g_variant_ref (current);
+		facts->description_serial = state->serial;
+	}
+	g_mutex_unlock (&facts->description_lock);
+
+	g_variant_unref (current);
+
+	return ret;
+}
+
+void
+facts_free (Facts *facts)
+{
+	g_clear_pointer (&facts->description, g_variant_unref);
+	g_clear_pointer (&facts->description_os_release, g_variant_unref);
+	g_clear_pointer (&facts->os_release, g_variant_unref);
+	g_mutex_clear (&facts->description_lock);
+	g_mutex_clear (&facts->os_release_lock);
+
+	g_free (facts);
+}
@@ -0,0 +1,33 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#ifndef OPENSETTINGS_HOSTNAME_FACTS_H
+#define OPENSETTINGS_HOSTNAME_FACTS_H
+
+#include <glib.h>
+
+#include "state.h"
+
+typedef struct _Facts Facts;
+
+/* Same contract as g_file_get_contents () without the error */
+typedef gboolean (*FactsReadFunc) (const gchar *path,
+                                   gchar **contents,
+                                   gpointer user_data);
+
+Facts *facts_new (FactsReadFunc read,
+                  gpointer user_data);
+void facts_invalidate (Facts *facts);
+gchar *facts_state_value (HostnameState *state,
+                          HostnameStateField field);
+gchar *facts_state_value_cached (HostnameState *state,
+                                 HostnameStateField field);
+gboolean facts_lookup (Facts *facts,
+                       const gchar *property,
+                       gchar **value);
+GVariant *facts_describe (Facts *facts,
+                          HostnameState *state);
+void facts_free (Facts *facts);
+
+#endif /* OPENSETTINGS_HOSTNAME_FACTS_H */
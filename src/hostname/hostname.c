@@ -0,0 +1,1195 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <dbus/dbus-protocol.h>
+#include <polkit/polkit.h>
+
+#ifdef ENABLE_ALLOC_COUNT
+#include "alloc-count.h"
+#endif
+#include "common.h"
+#include "config-writer.h"
+#include "container.h"
+#include "facts.h"
+#include "fair-queue.h"
+#include "hostname.h"
+#include "hostname-glue.h"
+#include "peer.h"
+#include "props.h"
+#include "startup.h"
+#include "state.h"
+#include "watch.h"
+
+#define ETC_RC_CONF "/etc/rc.conf"
+#define MACHINE_INFO "/etc/machine-info"
+#define HOSTNAME1_PATH "/org/freedesktop/hostname1"
+#define CONTAINER_PATH HOSTNAME1_PATH "/container/"
+
+static guint bus_id = 0;
+static gboolean read_only = FALSE;
+static gint coalesce_window = 0;
+static gboolean deferred_init = FALSE;
+static gdouble rate_limit = 0.0;
+static gint rate_burst = 10;
+static gdouble total_rate_limit = 0.0;
+static gchar *p2p_socket = NULL;
+static gboolean enable_containers = FALSE;
+
+static FairQueue *limiter = NULL;
+
+static GDBusConnection *bus_connection = NULL;
+
+/* What one object serves: the host the daemon runs on, or a container
+ * registered with RegisterContainer (). A container's hostname and files
+ * are only reached through its thread, see container.c; root is where
+ * the main thread finds the same files, for the watches. */
+struct target {
+	gint ref_count;
+	gchar *name;
+	gchar *object_path;
+	gchar *root;
+	Container *container;
+	HostnameStateCell state;
+	Facts *facts;
+	OpenSettingsHostname1 *skeleton;
+
+	/* These serialize changes to what backs each key, never reads */
+	GMutex hostname_lock;
+	GMutex static_hostname_lock;
+	GMutex machine_info_lock;
+};
+
+static struct target *host = NULL;
+
+static GHashTable *containers = NULL; /* name -> struct target */
+G_LOCK_DEFINE_STATIC (containers);
+
+/* By hand rather than with a regex, which would be compiled anew, and
+ * allocated, on every call */
+static gboolean
+hostname_is_valid (const gchar *name) {
+	const gchar *p;
+
+	if (name == NULL || name[0] == '\0')
+		return 0;
+
+	for (p = name; *p != '\0'; p++) {
+		if (p - name >= HOST_NAME_MAX)
+			return 0;
+		if (!g_ascii_isalnum (*p) && *p != '_' && *p != '.' && *p != '-')
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Container names end up as an object path element */
+static gboolean
+container_name_is_valid (const gchar *name)
+{
+	const gchar *p;
+
+	if (name == NULL || name[0] == '\0' || strlen (name) > 64)
+		return FALSE;
+
+	for (p = name; *p != '\0'; p++)
+		if (!g_ascii_isalnum (*p) && *p != '_')
+			return FALSE;
+
+	return TRUE;
+}
+
+/* One call into what backs a target, made by target_run () where the
+ * target's hostname and files are the ones in view */
+struct target_io {
+	const gchar *path;
+	const gchar *key;
+	const gchar *value;
+	gchar *contents;
+	GHashTable *values;
+	GError *error;
+	gint errsv;
+	gboolean ret;
+};
+
+static void
+target_run (struct target *target,
+            ContainerFunc func,
+            struct target_io *io)
+{
+	if (target->container != NULL)
+		container_run (target->container, func, io);
+	else
+		func (io);
+}
+
+static void
+io_sethostname (gpointer user_data)
+{
+	struct target_io *io = (struct target_io *) user_data;
+
+	io->ret = sethostname (io->value, strlen (io->value)) == 0;
+	io->errsv = errno;
+}
+
+static void
+io_gethostname (gpointer user_data)
+{
+	struct target_io *io = (struct target_io *) user_data;
+
+	io->contents = g_malloc0 (HOST_NAME_MAX + 1);
+	if (gethostname (io->contents, HOST_NAME_MAX)) {
+		perror (NULL);
+		g_strlcpy (io->contents, "localhost", HOST_NAME_MAX + 1);
+	}
+}
+
+static void
+io_write_key (gpointer user_data)
+{
+	struct target_io *io = (struct target_io *) user_data;
+
+	io->ret = config_write_key (io->path, io->key, io->value, TRUE, &io->error);
+}
+
+static void
+io_read_key (gpointer user_data)
+{
+	struct target_io *io = (struct target_io *) user_data;
+
+	io->contents = read_key_file (io->path, io->key);
+}
+
+static void
+io_read_env (gpointer user_data)
+{
+	struct target_io *io = (struct target_io *) user_data;
+
+	io->values = read_env_file (io->path);
+}
+
+static void
+io_read_file (gpointer user_data)
+{
+	struct target_io *io = (struct target_io *) user_data;
+
+	io->ret = g_file_get_contents (io->path, &io->contents, NULL, NULL);
+}
+
+/* So that a container's os-release is the container's */
+static gboolean
+target_read_file (const gchar *path,
+                  gchar **contents,
+                  gpointer user_data)
+{
+	struct target_io io = { 0 };
+
+	io.path = path;
+	target_run ((struct target *) user_data, io_read_file, &io);
+	*contents = io.contents;
+
+	return io.ret;
+}
+
+/* Without a name, the host */
+static struct target *
+target_new (const gchar *name,
+            pid_t leader,
+            GError **error)
+{
+	struct target *target;
+	Container *container = NULL;
+
+	if (name != NULL && (container = container_new (leader, error)) == NULL)
+		return NULL;
+
+	target = g_new0 (struct target, 1);
+	target->ref_count = 1;
+	target->container = container;
+	if (name == NULL) {
+		target->object_path = g_strdup (HOSTNAME1_PATH);
+		target->root = g_strdup ("");
+	} else {
+		target->name = g_strdup (name);
+		target->object_path = g_strconcat (CONTAINER_PATH, name, NULL);
+		/* Through the pinned root, so that the watches stay on this
+		 * container if the leader exits and its pid is reused */
+		target->root = g_strdup_printf ("/proc/self/fd/%d", container_get_root_fd (container));
+	}
+	hostname_state_cell_init (&target->state);
+	target->facts = facts_new (container != NULL ? target_read_file : NULL, target);
+	g_mutex_init (&target->hostname_lock);
+	g_mutex_init (&target->static_hostname_lock);
+	g_mutex_init (&target->machine_info_lock);
+
+	return target;
+}
+
+static struct target *
+target_ref (struct target *target)
+{
+	g_atomic_int_inc (&target->ref_count);
+
+	return target;
+}
+
+static void
+target_free (gpointer data,
+             GObject *where_the_skeleton_was)
+{
+	struct target *target = (struct target *) data;
+
+	if (target->container != NULL)
+		container_free (target->container);
+	/* Nothing is left to read the snapshot */
+	facts_free (target->facts);
+	hostname_state_cell_clear (&target->state);
+	g_mutex_clear (&target->hostname_lock);
+	g_mutex_clear (&target->static_hostname_lock);
+	g_mutex_clear (&target->machine_info_lock);
+	g_free (target->name);
+	g_free (target->object_path);
+	g_free (target->root);
+	g_free (target);
+}
+
+/* The skeleton reads from the state and facts and may outlive the last
+ * reference, in the middle of a property read: it frees the rest */
+static void
+target_unref (gpointer data)
+{
+	struct target *target = (struct target *) data;
+
+	if (!g_atomic_int_dec_and_test (&target->ref_count))
+		return;
+
+	if (target->skeleton != NULL)
+		g_object_unref (target->skeleton);
+	else
+		target_free (target, NULL);
+}
+
+static void
+target_closure_notify (gpointer data,
+                       GClosure *closure)
+{
+	target_unref (data);
+}
+
+/* The target an object path belongs to, while it's registered */
+static struct target *
+target_lookup (const gchar *object_path)
+{
+	struct target *target;
+
+	if (strcmp (object_path, host->object_path) == 0)
+		return target_ref (host);
+
+	if (containers == NULL || !g_str_has_prefix (object_path, CONTAINER_PATH))
+		return NULL;
+
+	G_LOCK (containers);
+	target = g_hash_table_lookup (containers, object_path + strlen (CONTAINER_PATH));
+	if (target != NULL)
+		target_ref (target);
+	G_UNLOCK (containers);
+
+	return target;
+}
+
+/* Publish a new snapshot and queue the property change. Callers hold the
+ * lock of the key, so snapshots and signals of one key stay in order. */
+static void
+update_state (struct target *target,
+              HostnameStateField field,
+              const gchar *value)
+{
+	OpenSettingsHostname1 *skeleton;
+	HostnameState *current;
+	gchar *exported;
+
+	if (!hostname_state_update (&target->state, field, value))
+		return;
+
+	/* Not exported yet, target_export () catches up */
+	skeleton = g_atomic_pointer_get (&target->skeleton);
+	if (skeleton == NULL)
+		return;
+
+	current = hostname_state_get (&target->state);
+	exported = facts_state_value_cached (current, field);
+	props_set (skeleton, hostname_state_field_property (field), exported);
+	g_free (exported);
+
+	/* The icon name may follow the chassis */
+	if (field == HOSTNAME_STATE_CHASSIS) {
+		exported = facts_state_value_cached (current, HOSTNAME_STATE_ICON_NAME);
+		props_set (skeleton, hostname_state_field_property (HOSTNAME_STATE_ICON_NAME), exported);
+		g_free (exported);
+	}
+	hostname_state_unref (current);
+}
+
+/* The handlers below run in GDBus worker threads, one per invocation.
+ * Each lock covers changes to one key of a target and whatever backs it
+ * (the kernel hostname, rc.conf, machine-info); keys stored in the same
+ * file share a lock. Current values are read from the state snapshot,
+ * which needs no lock, so no handler ever holds more than one. */
+
+#ifdef ENABLE_ALLOC_COUNT
+static guint64 set_requests = 0;
+static guint64 set_allocations = 0;
+G_LOCK_DEFINE_STATIC (allocations);
+#endif
+
+/* Counts what each Set* handler allocates, when built with
+ * --enable-alloc-count. Handlers end with return request_end (). */
+static guint64
+request_begin (void)
+{
+#ifdef ENABLE_ALLOC_COUNT
+	return alloc_count_get ();
+#else
+	return 0;
+#endif
+}
+
+static gboolean
+request_end (guint64 begin)
+{
+#ifdef ENABLE_ALLOC_COUNT
+	guint64 allocs = alloc_count_get () - begin;
+
+	G_LOCK (allocations);
+	set_requests++;
+	set_allocations += allocs;
+	G_UNLOCK (allocations);
+#endif
+	return TRUE;
+}
+
+static gboolean
+handler_check (GDBusMethodInvocation *invocation,
+               const gchar *action_id,
+               const gboolean user_interaction)
+{
+	GError *err = NULL;
+
+	if (read_only) {
+		g_dbus_method_invocation_return_dbus_error (invocation,
+							DBUS_ERROR_NOT_SUPPORTED,
+							"opensetiings-hostname is in read-only mode");
+		return FALSE;
+	}
+
+	if (!check_polkit_sync (invocation, action_id, user_interaction, &err)) {
+		g_dbus_method_invocation_take_error (invocation, err);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* The Set* handlers use the name they were passed where it lies, in the
+ * invocation's parameters, or else a literal or a field of a snapshot
+ * they hold until done; what they allocate is what polkit, the config
+ * writer and the new snapshot need. */
+
+static gboolean
+on_handle_set_hostname (OpenSettingsHostname1 *hostname1,
+                        GDBusMethodInvocation *invocation,
+                        const gchar *name,
+                        const gboolean user_interaction,
+                        gpointer user_data)
+{
+	guint64 allocs = request_begin ();
+	struct target *target = (struct target *) user_data;
+	struct target_io io = { 0 };
+	HostnameState *current = NULL;
+	const gchar *new_name;
+
+	if (!handler_check (invocation, "org.freedesktop.hostname1.set-hostname", user_interaction))
+		return request_end (allocs);
+
+	if (hostname_is_valid (name))
+		new_name = name;
+	else {
+		current = hostname_state_get (&target->state);
+		if (hostname_is_valid (current->fields[HOSTNAME_STATE_STATIC_HOSTNAME]))
+			new_name = current->fields[HOSTNAME_STATE_STATIC_HOSTNAME];
+		else
+			new_name = "localhost";
+	}
+
+	g_mutex_lock (&target->hostname_lock);
+	io.value = new_name;
+	target_run (target, io_sethostname, &io);
+	if (!io.ret) {
+		g_mutex_unlock (&target->hostname_lock);
+		if (current != NULL)
+			hostname_state_unref (current);
+		g_dbus_method_invocation_return_dbus_error (invocation,
+							DBUS_ERROR_FAILED,
+							strerror (io.errsv));
+		return request_end (allocs);
+	}
+	update_state (target, HOSTNAME_STATE_HOSTNAME, new_name);
+	g_mutex_unlock (&target->hostname_lock);
+	if (current != NULL)
+		hostname_state_unref (current);
+
+	open_settings_hostname1_complete_set_hostname (hostname1, invocation);
+
+	return request_end (allocs);
+}
+
+static gboolean
+on_handle_set_static_hostname (OpenSettingsHostname1 *hostname1,
+                               GDBusMethodInvocation *invocation,
+                               const gchar *name,
+                               const gboolean user_interaction,
+                               gpointer user_data)
+{
+	guint64 allocs = request_begin ();
+	struct target *target = (struct target *) user_data;
+	struct target_io io = { 0 };
+	const gchar *new_name;
+
+	if (!handler_check (invocation, "org.freedesktop.hostname1.set-static-hostname", user_interaction))
+		return request_end (allocs);
+
+	new_name = hostname_is_valid (name) ? name : "localhost";
+
+	g_mutex_lock (&target->static_hostname_lock);
+	io.path = ETC_RC_CONF;
+	io.key = "hostname";
+	io.value = new_name;
+	target_run (target, io_write_key, &io);
+	if (!io.ret) {
+		g_mutex_unlock (&target->static_hostname_lock);
+		g_dbus_method_invocation_take_error (invocation, io.error);
+		return request_end (allocs);
+	}
+	update_state (target, HOSTNAME_STATE_STATIC_HOSTNAME, new_name);
+	g_mutex_unlock (&target->static_hostname_lock);
+
+	open_settings_hostname1_complete_set_static_hostname (hostname1, invocation);
+
+	return request_end (allocs);
+}
+
+/* machine-info is one KEY=VALUE per line: a newline in a value would
+ * start a line of the caller's choosing */
+static gboolean
+machine_info_value_is_valid (const gchar *value)
+{
+	for (; *value != '\0'; value++)
+		if (g_ascii_iscntrl (*value))
+			return FALSE;
+
+	return TRUE;
+}
+
+static gboolean
+on_handle_set_pretty_hostname (OpenSettingsHostname1 *hostname1,
+                               GDBusMethodInvocation *invocation,
+                               const gchar *name,
+                               const gboolean user_interaction,
+                               gpointer user_data)
+{
+	guint64 allocs = request_begin ();
+	struct target *target = (struct target *) user_data;
+	struct target_io io = { 0 };
+	const gchar *new_name;
+
+	if (!handler_check (invocation, "org.freedesktop.hostname1.set-machine-info", user_interaction))
+		return request_end (allocs);
+
+	/* Don't allow a null pretty hostname */
+	new_name = name != NULL ? name : "";
+	if (!machine_info_value_is_valid (new_name)) {
+		g_dbus_method_invocation_return_error_literal (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+							       "The pretty hostname has control characters");
+		return request_end (allocs);
+	}
+
+	g_mutex_lock (&target->machine_info_lock);
+	io.path = MACHINE_INFO;
+	io.key = "PRETTY_HOSTNAME";
+	io.value = new_name;
+	target_run (target, io_write_key, &io);
+	if (!io.ret) {
+		g_mutex_unlock (&target->machine_info_lock);
+		g_dbus_method_invocation_take_error (invocation, io.error);
+		return request_end (allocs);
+	}
+	update_state (target, HOSTNAME_STATE_PRETTY_HOSTNAME, new_name);
+	g_mutex_unlock (&target->machine_info_lock);
+
+	open_settings_hostname1_complete_set_pretty_hostname (hostname1, invocation);
+
+	return request_end (allocs); /* Always return TRUE to indicate signal has been handled */
+}
+
+static gboolean
+on_handle_set_icon_name (OpenSettingsHostname1 *hostname1,
+                         GDBusMethodInvocation *invocation,
+                         const gchar *name,
+                         const gboolean user_interaction,
+                         gpointer user_data)
+{
+	guint64 allocs = request_begin ();
+	struct target *target = (struct target *) user_data;
+	struct target_io io = { 0 };
+	const gchar *new_name;
+
+	if (!handler_check (invocation, "org.freedesktop.hostname1.set-machine-info", user_interaction))
+		return request_end (allocs);
+
+	/* Don't allow a null icon name */
+	new_name = name != NULL ? name : "";
+	if (!machine_info_value_is_valid (new_name)) {
+		g_dbus_method_invocation_return_error_literal (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+							       "The icon name has control characters");
+		return request_end (allocs);
+	}
+
+	g_mutex_lock (&target->machine_info_lock);
+	io.path = MACHINE_INFO;
+	io.key = "ICON_NAME";
+	io.value = new_name;
+	target_run (target, io_write_key, &io);
+	if (!io.ret) {
+		g_mutex_unlock (&target->machine_info_lock);
+		g_dbus_method_invocation_take_error (invocation, io.error);
+		return request_end (allocs);
+	}
+	update_state (target, HOSTNAME_STATE_ICON_NAME, new_name);
+	g_mutex_unlock (&target->machine_info_lock);
+
+	open_settings_hostname1_complete_set_icon_name (hostname1, invocation);
+
+	return request_end (allocs); /* Always return TRUE to indicate signal has been handled */
+}
+
+static gboolean
+on_handle_get_statistics (OpenSettingsHostname1 *hostname1,
+                          GDBusMethodInvocation *invocation,
+                          gpointer user_data)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	props_add_statistics (&builder);
+	startup_add_statistics (&builder);
+	peer_server_add_statistics (&builder);
+	if (limiter != NULL) {
+		FairQueueStatistics limits;
+
+		fair_queue_get_statistics (limiter, &limits);
+		g_variant_builder_add (&builder, "{sv}", "RequestsAdmitted", g_variant_new_uint64 (limits.admitted));
+		g_variant_builder_add (&builder, "{sv}", "RequestsThrottled", g_variant_new_uint64 (limits.throttled));
+		g_variant_builder_add (&builder, "{sv}", "RequestsRejected", g_variant_new_uint64 (limits.rejected));
+		g_variant_builder_add (&builder, "{sv}", "RequestsQueued", g_variant_new_uint64 (limits.queued));
+		g_variant_builder_add (&builder, "{sv}", "Clients", g_variant_new_uint64 (limits.clients));
+	}
+	if (containers != NULL) {
+		G_LOCK (containers);
+		g_variant_builder_add (&builder, "{sv}", "Containers", g_variant_new_uint64 (g_hash_table_size (containers)));
+		G_UNLOCK (containers);
+	}
+#ifdef ENABLE_ALLOC_COUNT
+	G_LOCK (allocations);
+	g_variant_builder_add (&builder, "{sv}", "SetRequests", g_variant_new_uint64 (set_requests));
+	g_variant_builder_add (&builder, "{sv}", "SetAllocations", g_variant_new_uint64 (set_allocations));
+	G_UNLOCK (allocations);
+#endif
+	open_settings_hostname1_complete_get_statistics (hostname1, invocation, g_variant_builder_end (&builder));
+
+	return TRUE;
+}
+
+static gboolean
+on_handle_describe (OpenSettingsHostname1 *hostname1,
+                    GDBusMethodInvocation *invocation,
+                    gpointer user_data)
+{
+	struct target *target = (struct target *) user_data;
+	HostnameState *current;
+	GVariant *description;
+
+	current = hostname_state_get (&target->state);
+	description = facts_describe (target->facts, current);
+	hostname_state_unref (current);
+
+	open_settings_hostname1_complete_describe (hostname1, invocation, description);
+	g_variant_unref (description);
+
+	return TRUE;
+}
+
+static void load_state (struct target *target);
+static void add_watches (struct target *target);
+static gboolean target_export (struct target *target,
+                               GError **error);
+static void target_unexport (struct target *target);
+
+/* File monitors attach to the main context, so watches are always added
+ * and removed from there */
+static gboolean
+add_watches_cb (gpointer user_data)
+{
+	add_watches ((struct target *) user_data);
+	return FALSE;
+}
+
+static gboolean
+remove_target_cb (gpointer user_data)
+{
+	struct target *target = (struct target *) user_data;
+
+	watch_remove (target);
+	target_unexport (target);
+	target_unref (target);
+
+	return FALSE;
+}
+
+/* Containers are registered on the host's object, with --containers */
+static gboolean
+containers_check (GDBusMethodInvocation *invocation,
+                  struct target *target,
+                  const gboolean user_interaction)
+{
+	if (containers == NULL || target != host) {
+		g_dbus_method_invocation_return_dbus_error (invocation,
+							DBUS_ERROR_NOT_SUPPORTED,
+							"Containers are not served here");
+		return FALSE;
+	}
+
+	return handler_check (invocation, "org.freedesktop.hostname1.manage-containers", user_interaction);
+}
+
+static gboolean
+on_handle_register_container (OpenSettingsHostname1 *hostname1,
+                              GDBusMethodInvocation *invocation,
+                              const gchar *name,
+                              guint leader,
+                              const gboolean user_interaction,
+                              gpointer user_data)
+{
+	struct target *target;
+	GError *err = NULL;
+
+	if (!containers_check (invocation, user_data, user_interaction))
+		return TRUE;
+
+	if (!container_name_is_valid (name)) {
+		g_dbus_method_invocation_return_dbus_error (invocation,
+							DBUS_ERROR_INVALID_ARGS,
+							"Container names are made of letters, digits and underscores");
+		return TRUE;
+	}
+
+	target = target_new (name, leader, &err);
+	if (target == NULL) {
+		g_dbus_method_invocation_take_error (invocation, err);
+		return TRUE;
+	}
+
+	/* Exporting fails if the name is taken, by a container registered
+	 * or one still being removed */
+	load_state (target);
+	if (!target_export (target, &err)) {
+		g_dbus_method_invocation_take_error (invocation, err);
+		g_idle_add (remove_target_cb, target);
+		return TRUE;
+	}
+
+	/* Queued ahead of any removal, which can only follow the insert */
+	g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, add_watches_cb, target_ref (target), target_unref);
+
+	G_LOCK (containers);
+	g_hash_table_insert (containers, target->name, target);
+	G_UNLOCK (containers);
+
+	open_settings_hostname1_complete_register_container (hostname1, invocation, target->object_path);
+
+	return TRUE;
+}
+
+static gboolean
+on_handle_unregister_container (OpenSettingsHostname1 *hostname1,
+                                GDBusMethodInvocation *invocation,
+                                const gchar *name,
+                                const gboolean user_interaction,
+                                gpointer user_data)
+{
+	struct target *target;
+
+	if (!containers_check (invocation, user_data, user_interaction))
+		return TRUE;
+
+	G_LOCK (containers);
+	target = g_hash_table_lookup (containers, name);
+	if (target != NULL)
+		g_hash_table_remove (containers, name);
+	G_UNLOCK (containers);
+
+	if (target == NULL) {
+		g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT,
+						       "No container named '%s'", name);
+		return TRUE;
+	}
+
+	/* Calls already in flight keep the target alive until they're done */
+	g_idle_add (remove_target_cb, target);
+
+	open_settings_hostname1_complete_unregister_container (hostname1, invocation);
+
+	return TRUE;
+}
+
+/* A call that had to wait its turn is handed to the skeleton's method
+ * table, past this check, in a worker thread like any other call */
+static void
+dispatch_thread (GTask *task,
+                 gpointer source_object,
+                 gpointer task_data,
+                 GCancellable *cancellable)
+{
+	GDBusInterfaceSkeleton *interface = source_object;
+	GDBusMethodInvocation *invocation = task_data;
+
+	g_dbus_interface_skeleton_get_vtable (interface)->method_call (
+				g_dbus_method_invocation_get_connection (invocation),
+				g_dbus_method_invocation_get_sender (invocation),
+				g_dbus_method_invocation_get_object_path (invocation),
+				g_dbus_method_invocation_get_interface_name (invocation),
+				g_dbus_method_invocation_get_method_name (invocation),
+				g_dbus_method_invocation_get_parameters (invocation),
+				invocation,
+				interface);
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+dispatch_deferred (gpointer user_data)
+{
+	GDBusMethodInvocation *invocation = user_data;
+	struct target *target;
+	GTask *task;
+
+	/* The container may have gone while the call waited */
+	target = target_lookup (g_dbus_method_invocation_get_object_path (invocation));
+	if (target == NULL) {
+		g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT,
+						       "The container is no longer registered");
+		return;
+	}
+
+	task = g_task_new (target->skeleton, NULL, NULL, NULL);
+	g_task_set_task_data (task, invocation, NULL);
+	g_task_run_in_thread (task, dispatch_thread);
+	g_object_unref (task);
+	target_unref (target);
+}
+
+/* The limiter went away with the call still waiting */
+static void
+drop_deferred (gpointer user_data)
+{
+	g_dbus_method_invocation_return_dbus_error (user_data, DBUS_ERROR_LIMITS_EXCEEDED, "Too many requests");
+}
+
+/* Early calls wait here until the state they would read is loaded. The
+ * setters, which cost a polkit round trip and a disk write, and container
+ * registration then go through the limiter; reads are served from the
+ * snapshot and caches and are let through. */
+static gboolean
+on_authorize_method (GDBusInterfaceSkeleton *interface,
+                     GDBusMethodInvocation *invocation,
+                     gpointer user_data)
+{
+	FairQueueVerdict verdict;
+	GCredentials *credentials;
+	const gchar *method;
+	const gchar *client;
+	gchar pid_key[32];
+
+	startup_wait_ready ();
+
+	method = g_dbus_method_invocation_get_method_name (invocation);
+	if (limiter == NULL ||
+	    !(g_str_has_prefix (method, "Set") || g_str_has_suffix (method, "Container")))
+		return TRUE;
+
+	/* Peers have no bus name; their process stands for it */
+	if (g_dbus_method_invocation_get_sender (invocation) != NULL) {
+		client = g_dbus_method_invocation_get_sender (invocation);
+	} else {
+		credentials = g_dbus_connection_get_peer_credentials (g_dbus_method_invocation_get_connection (invocation));
+		g_snprintf (pid_key, sizeof (pid_key), "pid:%d", credentials != NULL ? (gint) g_credentials_get_unix_pid (credentials, NULL) : -1);
+		client = pid_key;
+	}
+
+	/* The ref goes to whoever ends up answering */
+	g_object_ref (invocation);
+	verdict = fair_queue_admit (limiter, client, dispatch_deferred, invocation);
+
+	switch (verdict) {
+		case FAIR_QUEUE_RUN:
+			g_object_unref (invocation);
+			return TRUE;
+		case FAIR_QUEUE_QUEUED:
+			return FALSE;
+		case FAIR_QUEUE_REJECTED:
+		default:
+			g_dbus_method_invocation_return_dbus_error (invocation, DBUS_ERROR_LIMITS_EXCEEDED, "Too many requests");
+			return FALSE;
+	}
+}
+
+/* Stays installed, but costs an atomic read once the first reply is out */
+static GDBusMessage *
+first_reply_filter (GDBusConnection *connection,
+                    GDBusMessage *message,
+                    gboolean incoming,
+                    gpointer user_data)
+{
+	if (!incoming)
+		switch (g_dbus_message_get_message_type (message)) {
+			case G_DBUS_MESSAGE_TYPE_METHOD_RETURN:
+			case G_DBUS_MESSAGE_TYPE_ERROR:
+				startup_mark (STARTUP_FIRST_REPLY);
+				break;
+			default:
+				break;
+		}
+
+	return message;
+}
+
+/* Creates the target's skeleton, each handler holding a reference to the
+ * target, and exports it on the bus. From any thread. */
+static gboolean
+target_export (struct target *target,
+               GError **error)
+{
+	OpenSettingsHostname1 *skeleton;
+	HostnameState *current;
+	gchar *exported;
+	gint i;
+
+	skeleton = props_init (&target->state, target->facts, coalesce_window);
+
+	/* Handlers may block on polkit and on disk, keep them off the main loop */
+	g_dbus_interface_skeleton_set_flags (G_DBUS_INTERFACE_SKELETON (skeleton),
+					G_DBUS_INTERFACE_SKELETON_FLAGS_HANDLE_METHOD_INVOCATIONS_IN_THREAD);
+
+	g_signal_connect_data (skeleton, "handle-set-hostname", G_CALLBACK (on_handle_set_hostname), target_ref (target), target_closure_notify, 0);
+	g_signal_connect_data (skeleton, "handle-set-static-hostname", G_CALLBACK (on_handle_set_static_hostname), target_ref (target), target_closure_notify, 0);
+	g_signal_connect_data (skeleton, "handle-set-pretty-hostname", G_CALLBACK (on_handle_set_pretty_hostname), target_ref (target), target_closure_notify, 0);
+	g_signal_connect_data (skeleton, "handle-set-icon-name", G_CALLBACK (on_handle_set_icon_name), target_ref (target), target_closure_notify, 0);
+	g_signal_connect_data (skeleton, "handle-get-statistics", G_CALLBACK (on_handle_get_statistics), target_ref (target), target_closure_notify, 0);
+	g_signal_connect_data (skeleton, "handle-describe", G_CALLBACK (on_handle_describe), target_ref (target), target_closure_notify, 0);
+	g_signal_connect_data (skeleton, "handle-register-container", G_CALLBACK (on_handle_register_container), target_ref (target), target_closure_notify, 0);
+	g_signal_connect_data (skeleton, "handle-unregister-container", G_CALLBACK (on_handle_unregister_container), target_ref (target), target_closure_notify, 0);
+	g_signal_connect (skeleton, "g-authorize-method", G_CALLBACK (on_authorize_method), NULL);
+	g_object_weak_ref (G_OBJECT (skeleton), target_free, target);
+
+	/* A change published before update_state () could see the skeleton
+	 * is passed on here */
+	g_atomic_pointer_set (&target->skeleton, skeleton);
+	current = hostname_state_get (&target->state);
+	for (i = 0; i < HOSTNAME_STATE_N_FIELDS; i++) {
+		exported = facts_state_value_cached (current, i);
+		props_sync (skeleton, hostname_state_field_property (i), exported);
+		g_free (exported);
+	}
+	hostname_state_unref (current);
+
+	return g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (skeleton),
+						 bus_connection, target->object_path, error);
+}
+
+/* From the main context. Drops the handlers' references to the target. */
+static void
+target_unexport (struct target *target)
+{
+	GDBusInterfaceSkeleton *skeleton;
+
+	if (target->skeleton == NULL)
+		return;
+
+	skeleton = G_DBUS_INTERFACE_SKELETON (target->skeleton);
+	props_destroy (target->skeleton);
+	if (g_dbus_interface_skeleton_get_connection (skeleton) != NULL)
+		g_dbus_interface_skeleton_unexport (skeleton);
+	g_signal_handlers_disconnect_by_data (skeleton, target);
+}
+
+static void
+on_bus_acquired (GDBusConnection *connection,
+                 const gchar     *bus_name,
+                 gpointer         user_data)
+{
+	GError *err = NULL;
+
+	g_debug ("Acquired a message bus connection");
+	startup_mark (STARTUP_BUS_ACQUIRED);
+
+	bus_connection = connection;
+	g_dbus_connection_add_filter (connection, first_reply_filter, NULL, NULL);
+
+	if (!target_export (host, &err)) {
+		g_critical ("Failed to export interface on " HOSTNAME1_PATH ": %s", err->message);
+		exit(1);
+	}
+
+	if (p2p_socket != NULL &&
+	    !peer_server_start (p2p_socket, G_DBUS_INTERFACE_SKELETON (host->skeleton),
+				HOSTNAME1_PATH, first_reply_filter, &err)) {
+		g_warning ("Not listening on %s: %s", p2p_socket, err->message);
+		g_clear_error (&err);
+	}
+}
+
+static void
+on_name_acquired (GDBusConnection *connection,
+                  const gchar     *bus_name,
+                  gpointer         user_data)
+{
+	g_debug ("Acquired the name %s", bus_name);
+	startup_mark (STARTUP_NAME_ACQUIRED);
+	component_started();
+}
+
+static void
+on_name_lost (GDBusConnection *connection,
+              const gchar     *bus_name,
+              gpointer         user_data)
+{
+	if (connection == NULL)
+		g_critical ("Failed to acquire a dbus connection");
+	else
+		g_critical ("Failed to acquire dbus name %s", bus_name);
+	exit(1);
+}
+
+void
+hostname_stop (void)
+{
+	GHashTableIter iter;
+	gpointer target;
+
+	g_bus_unown_name (bus_id);
+	bus_id = 0;
+	read_only = FALSE;
+	watch_destroy ();
+	peer_server_stop ();
+	if (containers != NULL) {
+		g_hash_table_iter_init (&iter, containers);
+		while (g_hash_table_iter_next (&iter, NULL, &target)) {
+			g_hash_table_iter_steal (&iter);
+			target_unexport (target);
+			target_unref (target);
+		}
+		g_clear_pointer (&containers, g_hash_table_unref);
+	}
+	if (host != NULL) {
+		target_unexport (host);
+		target_unref (host);
+		host = NULL;
+	}
+	if (limiter != NULL) {
+		fair_queue_free (limiter);
+		limiter = NULL;
+	}
+}
+
+/* Each loader re-parses only the keys of its own source, so they double as
+ * change handlers for the watches set up in add_watches (). The source is
+ * read under the key's lock: with --deferred-init, a watch may fire while
+ * the initial load is still running, and the later reader must also be
+ * the later writer. */
+static void
+load_kernel_hostname (gpointer user_data)
+{
+	struct target *target = (struct target *) user_data;
+	struct target_io io = { 0 };
+
+	g_mutex_lock (&target->hostname_lock);
+	target_run (target, io_gethostname, &io);
+	update_state (target, HOSTNAME_STATE_HOSTNAME, io.contents);
+	g_mutex_unlock (&target->hostname_lock);
+
+	g_free (io.contents);
+}
+
+static void
+load_rc_conf (gpointer user_data)
+{
+	struct target *target = (struct target *) user_data;
+	struct target_io io = { 0 };
+
+	g_mutex_lock (&target->static_hostname_lock);
+	io.path = ETC_RC_CONF;
+	io.key = "hostname";
+	target_run (target, io_read_key, &io);
+	update_state (target, HOSTNAME_STATE_STATIC_HOSTNAME, io.contents);
+	g_mutex_unlock (&target->static_hostname_lock);
+
+	g_free (io.contents);
+}
+
+static void
+load_machine_info (gpointer user_data)
+{
+	static const struct {
+		const gchar *key;
+		HostnameStateField field;
+	} keys[] = {
+		{ "PRETTY_HOSTNAME", HOSTNAME_STATE_PRETTY_HOSTNAME },
+		{ "ICON_NAME", HOSTNAME_STATE_ICON_NAME },
+		{ "CHASSIS", HOSTNAME_STATE_CHASSIS },
+		{ "DEPLOYMENT", HOSTNAME_STATE_DEPLOYMENT },
+		{ "LOCATION", HOSTNAME_STATE_LOCATION },
+	};
+	struct target *target = (struct target *) user_data;
+	struct target_io io = { 0 };
+	const gchar *value;
+	guint i;
+
+	g_mutex_lock (&target->machine_info_lock);
+	/* Unset icon name and chassis are guessed when first read */
+	io.path = MACHINE_INFO;
+	target_run (target, io_read_env, &io);
+	for (i = 0; i < G_N_ELEMENTS (keys); i++) {
+		value = g_hash_table_lookup (io.values, keys[i].key);
+		update_state (target, keys[i].field, value != NULL ? value : "");
+	}
+	g_mutex_unlock (&target->machine_info_lock);
+
+	g_hash_table_unref (io.values);
+}
+
+static void
+invalidate_facts (gpointer user_data)
+{
+	facts_invalidate (((struct target *) user_data)->facts);
+}
+
+static void
+load_state (struct target *target)
+{
+	load_kernel_hostname (target);
+	load_rc_conf (target);
+	load_machine_info (target);
+	if (target == host)
+		startup_mark (STARTUP_STATE_LOADED);
+}
+
+static gpointer
+load_state_thread (gpointer user_data)
+{
+	load_state (host);
+	startup_set_ready ();
+
+	return NULL;
+}
+
+static void
+watch_target_file (struct target *target,
+                   const gchar *file,
+                   WatchFunc func)
+{
+	gchar *path;
+
+	path = g_strconcat (target->root, file, NULL);
+	watch_file (path, func, target);
+	g_free (path);
+}
+
+/* The watches hold no reference: a target's are removed before it goes.
+ * The kernel hostname is opened here, in the daemon's UTS namespace, for
+ * a container too: what matters is the wakeup, which the kernel sends to
+ * every poller of the file whichever namespace the name changed in, and
+ * load_kernel_hostname () then reads the name inside the container. */
+static void
+add_watches (struct target *target)
+{
+	watch_kernel_hostname (load_kernel_hostname, target);
+	watch_target_file (target, ETC_RC_CONF, load_rc_conf);
+	watch_target_file (target, MACHINE_INFO, load_machine_info);
+	watch_target_file (target, "/etc/os-release", invalidate_facts);
+	watch_target_file (target, "/usr/lib/os-release", invalidate_facts);
+	if (target == host)
+		startup_mark (STARTUP_WATCHES_ADDED);
+}
+
+static void
+own_name (void)
+{
+	bus_id = g_bus_own_name (G_BUS_TYPE_SYSTEM,
+				"org.freedesktop.hostname1",
+				G_BUS_NAME_OWNER_FLAGS_NONE,
+				on_bus_acquired,
+				on_name_acquired,
+				on_name_lost,
+				NULL,
+				NULL);
+}
+
+void
+hostname_start (void)
+{
+	if (coalesce_window < 0)
+		coalesce_window = 0;
+
+	host = target_new (NULL, 0, NULL);
+	if (rate_limit > 0 || total_rate_limit > 0)
+		limiter = fair_queue_new (rate_limit, MAX (rate_burst, 1), total_rate_limit, drop_deferred);
+	if (enable_containers)
+		containers = g_hash_table_new (g_str_hash, g_str_equal);
+
+	if (!deferred_init) {
+		load_state (host);
+		add_watches (host);
+		startup_set_ready ();
+		own_name ();
+		return;
+	}
+
+	/* Get on the bus first and load state while the name is being
+	 * acquired. Calls arriving before it's loaded wait on the gate. */
+	own_name ();
+	add_watches (host);
+	g_thread_unref (g_thread_new ("load-state", load_state_thread, NULL));
+}
+
+static GOptionEntry entries[] = {
+	{ "coalesce-window", 'w', 0, G_OPTION_ARG_INT, &coalesce_window, "Batch property changes made within MSEC milliseconds into one PropertiesChanged signal", "MSEC" },
+	{ "deferred-init", 'd', 0, G_OPTION_ARG_NONE, &deferred_init, "Request the bus name before loading state", NULL },
+	{ "rate-limit", 'r', 0, G_OPTION_ARG_DOUBLE, &rate_limit, "Let each client make RATE setter calls per second (default: no limit)", "RATE" },
+	{ "rate-burst", 'b', 0, G_OPTION_ARG_INT, &rate_burst, "Let each client make up to N setter calls at once", "N" },
+	{ "total-rate-limit", 't', 0, G_OPTION_ARG_DOUBLE, &total_rate_limit, "Serve RATE setter calls per second in all (default: no limit)", "RATE" },
+	{ "p2p-socket", 'p', 0, G_OPTION_ARG_FILENAME, &p2p_socket, "Also serve peer-to-peer connections on the unix socket at PATH", "PATH" },
+	{ "containers", 'c', 0, G_OPTION_ARG_NONE, &enable_containers, "Serve an object for each container registered with RegisterContainer", NULL },
+	{ NULL }
+};
+
+const GOptionEntry *
+hostname_get_options (void)
+{
+	return entries;
+}
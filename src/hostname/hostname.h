@@ -0,0 +1,20 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#ifndef OPENSETTINGS_HOSTNAME_H
+#define OPENSETTINGS_HOSTNAME_H
+
+#include <glib.h>
+
+/* The hostname1 mechanism, for whatever main loop runs it: this daemon's
+ * own, or the one it shares with the others in opensettings-daemon */
+
+const GOptionEntry *hostname_get_options (void);
+
+/* Loads state and owns the name on the system bus; needs a main loop
+ * running on the default context */
+void hostname_start (void);
+void hostname_stop (void);
+
+#endif /* OPENSETTINGS_HOSTNAME_H */
@@ -0,0 +1,240 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* A private socket serving the same interface as the bus does, for local
+ * clients that call often enough for the extra hop through the bus daemon
+ * to matter. Peers authenticate with their credentials, which the polkit
+ * checks then use instead of a bus name. */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "parsers.h"
+#include "peer.h"
+
+#define PEER_PROCESS_KEY "opensettings-peer-process"
+
+static GDBusServer *server = NULL;
+static gchar *server_path = NULL;
+static GDBusInterfaceSkeleton *server_skeleton = NULL;
+static gchar *server_object_path = NULL;
+static GDBusMessageFilterFunction server_filter = NULL;
+
+/* Read from handler threads for GetStatistics */
+static gint n_peers = 0;
+static gint n_peers_total = 0;
+
+/* Only EXTERNAL gives us credentials to check */
+static gboolean
+on_allow_mechanism (GDBusAuthObserver *observer,
+                    const gchar *mechanism,
+                    gpointer user_data)
+{
+	return g_strcmp0 (mechanism, "EXTERNAL") == 0;
+}
+
+static gboolean
+on_authorize_peer (GDBusAuthObserver *observer,
+                   GIOStream *stream,
+                   GCredentials *credentials,
+                   gpointer user_data)
+{
+	return credentials != NULL &&
+	       g_credentials_get_unix_pid (credentials, NULL) != -1;
+}
+
+static void
+on_closed (GDBusConnection *connection,
+           gboolean remote_peer_vanished,
+           GError *error,
+           gpointer user_data)
+{
+	g_debug ("Peer connection closed");
+	if (server_skeleton != NULL)
+		g_dbus_interface_skeleton_unexport_from_connection (server_skeleton, connection);
+	g_atomic_int_add (&n_peers, -1);
+	g_object_unref (connection);
+}
+
+/* The peer, as it was when it connected */
+struct peer_process {
+	pid_t pid;
+	uid_t uid;
+	guint64 start_time;
+};
+
+static struct peer_process *
+peer_process_new (GCredentials *credentials)
+{
+	struct peer_process process, *ret;
+	gchar *path, *contents;
+	gboolean ok;
+
+	process.pid = g_credentials_get_unix_pid (credentials, NULL);
+	process.uid = g_credentials_get_unix_user (credentials, NULL);
+	if (process.pid == -1 || process.uid == (uid_t) -1)
+		return NULL;
+
+	path = g_strdup_printf ("/proc/%d/stat", (int) process.pid);
+	ok = g_file_get_contents (path, &contents, NULL, NULL);
+	g_free (path);
+	if (!ok)
+		return NULL;
+	ok = parse_proc_stat_start_time (contents, &process.start_time);
+	g_free (contents);
+	if (!ok)
+		return NULL;
+
+	ret = g_new (struct peer_process, 1);
+	*ret = process;
+
+	return ret;
+}
+
+static gboolean
+on_new_connection (GDBusServer *server,
+                   GDBusConnection *connection,
+                   gpointer user_data)
+{
+	GError *err = NULL;
+	struct peer_process *process;
+
+	/* Pinned now, so that the PID can't name another process by the
+	 * time polkit looks at it */
+	process = peer_process_new (g_dbus_connection_get_peer_credentials (connection));
+	if (process == NULL) {
+		g_debug ("Peer went away before it could be identified");
+		return FALSE;
+	}
+	g_object_set_data_full (G_OBJECT (connection), PEER_PROCESS_KEY, process, g_free);
+
+	if (server_filter != NULL)
+		g_dbus_connection_add_filter (connection, server_filter, NULL, NULL);
+
+	if (!g_dbus_interface_skeleton_export (server_skeleton, connection, server_object_path, &err)) {
+		g_warning ("Failed to export interface to a peer: %s", err->message);
+		g_error_free (err);
+		return FALSE;
+	}
+
+	g_debug ("Peer connected");
+	g_atomic_int_inc (&n_peers);
+	g_atomic_int_inc (&n_peers_total);
+	g_signal_connect (connection, "closed", G_CALLBACK (on_closed), NULL);
+	g_object_ref (connection);
+
+	return TRUE;
+}
+
+gboolean
+peer_server_start (const gchar *socket_path,
+                   GDBusInterfaceSkeleton *skeleton,
+                   const gchar *object_path,
+                   GDBusMessageFilterFunction filter,
+                   GError **error)
+{
+	GDBusAuthObserver *observer;
+	struct stat st;
+	gchar *address, *dir, *guid;
+
+	g_return_val_if_fail (server == NULL, FALSE);
+
+	/* The socket's mode is set by path below, which is only safe in a
+	 * directory no one else can put anything into */
+	dir = g_path_get_dirname (socket_path);
+	g_mkdir_with_parents (dir, 0755);
+	if (lstat (dir, &st) != 0 || !S_ISDIR (st.st_mode) ||
+	    st.st_uid != geteuid () || (st.st_mode & 022) != 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+			     "%s must be a directory only we can write to", dir);
+		g_free (dir);
+		return FALSE;
+	}
+	g_free (dir);
+
+	/* A socket left by an earlier run would make the bind fail */
+	if (g_unlink (socket_path) < 0 && errno != ENOENT) {
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+			     "Cannot remove %s: %s", socket_path, g_strerror (errno));
+		return FALSE;
+	}
+
+	observer = g_dbus_auth_observer_new ();
+	g_signal_connect (observer, "allow-mechanism", G_CALLBACK (on_allow_mechanism), NULL);
+	g_signal_connect (observer, "authorize-authenticated-peer", G_CALLBACK (on_authorize_peer), NULL);
+
+	address = g_strdup_printf ("unix:path=%s", socket_path);
+	guid = g_dbus_generate_guid ();
+	server = g_dbus_server_new_sync (address, G_DBUS_SERVER_FLAGS_NONE, guid, observer, NULL, error);
+	g_free (guid);
+	g_free (address);
+	g_object_unref (observer);
+	if (server == NULL)
+		return FALSE;
+
+	/* Anyone may connect; polkit decides what they may change, as on the
+	 * bus */
+	g_chmod (socket_path, 0666);
+
+	server_path = g_strdup (socket_path);
+	server_skeleton = g_object_ref (skeleton);
+	server_object_path = g_strdup (object_path);
+	server_filter = filter;
+
+	g_signal_connect (server, "new-connection", G_CALLBACK (on_new_connection), NULL);
+	g_dbus_server_start (server);
+	g_debug ("Listening on %s", socket_path);
+
+	return TRUE;
+}
+
+gboolean
+peer_get_process (GDBusConnection *connection,
+                  pid_t *pid,
+                  uid_t *uid,
+                  guint64 *start_time)
+{
+	struct peer_process *process;
+
+	process = g_object_get_data (G_OBJECT (connection), PEER_PROCESS_KEY);
+	if (process == NULL)
+		return FALSE;
+
+	*pid = process->pid;
+	*uid = process->uid;
+	*start_time = process->start_time;
+
+	return TRUE;
+}
+
+void
+peer_server_add_statistics (GVariantBuilder *builder)
+{
+	g_variant_builder_add (builder, "{sv}", "PeerConnections",
+			       g_variant_new_uint32 (g_atomic_int_get (&n_peers)));
+	g_variant_builder_add (builder, "{sv}", "PeerConnectionsTotal",
+			       g_variant_new_uint32 (g_atomic_int_get (&n_peers_total)));
+}
+
+void
+peer_server_stop (void)
+{
+	if (server == NULL)
+		return;
+
+	g_dbus_server_stop (server);
+	g_clear_object (&server);
+	g_unlink (server_path);
+	g_clear_pointer (&server_path, g_free);
+	g_clear_pointer (&server_object_path, g_free);
+	/* Connections still open unexport from it when they close */
+	g_clear_object (&server_skeleton);
+}
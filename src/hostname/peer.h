@@ -0,0 +1,27 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#ifndef OPENSETTINGS_HOSTNAME_PEER_H
+#define OPENSETTINGS_HOSTNAME_PEER_H
+
+#include <sys/types.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+gboolean peer_server_start (const gchar *socket_path,
+                            GDBusInterfaceSkeleton *skeleton,
+                            const gchar *object_path,
+                            GDBusMessageFilterFunction filter,
+                            GError **error);
+/* The process at the other end of a peer connection, as it was when it
+ * connected; FALSE for a bus connection */
+gboolean peer_get_process (GDBusConnection *connection,
+                           pid_t *pid,
+                           uid_t *uid,
+                           guint64 *start_time);
+void peer_server_add_statistics (GVariantBuilder *builder);
+void peer_server_stop (void);
+
+#endif /* OPENSETTINGS_HOSTNAME_PEER_H */
@@ -0,0 +1,295 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* Property updates are not pushed to the skeleton one by one: every
+ * props_set () lands in a pending table and all of them are applied in a
+ * single batch, either on the next main loop iteration or once the
+ * configured window expires. The skeleton then sends one PropertiesChanged
+ * signal carrying every property that actually changed.
+ *
+ * Property reads don't go through the values stored in the skeleton at
+ * all: its get_property is overridden to answer from the current state
+ * snapshot, without taking any lock, or from the facts. The stored values
+ * only serve the skeleton's own change tracking.
+ *
+ * Each skeleton has a state cell, facts and pending changes of its own;
+ * the statistics count them all. */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "props.h"
+#include "startup.h"
+
+typedef struct {
+	OpenSettingsHostname1Skeleton parent_instance;
+	HostnameStateCell *cell;
+	Facts *facts;
+	guint window;
+
+	GHashTable *pending; /* property name -> new value */
+	GHashTable *published; /* property name -> value in the skeleton */
+	guint flush_id;
+	GMutex lock;
+} HostnameSkeleton;
+
+typedef struct {
+	OpenSettingsHostname1SkeletonClass parent_class;
+} HostnameSkeletonClass;
+
+static GType hostname_skeleton_get_type (void);
+
+G_DEFINE_TYPE (HostnameSkeleton, hostname_skeleton, OPEN_SETTINGS_TYPE_HOSTNAME1_SKELETON);
+
+static guint64 updates = 0;
+static guint64 signals_emitted = 0;
+G_LOCK_DEFINE_STATIC (statistics);
+
+static void
+hostname_skeleton_get_property (GObject *object,
+                                guint prop_id,
+                                GValue *value,
+                                GParamSpec *pspec)
+{
+	HostnameSkeleton *skeleton = (HostnameSkeleton *) object;
+	HostnameState *state;
+	gchar *fact;
+	gint field;
+
+	startup_wait_ready ();
+
+	field = hostname_state_property_field (pspec->name);
+	if (field >= 0) {
+		state = hostname_state_get (skeleton->cell);
+		g_value_take_string (value, facts_state_value (state, field));
+		hostname_state_unref (state);
+		return;
+	}
+
+	if (facts_lookup (skeleton->facts, pspec->name, &fact)) {
+		g_value_take_string (value, fact);
+		return;
+	}
+
+	G_OBJECT_CLASS (hostname_skeleton_parent_class)->get_property (object, prop_id, value, pspec);
+}
+
+static void
+hostname_skeleton_finalize (GObject *object)
+{
+	HostnameSkeleton *skeleton = (HostnameSkeleton *) object;
+
+	g_clear_pointer (&skeleton->pending, g_hash_table_unref);
+	g_clear_pointer (&skeleton->published, g_hash_table_unref);
+	g_mutex_clear (&skeleton->lock);
+
+	G_OBJECT_CLASS (hostname_skeleton_parent_class)->finalize (object);
+}
+
+static void
+hostname_skeleton_init (HostnameSkeleton *skeleton)
+{
+	g_mutex_init (&skeleton->lock);
+}
+
+static void
+hostname_skeleton_class_init (HostnameSkeletonClass *klass)
+{
+	G_OBJECT_CLASS (klass)->get_property = hostname_skeleton_get_property;
+	G_OBJECT_CLASS (klass)->finalize = hostname_skeleton_finalize;
+}
+
+static gboolean
+props_flush_cb (gpointer user_data)
+{
+	props_flush (user_data);
+	return FALSE;
+}
+
+/* The returned skeleton starts out with the values of the current snapshot,
+ * as configured: fallbacks that would cost I/O are left to the first read.
+ * It queues changes from the start, but whoever publishes it to other
+ * threads should pass it every field once it has, in case one changed in
+ * between. */
+OpenSettingsHostname1 *
+props_init (HostnameStateCell *cell,
+            Facts *facts,
+            guint window_ms)
+{
+	HostnameSkeleton *skeleton;
+	HostnameState *state;
+	gint i;
+
+	skeleton = g_object_new (hostname_skeleton_get_type (), NULL);
+	skeleton->cell = cell;
+	skeleton->facts = facts;
+	skeleton->window = window_ms;
+	skeleton->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	skeleton->published = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	state = hostname_state_get (cell);
+	for (i = 0; i < HOSTNAME_STATE_N_FIELDS; i++) {
+		const gchar *property = hostname_state_field_property (i);
+
+		g_object_set (skeleton, property, state->fields[i], NULL);
+		g_hash_table_replace (skeleton->published, g_strdup (property), g_strdup (state->fields[i]));
+	}
+	hostname_state_unref (state);
+
+	return OPEN_SETTINGS_HOSTNAME1 (skeleton);
+}
+
+static void
+props_queue (HostnameSkeleton *skeleton,
+             const gchar *property,
+             const gchar *value,
+             gboolean count)
+{
+	GSource *source;
+	gpointer current;
+
+	g_mutex_lock (&skeleton->lock);
+	if (skeleton->pending == NULL) {
+		g_mutex_unlock (&skeleton->lock);
+		return;
+	}
+
+	/* Only a value that changes what would be sent is an update */
+	if (!g_hash_table_lookup_extended (skeleton->pending, property, NULL, &current))
+		current = g_hash_table_lookup (skeleton->published, property);
+	if (g_strcmp0 (current, value) == 0) {
+		g_mutex_unlock (&skeleton->lock);
+		return;
+	}
+
+	g_hash_table_replace (skeleton->pending, g_strdup (property), g_strdup (value));
+
+	if (skeleton->flush_id == 0) {
+		if (skeleton->window > 0)
+			source = g_timeout_source_new (skeleton->window);
+		else
+			source = g_idle_source_new ();
+		g_source_set_callback (source, props_flush_cb, g_object_ref (skeleton), g_object_unref);
+		skeleton->flush_id = g_source_attach (source, NULL);
+		g_source_unref (source);
+	}
+	g_mutex_unlock (&skeleton->lock);
+
+	if (!count)
+		return;
+
+	G_LOCK (statistics);
+	updates++;
+	G_UNLOCK (statistics);
+}
+
+/* May be called from any thread. The skeleton itself is only touched from
+ * the default main context, in props_flush (). */
+void
+props_set (OpenSettingsHostname1 *object,
+           const gchar *property,
+           const gchar *value)
+{
+	props_queue ((HostnameSkeleton *) object, property, value, TRUE);
+}
+
+/* The same for a value the skeleton may have missed, which isn't counted
+ * as an update */
+void
+props_sync (OpenSettingsHostname1 *object,
+            const gchar *property,
+            const gchar *value)
+{
+	props_queue ((HostnameSkeleton *) object, property, value, FALSE);
+}
+
+void
+props_flush (OpenSettingsHostname1 *object)
+{
+	HostnameSkeleton *skeleton = (HostnameSkeleton *) object;
+	GHashTable *batch;
+	GHashTableIter iter;
+	gpointer key, value;
+	guint changed = 0;
+
+	g_mutex_lock (&skeleton->lock);
+	if (skeleton->flush_id != 0) {
+		g_source_remove (skeleton->flush_id);
+		skeleton->flush_id = 0;
+	}
+	if (skeleton->pending == NULL || g_hash_table_size (skeleton->pending) == 0) {
+		g_mutex_unlock (&skeleton->lock);
+		return;
+	}
+	batch = skeleton->pending;
+	skeleton->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	/* g_object_get () would answer from the snapshot, which is already
+	 * ahead of what the skeleton has announced. Under the lock, as
+	 * props_set () compares against it too. */
+	g_hash_table_iter_init (&iter, batch);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		if (g_strcmp0 (g_hash_table_lookup (skeleton->published, key), value) == 0)
+			g_hash_table_iter_remove (&iter);
+		else
+			g_hash_table_replace (skeleton->published, g_strdup (key), g_strdup (value));
+	}
+	g_mutex_unlock (&skeleton->lock);
+
+	g_object_freeze_notify (G_OBJECT (skeleton));
+	g_hash_table_iter_init (&iter, batch);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_object_set (skeleton, (const gchar *) key, value, NULL);
+		changed++;
+	}
+	g_object_thaw_notify (G_OBJECT (skeleton));
+	g_hash_table_unref (batch);
+
+	if (changed == 0)
+		return;
+
+	/* Send the queued changes now rather than on the skeleton's own idle */
+	g_dbus_interface_skeleton_flush (G_DBUS_INTERFACE_SKELETON (skeleton));
+
+	G_LOCK (statistics);
+	signals_emitted++;
+	G_UNLOCK (statistics);
+}
+
+void
+props_add_statistics (GVariantBuilder *builder)
+{
+	guint64 n_updates, n_emitted;
+
+	G_LOCK (statistics);
+	n_updates = updates;
+	n_emitted = signals_emitted;
+	G_UNLOCK (statistics);
+
+	g_variant_builder_add (builder, "{sv}", "PropertyUpdates",
+	                       g_variant_new_uint64 (n_updates));
+	g_variant_builder_add (builder, "{sv}", "PropertiesChangedEmitted",
+	                       g_variant_new_uint64 (n_emitted));
+	/* Every update that did not cost a signal of its own */
+	g_variant_builder_add (builder, "{sv}", "PropertiesChangedCoalesced",
+	                       g_variant_new_uint64 (n_updates - n_emitted));
+}
+
+/* Sends what is pending and drops whatever comes later. From the default
+ * main context, before the skeleton is unexported. */
+void
+props_destroy (OpenSettingsHostname1 *object)
+{
+	HostnameSkeleton *skeleton = (HostnameSkeleton *) object;
+
+	props_flush (object);
+
+	g_mutex_lock (&skeleton->lock);
+	if (skeleton->flush_id != 0) {
+		g_source_remove (skeleton->flush_id);
+		skeleton->flush_id = 0;
+	}
+	g_clear_pointer (&skeleton->pending, g_hash_table_unref);
+	g_mutex_unlock (&skeleton->lock);
+}
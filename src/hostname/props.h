@@ -0,0 +1,27 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#ifndef OPENSETTINGS_HOSTNAME_PROPS_H
+#define OPENSETTINGS_HOSTNAME_PROPS_H
+
+#include <glib.h>
+
+#include "facts.h"
+#include "hostname-glue.h"
+#include "state.h"
+
+OpenSettingsHostname1 *props_init (HostnameStateCell *cell,
+                                   Facts *facts,
+                                   guint window_ms);
+void props_set (OpenSettingsHostname1 *object,
+                const gchar *property,
+                const gchar *value);
+void props_sync (OpenSettingsHostname1 *object,
+                 const gchar *property,
+                 const gchar *value);
+void props_flush (OpenSettingsHostname1 *object);
+void props_add_statistics (GVariantBuilder *builder);
+void props_destroy (OpenSettingsHostname1 *object);
+
+#endif /* OPENSETTINGS_HOSTNAME_PROPS_H */
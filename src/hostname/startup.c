@@ -0,0 +1,89 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* Records when each startup phase was first reached, in monotonic
+ * microseconds since main () was entered, and holds the readiness gate
+ * early calls wait on while state is still being loaded. */
+
+#include <glib.h>
+
+#include "startup.h"
+
+static const gchar *phase_names[STARTUP_N_PHASES] = {
+	"StateLoaded",
+	"WatchesAdded",
+	"BusAcquired",
+	"NameAcquired",
+	"Ready",
+	"FirstReply",
+};
+
+static gint64 start_time = 0;
+static gint64 phase_times[STARTUP_N_PHASES];
+static gint phase_reached[STARTUP_N_PHASES];
+
+static gint ready = 0;
+static GMutex ready_mutex;
+static GCond ready_cond;
+
+void
+startup_begin (void)
+{
+	start_time = g_get_monotonic_time ();
+}
+
+/* Only the first mark of a phase counts. Cheap once it's been reached. */
+void
+startup_mark (StartupPhase phase)
+{
+	if (g_atomic_int_get (&phase_reached[phase]) ||
+	    !g_atomic_int_compare_and_exchange (&phase_reached[phase], 0, 2))
+		return;
+
+	phase_times[phase] = g_get_monotonic_time () - start_time;
+	g_atomic_int_set (&phase_reached[phase], 1);
+
+	g_debug ("Startup: %s after %" G_GINT64_FORMAT " us", phase_names[phase], phase_times[phase]);
+}
+
+void
+startup_set_ready (void)
+{
+	startup_mark (STARTUP_READY);
+
+	g_mutex_lock (&ready_mutex);
+	g_atomic_int_set (&ready, 1);
+	g_cond_broadcast (&ready_cond);
+	g_mutex_unlock (&ready_mutex);
+}
+
+void
+startup_wait_ready (void)
+{
+	if (g_atomic_int_get (&ready))
+		return;
+
+	g_mutex_lock (&ready_mutex);
+	while (!g_atomic_int_get (&ready))
+		g_cond_wait (&ready_cond, &ready_mutex);
+	g_mutex_unlock (&ready_mutex);
+}
+
+void
+startup_add_statistics (GVariantBuilder *builder)
+{
+	gint i;
+
+	for (i = 0; i < STARTUP_N_PHASES; i++) {
+		gchar *name;
+
+		/* Skip phases still being marked, too */
+		if (g_atomic_int_get (&phase_reached[i]) != 1)
+			continue;
+
+		name = g_strdup_printf ("Startup%sUsec", phase_names[i]);
+		g_variant_builder_add (builder, "{sv}", name, g_variant_new_uint64 (phase_times[i]));
+		g_free (name);
+	}
+}
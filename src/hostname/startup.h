@@ -0,0 +1,26 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#ifndef OPENSETTINGS_HOSTNAME_STARTUP_H
+#define OPENSETTINGS_HOSTNAME_STARTUP_H
+
+#include <glib.h>
+
+typedef enum {
+	STARTUP_STATE_LOADED,
+	STARTUP_WATCHES_ADDED,
+	STARTUP_BUS_ACQUIRED,
+	STARTUP_NAME_ACQUIRED,
+	STARTUP_READY,
+	STARTUP_FIRST_REPLY,
+	STARTUP_N_PHASES
+} StartupPhase;
+
+void startup_begin (void);
+void startup_mark (StartupPhase phase);
+void startup_set_ready (void);
+void startup_wait_ready (void);
+void startup_add_statistics (GVariantBuilder *builder);
+
+#endif /* OPENSETTINGS_HOSTNAME_STARTUP_H */
@@ -0,0 +1,167 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+/* Readers never lock: they announce themselves in the reader count of the
+ * current epoch, load the published pointer, take a reference and leave.
+ * Writers are serialized on the cell's mutex. After swapping the pointer
+ * they flip the epoch twice, each time waiting for the readers of the
+ * previous epoch to leave, before dropping their own reference to the old
+ * snapshot. Any reader that could still have loaded the old pointer holds
+ * a reference by then. */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "state.h"
+
+/* GObject property names of the generated skeleton */
+static const gchar *field_properties[HOSTNAME_STATE_N_FIELDS] = {
+	"hostname",
+	"static-hostname",
+	"pretty-hostname",
+	"icon-name",
+	"chassis",
+	"deployment",
+	"location",
+};
+
+const gchar *
+hostname_state_field_property (HostnameStateField field)
+{
+	g_return_val_if_fail (field < HOSTNAME_STATE_N_FIELDS, NULL);
+
+	return field_properties[field];
+}
+
+gint
+hostname_state_property_field (const gchar *property)
+{
+	gint i;
+
+	for (i = 0; i < HOSTNAME_STATE_N_FIELDS; i++)
+		if (strcmp (field_properties[i], property) == 0)
+			return i;
+
+	return -1;
+}
+
+static HostnameState *
+hostname_state_new (void)
+{
+	HostnameState *state;
+
+	state = g_new0 (HostnameState, 1);
+	state->ref_count = 1;
+
+	return state;
+}
+
+static HostnameState *
+hostname_state_copy (const HostnameState *state)
+{
+	HostnameState *copy;
+	gint i;
+
+	copy = hostname_state_new ();
+	copy->serial = state->serial + 1;
+	for (i = 0; i < HOSTNAME_STATE_N_FIELDS; i++)
+		copy->fields[i] = g_strdup (state->fields[i]);
+
+	return copy;
+}
+
+HostnameState *
+hostname_state_ref (HostnameState *state)
+{
+	g_atomic_int_inc (&state->ref_count);
+
+	return state;
+}
+
+void
+hostname_state_unref (HostnameState *state)
+{
+	gint i;
+
+	if (state == NULL || !g_atomic_int_dec_and_test (&state->ref_count))
+		return;
+
+	for (i = 0; i < HOSTNAME_STATE_N_FIELDS; i++)
+		g_free (state->fields[i]);
+	g_free (state);
+}
+
+void
+hostname_state_cell_init (HostnameStateCell *cell)
+{
+	memset (cell, 0, sizeof (HostnameStateCell));
+	g_mutex_init (&cell->writer);
+	cell->current = hostname_state_new ();
+}
+
+/* Only once no reader can be left */
+void
+hostname_state_cell_clear (HostnameStateCell *cell)
+{
+	hostname_state_unref (cell->current);
+	cell->current = NULL;
+	g_mutex_clear (&cell->writer);
+}
+
+HostnameState *
+hostname_state_get (HostnameStateCell *cell)
+{
+	HostnameState *state;
+	guint epoch;
+
+	epoch = (guint) g_atomic_int_get (&cell->epoch) & 1;
+	g_atomic_int_inc (&cell->readers[epoch]);
+	state = hostname_state_ref (g_atomic_pointer_get (&cell->current));
+	g_atomic_int_add (&cell->readers[epoch], -1);
+
+	return state;
+}
+
+static void
+hostname_state_synchronize (HostnameStateCell *cell)
+{
+	guint old;
+	gint i;
+
+	for (i = 0; i < 2; i++) {
+		old = (guint) g_atomic_int_add (&cell->epoch, 1) & 1;
+		while (g_atomic_int_get (&cell->readers[old]) != 0)
+			g_thread_yield ();
+	}
+}
+
+/* Returns FALSE, and publishes nothing, if the field already had value */
+gboolean
+hostname_state_update (HostnameStateCell *cell,
+                       HostnameStateField field,
+                       const gchar *value)
+{
+	HostnameState *old, *state;
+
+	g_mutex_lock (&cell->writer);
+
+	old = g_atomic_pointer_get (&cell->current);
+	if (g_strcmp0 (old->fields[field], value) == 0) {
+		g_mutex_unlock (&cell->writer);
+		return FALSE;
+	}
+
+	state = hostname_state_copy (old);
+	g_free (state->fields[field]);
+	state->fields[field] = g_strdup (value);
+
+	g_atomic_pointer_set (&cell->current, state);
+	hostname_state_synchronize (cell);
+	hostname_state_unref (old);
+
+	g_mutex_unlock (&cell->writer);
+
+	return TRUE;
+}
@@ -0,0 +1,50 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#ifndef OPENSETTINGS_HOSTNAME_STATE_H
+#define OPENSETTINGS_HOSTNAME_STATE_H
+
+#include <glib.h>
+
+typedef enum {
+	HOSTNAME_STATE_HOSTNAME,
+	HOSTNAME_STATE_STATIC_HOSTNAME,
+	HOSTNAME_STATE_PRETTY_HOSTNAME,
+	HOSTNAME_STATE_ICON_NAME,
+	HOSTNAME_STATE_CHASSIS,
+	HOSTNAME_STATE_DEPLOYMENT,
+	HOSTNAME_STATE_LOCATION,
+	HOSTNAME_STATE_N_FIELDS
+} HostnameStateField;
+
+/* An immutable snapshot of every property. Never modified once published;
+ * a change publishes a new snapshot instead. */
+typedef struct {
+	gint ref_count;
+	guint64 serial;
+	gchar *fields[HOSTNAME_STATE_N_FIELDS];
+} HostnameState;
+
+/* Where the current snapshot is published */
+typedef struct {
+	HostnameState *current;
+	gint epoch;
+	gint readers[2];
+	GMutex writer;
+} HostnameStateCell;
+
+void hostname_state_cell_init (HostnameStateCell *cell);
+void hostname_state_cell_clear (HostnameStateCell *cell);
+
+HostnameState *hostname_state_get (HostnameStateCell *cell);
+HostnameState *hostname_state_ref (HostnameState *state);
+void hostname_state_unref (HostnameState *state);
+gboolean hostname_state_update (HostnameStateCell *cell,
+                                HostnameStateField field,
+                                const gchar *value);
+
+const gchar *hostname_state_field_property (HostnameStateField field);
+gint hostname_state_property_field (const gchar *property);
+
+#endif /* OPENSETTINGS_HOSTNAME_STATE_H */
@@ -0,0 +1,162 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+
+#include "watch.h"
+
+/* Writes to /proc/sys/kernel/hostname (sethostname (), hostname(1), a
+ * write to the file itself) wake up pollers of that file with POLLERR and
+ * POLLPRI set, whichever UTS namespace the name was changed in. */
+#define KERNEL_HOSTNAME "/proc/sys/kernel/hostname"
+
+struct watch {
+	WatchFunc func;
+	gpointer user_data;
+	GFileMonitor *monitor;
+	gint fd;
+	guint source_id;
+};
+
+static GSList *watches = NULL;
+
+static void
+watch_file_changed_cb (GFileMonitor *monitor,
+                       GFile *file,
+                       GFile *other_file,
+                       GFileMonitorEvent event_type,
+                       gpointer user_data)
+{
+	struct watch *watch = (struct watch *) user_data;
+
+	switch (event_type) {
+		case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+		case G_FILE_MONITOR_EVENT_CREATED:
+		case G_FILE_MONITOR_EVENT_DELETED:
+		case G_FILE_MONITOR_EVENT_MOVED:
+			watch->func (watch->user_data);
+			break;
+		default:
+			break;
+	}
+}
+
+void
+watch_file (const gchar *path,
+            WatchFunc func,
+            gpointer user_data)
+{
+	struct watch *watch;
+	GFile *file;
+	GError *err = NULL;
+
+	watch = g_new0 (struct watch, 1);
+	watch->func = func;
+	watch->user_data = user_data;
+	watch->fd = -1;
+
+	/* Backed by inotify on the parent directory, so this also catches
+	 * files that get replaced through a rename */
+	file = g_file_new_for_path (path);
+	watch->monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &err);
+	g_object_unref (file);
+	if (watch->monitor == NULL) {
+		g_warning ("Failed to watch %s: %s", path, err->message);
+		g_error_free (err);
+		g_free (watch);
+		return;
+	}
+
+	g_signal_connect (watch->monitor, "changed", G_CALLBACK (watch_file_changed_cb), watch);
+	watches = g_slist_prepend (watches, watch);
+}
+
+static gboolean
+watch_kernel_hostname_cb (gint fd,
+                          GIOCondition condition,
+                          gpointer user_data)
+{
+	struct watch *watch = (struct watch *) user_data;
+	gchar buf[HOST_NAME_MAX + 1];
+
+	/* Consume the event; the caller re-reads the name itself */
+	if (lseek (fd, 0, SEEK_SET) < 0 || read (fd, buf, sizeof (buf)) < 0)
+		g_debug ("Failed to read " KERNEL_HOSTNAME ": %s", strerror (errno));
+
+	watch->func (watch->user_data);
+
+	return TRUE;
+}
+
+void
+watch_kernel_hostname (WatchFunc func,
+                       gpointer user_data)
+{
+	struct watch *watch;
+	gint fd;
+
+	fd = open (KERNEL_HOSTNAME, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		g_warning ("Failed to open " KERNEL_HOSTNAME ": %s", strerror (errno));
+		return;
+	}
+
+	watch = g_new0 (struct watch, 1);
+	watch->func = func;
+	watch->user_data = user_data;
+	watch->fd = fd;
+	watch->source_id = g_unix_fd_add (fd, G_IO_ERR | G_IO_PRI, watch_kernel_hostname_cb, watch);
+
+	watches = g_slist_prepend (watches, watch);
+}
+
+static void
+watch_free (gpointer data)
+{
+	struct watch *watch = (struct watch *) data;
+
+	if (watch->monitor != NULL) {
+		g_signal_handlers_disconnect_by_data (watch->monitor, watch);
+		g_file_monitor_cancel (watch->monitor);
+		g_object_unref (watch->monitor);
+	}
+	if (watch->source_id != 0)
+		g_source_remove (watch->source_id);
+	if (watch->fd >= 0)
+		close (watch->fd);
+
+	g_free (watch);
+}
+
+/* Every watch added with user_data */
+void
+watch_remove (gpointer user_data)
+{
+	GSList *l, *next;
+
+	for (l = watches; l != NULL; l = next) {
+		struct watch *watch = (struct watch *) l->data;
+
+		next = l->next;
+		if (watch->user_data != user_data)
+			continue;
+		watches = g_slist_delete_link (watches, l);
+		watch_free (watch);
+	}
+}
+
+void
+watch_destroy (void)
+{
+	g_slist_free_full (watches, watch_free);
+	watches = NULL;
+}
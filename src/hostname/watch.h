@@ -0,0 +1,20 @@
+/*
+  Copyright 2019 Ataraxia Linux
+*/
+
+#ifndef OPENSETTINGS_HOSTNAME_WATCH_H
+#define OPENSETTINGS_HOSTNAME_WATCH_H
+
+#include <glib.h>
+
+typedef void (*WatchFunc) (gpointer user_data);
+
+void watch_file (const gchar *path,
+                 WatchFunc func,
+                 gpointer user_data);
+void watch_kernel_hostname (WatchFunc func,
+                            gpointer user_data);
+void watch_remove (gpointer user_data);
+void watch_destroy (void);
+
+#endif /* OPENSETTINGS_HOSTNAME_WATCH_H */
@@ -0,0 +1,75 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "alloc-count.h"
+
+#if ALLOC_COUNT_SUPPORTED
+
+/* In the executable, so reading it never allocates */
+static __thread guint64 n_allocs = 0;
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+void *
+malloc (size_t size)
+{
+        n_allocs++;
+        return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+        n_allocs++;
+        return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+        n_allocs++;
+        return __libc_realloc (ptr, size);
+}
+
+guint64
+alloc_count_get (void)
+{
+        return n_allocs;
+}
+
+#else
+
+guint64
+alloc_count_get (void)
+{
+        return 0;
+}
+
+#endif
@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __ALLOC_COUNT_H__
+#define __ALLOC_COUNT_H__
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Counts the malloc (), calloc () and realloc () calls of each thread, by
+ * overriding them in front of glibc's, so only programs that measure
+ * their allocations should link it. Elsewhere the count stays 0. */
+#ifdef __GLIBC__
+#define ALLOC_COUNT_SUPPORTED 1
+#else
+#define ALLOC_COUNT_SUPPORTED 0
+#endif
+
+/* Allocations made by the calling thread so far */
+guint64 alloc_count_get (void);
+
+G_END_DECLS
+
+#endif /* __ALLOC_COUNT_H__ */
@@ -0,0 +1,715 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <linux/fs.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "config-writer.h"
+
+typedef struct
+{
+        char     *filename;
+
+        /* What was there before, to roll back to */
+        gboolean  existed;
+        gboolean  was_symlink;
+        char     *old_contents;
+        gsize     old_len;
+        char     *old_link;
+        mode_t    mode;
+        uid_t     uid;
+        gid_t     gid;
+
+        /* What we want there; contents is NULL for a symlink */
+        GString  *contents;
+        char     *link_target;
+        gboolean  changed;
+
+        /* A file already holding contents, whose data the new one can
+         * share; not ours to close */
+        int       share_fd;
+        gboolean  share_link;
+
+        char     *tmp_path;
+        gboolean  renamed;
+} StagedFile;
+
+struct _ConfigTransaction
+{
+        GPtrArray *files;
+};
+
+GQuark
+config_writer_error_quark (void)
+{
+        static GQuark ret = 0;
+
+        if (ret == 0) {
+                ret = g_quark_from_static_string ("config-writer-error");
+        }
+
+        return ret;
+}
+
+static void
+staged_file_free (gpointer data)
+{
+        StagedFile *file = data;
+
+        if (file->tmp_path != NULL)
+                g_unlink (file->tmp_path);
+
+        g_free (file->filename);
+        g_free (file->old_contents);
+        g_free (file->old_link);
+        if (file->contents != NULL)
+                g_string_free (file->contents, TRUE);
+        g_free (file->link_target);
+        g_free (file->tmp_path);
+        g_free (file);
+}
+
+ConfigTransaction *
+config_transaction_new (void)
+{
+        ConfigTransaction *transaction;
+
+        transaction = g_new0 (ConfigTransaction, 1);
+        transaction->files = g_ptr_array_new_with_free_func (staged_file_free);
+
+        return transaction;
+}
+
+void
+config_transaction_free (ConfigTransaction *transaction)
+{
+        if (transaction == NULL)
+                return;
+
+        g_ptr_array_free (transaction->files, TRUE);
+        g_free (transaction);
+}
+
+/* Find the staged copy of filename, loading the file the first time it
+ * is touched by the transaction */
+static StagedFile *
+config_transaction_lookup (ConfigTransaction  *transaction,
+                           const char         *filename,
+                           GError            **error)
+{
+        StagedFile  *file;
+        struct stat  st;
+        GError      *our_error;
+        guint        i;
+
+        for (i = 0; i < transaction->files->len; i++) {
+                file = g_ptr_array_index (transaction->files, i);
+                if (strcmp (file->filename, filename) == 0)
+                        return file;
+        }
+
+        file = g_new0 (StagedFile, 1);
+        file->filename = g_strdup (filename);
+        file->mode = 0644;
+        file->share_fd = -1;
+
+        if (g_lstat (filename, &st) == 0) {
+                file->existed = TRUE;
+                file->was_symlink = S_ISLNK (st.st_mode);
+                if (file->was_symlink)
+                        file->old_link = g_file_read_link (filename, NULL);
+
+                /* Mode and contents of what the name resolves to */
+                if (g_stat (filename, &st) == 0 && S_ISREG (st.st_mode)) {
+                        file->mode = st.st_mode & 07777;
+                        file->uid = st.st_uid;
+                        file->gid = st.st_gid;
+
+                        our_error = NULL;
+                        if (!g_file_get_contents (filename, &file->old_contents,
+                                                  &file->old_len, &our_error)) {
+                                g_set_error (error, CONFIG_WRITER_ERROR,
+                                             CONFIG_WRITER_ERROR_READ,
+                                             "%s cannot be read: %s",
+                                             filename, our_error->message);
+                                g_error_free (our_error);
+                                g_free (file->filename);
+                                g_free (file->old_link);
+                                g_free (file);
+                                return NULL;
+                        }
+                        file->contents = g_string_new_len (file->old_contents,
+                                                           file->old_len);
+                }
+        }
+
+        g_ptr_array_add (transaction->files, file);
+
+        return file;
+}
+
+/* key="value", escaped as inside a shell's double quotes */
+static char *
+quote_value (const char *key,
+             const char *value)
+{
+        GString *line;
+
+        line = g_string_sized_new (strlen (key) + strlen (value) + 3);
+        g_string_append (line, key);
+        g_string_append (line, "=\"");
+        for (; *value != '\0'; value++) {
+                if (strchr ("\"\\$`", *value) != NULL)
+                        g_string_append_c (line, '\\');
+                g_string_append_c (line, *value);
+        }
+        g_string_append_c (line, '"');
+
+        return g_string_free (line, FALSE);
+}
+
+gboolean
+config_edit_key (GString    *contents,
+                 const char *key,
+                 const char *value,
+                 gboolean    append)
+{
+        gsize     key_len;
+        gsize     new_len;
+        gsize     pos;
+        gboolean  found;
+        gboolean  changed;
+        char     *new_line;
+
+        key_len = strlen (key);
+        new_line = quote_value (key, value);
+        new_len = strlen (new_line);
+        found = FALSE;
+        changed = FALSE;
+
+        pos = 0;
+        while (pos < contents->len) {
+                const char *line;
+                const char *eol;
+                gsize       line_len;
+
+                line = contents->str + pos;
+                eol = memchr (line, '\n', contents->len - pos);
+                line_len = eol ? (gsize) (eol - line) : contents->len - pos;
+
+                if (line_len <= key_len ||
+                    strncmp (line, key, key_len) != 0 ||
+                    line[key_len] != '=') {
+                        pos += line_len + 1;
+                        continue;
+                }
+
+                found = TRUE;
+
+                if (new_len != line_len || memcmp (line, new_line, line_len) != 0) {
+                        g_string_erase (contents, pos, line_len);
+                        g_string_insert_len (contents, pos, new_line, new_len);
+                        changed = TRUE;
+                }
+
+                pos += new_len + 1;
+        }
+
+        if (!found && append) {
+                if (contents->len > 0 && contents->str[contents->len - 1] != '\n')
+                        g_string_append_c (contents, '\n');
+                g_string_append_len (contents, new_line, new_len);
+                g_string_append_c (contents, '\n');
+                changed = TRUE;
+        }
+
+        g_free (new_line);
+
+        return changed;
+}
+
+gboolean
+config_transaction_set_key (ConfigTransaction  *transaction,
+                            const char         *filename,
+                            const char         *key,
+                            const char         *value,
+                            gboolean            append,
+                            GError            **error)
+{
+        StagedFile *file;
+        const char *p;
+
+        /* A newline would start a line of the caller's choosing */
+        for (p = value; *p != '\0'; p++) {
+                if (g_ascii_iscntrl (*p)) {
+                        g_set_error (error, CONFIG_WRITER_ERROR,
+                                     CONFIG_WRITER_ERROR_INVALID,
+                                     "The value of %s has control characters",
+                                     key);
+                        return FALSE;
+                }
+        }
+
+        if (!append && !g_file_test (filename, G_FILE_TEST_IS_REGULAR))
+                return TRUE;
+
+        file = config_transaction_lookup (transaction, filename, error);
+        if (file == NULL)
+                return FALSE;
+
+        if (file->contents == NULL) {
+                if (!append)
+                        return TRUE;
+                file->contents = g_string_new (NULL);
+                g_clear_pointer (&file->link_target, g_free);
+        }
+
+        if (config_edit_key (file->contents, key, value, append))
+                file->changed = TRUE;
+
+        return TRUE;
+}
+
+gboolean
+config_transaction_set_contents (ConfigTransaction  *transaction,
+                                 const char         *filename,
+                                 const char         *contents,
+                                 gssize              length,
+                                 GError            **error)
+{
+        StagedFile *file;
+
+        file = config_transaction_lookup (transaction, filename, error);
+        if (file == NULL)
+                return FALSE;
+
+        if (length < 0)
+                length = strlen (contents);
+
+        if (file->contents == NULL)
+                file->contents = g_string_new (NULL);
+        g_string_truncate (file->contents, 0);
+        g_string_append_len (file->contents, contents, length);
+        g_clear_pointer (&file->link_target, g_free);
+        file->share_fd = -1;
+
+        /* Writing the same bytes over a regular file is a no-op */
+        file->changed = file->was_symlink ||
+                        !file->existed ||
+                        file->old_contents == NULL ||
+                        file->old_len != (gsize) length ||
+                        memcmp (file->old_contents, contents, length) != 0;
+
+        return TRUE;
+}
+
+gboolean
+config_transaction_set_contents_shared (ConfigTransaction  *transaction,
+                                        const char         *filename,
+                                        const char         *contents,
+                                        gssize              length,
+                                        int                 share_fd,
+                                        gboolean            share_link,
+                                        GError            **error)
+{
+        StagedFile *file;
+
+        if (!config_transaction_set_contents (transaction, filename,
+                                              contents, length, error))
+                return FALSE;
+
+        file = config_transaction_lookup (transaction, filename, error);
+        file->share_fd = share_fd;
+        file->share_link = share_link;
+
+        return TRUE;
+}
+
+gboolean
+config_transaction_set_symlink (ConfigTransaction  *transaction,
+                                const char         *filename,
+                                const char         *target,
+                                GError            **error)
+{
+        StagedFile *file;
+
+        file = config_transaction_lookup (transaction, filename, error);
+        if (file == NULL)
+                return FALSE;
+
+        if (file->contents != NULL) {
+                g_string_free (file->contents, TRUE);
+                file->contents = NULL;
+        }
+        g_free (file->link_target);
+        file->link_target = g_strdup (target);
+        file->share_fd = -1;
+
+        file->changed = !file->was_symlink ||
+                        g_strcmp0 (file->old_link, target) != 0;
+
+        return TRUE;
+}
+
+static char *
+make_tmp_path (const char *filename)
+{
+        char *dir, *base, *tmp_path;
+
+        dir = g_path_get_dirname (filename);
+        base = g_path_get_basename (filename);
+        tmp_path = g_strdup_printf ("%s/.%s.XXXXXX", dir, base);
+        g_free (dir);
+        g_free (base);
+
+        return tmp_path;
+}
+
+/* Write data, or a symlink to link_target, to a new file next to
+ * filename. Nothing is synced here. */
+static char *
+write_tmp (const char  *filename,
+           const char  *data,
+           gsize        len,
+           const char  *link_target,
+           mode_t       mode,
+           uid_t        uid,
+           gid_t        gid,
+           gboolean     chown_tmp,
+           GError     **error)
+{
+        char *tmp_path;
+        int   fd;
+        int   errsv;
+
+        tmp_path = make_tmp_path (filename);
+
+        fd = g_mkstemp_full (tmp_path, O_RDWR | O_CLOEXEC, mode);
+        if (fd < 0) {
+                errsv = errno;
+                goto error;
+        }
+
+        if (link_target != NULL) {
+                /* Reuse the unique name mkstemp found for the symlink */
+                close (fd);
+                if (g_unlink (tmp_path) != 0 ||
+                    symlink (link_target, tmp_path) != 0) {
+                        errsv = errno;
+                        goto error;
+                }
+                return tmp_path;
+        }
+
+        while (len > 0) {
+                gssize written;
+
+                written = write (fd, data, len);
+                if (written < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        errsv = errno;
+                        close (fd);
+                        g_unlink (tmp_path);
+                        goto error;
+                }
+                data += written;
+                len -= written;
+        }
+
+        /* mkstemp honours the umask */
+        if (fchmod (fd, mode) != 0)
+                g_debug ("Cannot set mode of %s: %s", tmp_path, g_strerror (errno));
+        if (chown_tmp && fchown (fd, uid, gid) != 0)
+                g_debug ("Cannot set owner of %s: %s", tmp_path, g_strerror (errno));
+
+        if (close (fd) != 0) {
+                errsv = errno;
+                g_unlink (tmp_path);
+                goto error;
+        }
+
+        return tmp_path;
+
+error:
+        g_set_error (error, CONFIG_WRITER_ERROR,
+                     CONFIG_WRITER_ERROR_WRITE,
+                     "%s cannot be overwritten: %s",
+                     filename, g_strerror (errsv));
+        g_free (tmp_path);
+        return NULL;
+}
+
+/* Make a new file next to filename out of share_fd's data, without
+ * copying it: a reflink, or a hard link with link. Fails, quietly, when
+ * the filesystems differ or can't do it, and write_tmp () is then used. */
+static char *
+share_tmp (const char *filename,
+           int         share_fd,
+           gboolean    link,
+           mode_t      mode,
+           uid_t       uid,
+           gid_t       gid,
+           gboolean    chown_tmp)
+{
+        char *tmp_path;
+        int   fd;
+
+        tmp_path = make_tmp_path (filename);
+
+        fd = g_mkstemp_full (tmp_path, O_RDWR | O_CLOEXEC, mode);
+        if (fd < 0)
+                goto error;
+
+        if (link) {
+                /* Reuse the unique name, as for symlinks. The link keeps
+                 * the mode and owner of share_fd's file. */
+                close (fd);
+                if (g_unlink (tmp_path) != 0 ||
+                    linkat (share_fd, "", AT_FDCWD, tmp_path, AT_EMPTY_PATH) != 0)
+                        goto error;
+                return tmp_path;
+        }
+
+#ifdef FICLONE
+        if (ioctl (fd, FICLONE, share_fd) == 0) {
+                if (fchmod (fd, mode) != 0)
+                        g_debug ("Cannot set mode of %s: %s", tmp_path, g_strerror (errno));
+                if (chown_tmp && fchown (fd, uid, gid) != 0)
+                        g_debug ("Cannot set owner of %s: %s", tmp_path, g_strerror (errno));
+                if (close (fd) == 0)
+                        return tmp_path;
+                g_unlink (tmp_path);
+                goto error;
+        }
+#endif
+
+        close (fd);
+        g_unlink (tmp_path);
+
+error:
+        g_free (tmp_path);
+        return NULL;
+}
+
+/* Put back whatever was at file->filename before the commit */
+static void
+staged_file_restore (StagedFile *file)
+{
+        char *tmp_path;
+
+        if (!file->existed) {
+                g_unlink (file->filename);
+                return;
+        }
+
+        if (file->old_contents == NULL && file->old_link == NULL) {
+                g_warning ("Cannot restore %s", file->filename);
+                return;
+        }
+
+        if (file->was_symlink && file->old_link != NULL)
+                tmp_path = write_tmp (file->filename, NULL, 0, file->old_link,
+                                      0777, 0, 0, FALSE, NULL);
+        else
+                tmp_path = write_tmp (file->filename, file->old_contents,
+                                      file->old_len, NULL, file->mode,
+                                      file->uid, file->gid, TRUE, NULL);
+
+        if (tmp_path == NULL || g_rename (tmp_path, file->filename) != 0) {
+                g_warning ("Cannot restore %s", file->filename);
+                if (tmp_path != NULL)
+                        g_unlink (tmp_path);
+        }
+        g_free (tmp_path);
+}
+
+static void
+close_dir (gpointer data)
+{
+        close (GPOINTER_TO_INT (data));
+}
+
+gboolean
+config_transaction_commit (ConfigTransaction  *transaction,
+                           GError            **error)
+{
+        GHashTable *dirs;
+        GHashTable *devices;
+        GHashTableIter iter;
+        gpointer    key, value;
+        gboolean    retval;
+        guint       i;
+
+        retval = FALSE;
+        dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, close_dir);
+        devices = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+
+        /* First, write every new file next to its target */
+        for (i = 0; i < transaction->files->len; i++) {
+                StagedFile  *file = g_ptr_array_index (transaction->files, i);
+                char        *dir;
+                struct stat  st;
+                int          fd;
+
+                if (!file->changed)
+                        continue;
+
+                if (file->link_target != NULL)
+                        file->tmp_path = write_tmp (file->filename, NULL, 0,
+                                                    file->link_target, 0777,
+                                                    0, 0, FALSE, error);
+                else {
+                        if (file->share_fd >= 0)
+                                file->tmp_path = share_tmp (file->filename,
+                                                            file->share_fd,
+                                                            file->share_link,
+                                                            file->mode, file->uid,
+                                                            file->gid, file->existed);
+                        if (file->tmp_path == NULL)
+                                file->tmp_path = write_tmp (file->filename,
+                                                            file->contents->str,
+                                                            file->contents->len,
+                                                            NULL, file->mode,
+                                                            file->uid, file->gid,
+                                                            file->existed, error);
+                }
+                if (file->tmp_path == NULL)
+                        goto out;
+
+                dir = g_path_get_dirname (file->filename);
+                if (g_hash_table_contains (dirs, dir)) {
+                        g_free (dir);
+                        continue;
+                }
+
+                fd = open (dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (fd < 0) {
+                        g_set_error (error, CONFIG_WRITER_ERROR,
+                                     CONFIG_WRITER_ERROR_SYNC,
+                                     "%s cannot be opened: %s",
+                                     dir, g_strerror (errno));
+                        g_free (dir);
+                        goto out;
+                }
+                g_hash_table_insert (dirs, dir, GINT_TO_POINTER (fd));
+
+                if (fstat (fd, &st) == 0) {
+                        gint64 *dev = g_new (gint64, 1);
+                        *dev = st.st_dev;
+                        g_hash_table_replace (devices, dev, GINT_TO_POINTER (fd));
+                }
+        }
+
+        /* Then make the data durable with one sync per filesystem, so that
+         * no rename below can expose a file whose data isn't on disk */
+        g_hash_table_iter_init (&iter, devices);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                if (syncfs (GPOINTER_TO_INT (value)) != 0) {
+                        g_set_error (error, CONFIG_WRITER_ERROR,
+                                     CONFIG_WRITER_ERROR_SYNC,
+                                     "Cannot sync filesystem: %s",
+                                     g_strerror (errno));
+                        goto out;
+                }
+        }
+
+        /* Swap the files in */
+        for (i = 0; i < transaction->files->len; i++) {
+                StagedFile *file = g_ptr_array_index (transaction->files, i);
+
+                if (file->tmp_path == NULL)
+                        continue;
+
+                if (g_rename (file->tmp_path, file->filename) != 0) {
+                        g_set_error (error, CONFIG_WRITER_ERROR,
+                                     CONFIG_WRITER_ERROR_WRITE,
+                                     "%s cannot be overwritten: %s",
+                                     file->filename, g_strerror (errno));
+                        goto out;
+                }
+                g_free (file->tmp_path);
+                file->tmp_path = NULL;
+                file->renamed = TRUE;
+        }
+
+        /* And persist the renames themselves */
+        g_hash_table_iter_init (&iter, dirs);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                if (fsync (GPOINTER_TO_INT (value)) != 0)
+                        g_debug ("Cannot sync %s: %s", (char *) key, g_strerror (errno));
+        }
+
+        retval = TRUE;
+
+out:
+        if (!retval) {
+                for (i = 0; i < transaction->files->len; i++) {
+                        StagedFile *file = g_ptr_array_index (transaction->files, i);
+
+                        if (file->renamed) {
+                                staged_file_restore (file);
+                                file->renamed = FALSE;
+                        }
+                        if (file->tmp_path != NULL) {
+                                g_unlink (file->tmp_path);
+                                g_free (file->tmp_path);
+                                file->tmp_path = NULL;
+                        }
+                }
+        }
+
+        g_hash_table_destroy (devices);
+        g_hash_table_destroy (dirs);
+
+        return retval;
+}
+
+gboolean
+config_write_key (const char  *filename,
+                  const char  *key,
+                  const char  *value,
+                  gboolean     append,
+                  GError     **error)
+{
+        ConfigTransaction *transaction;
+        gboolean           retval;
+
+        transaction = config_transaction_new ();
+        retval = config_transaction_set_key (transaction, filename, key, value,
+                                             append, error) &&
+                 config_transaction_commit (transaction, error);
+        config_transaction_free (transaction);
+
+        return retval;
+}
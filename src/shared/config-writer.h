@@ -0,0 +1,100 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __CONFIG_WRITER_H__
+#define __CONFIG_WRITER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define CONFIG_WRITER_ERROR config_writer_error_quark ()
+GQuark config_writer_error_quark (void);
+
+typedef enum
+{
+        CONFIG_WRITER_ERROR_READ,
+        CONFIG_WRITER_ERROR_WRITE,
+        CONFIG_WRITER_ERROR_SYNC,
+        CONFIG_WRITER_ERROR_INVALID
+} ConfigWriterError;
+
+/* A transaction collects edits to any number of files and applies them all
+ * at once: every new file is written next to its target, the affected
+ * filesystems are synced once, the files are renamed into place and their
+ * directories synced. If any step fails, the files already replaced are
+ * put back the way they were. */
+typedef struct _ConfigTransaction ConfigTransaction;
+
+ConfigTransaction *config_transaction_new          (void);
+void               config_transaction_free         (ConfigTransaction  *transaction);
+
+/* Replace the value of every "key=" line of an existing regular file. The
+ * call is a no-op when the file or the key doesn't exist, unless append is
+ * set, in which case the line (and the file) is created. A value with
+ * control characters in it is refused. */
+gboolean           config_transaction_set_key      (ConfigTransaction  *transaction,
+                                                    const char         *filename,
+                                                    const char         *key,
+                                                    const char         *value,
+                                                    gboolean            append,
+                                                    GError            **error);
+gboolean           config_transaction_set_contents (ConfigTransaction  *transaction,
+                                                    const char         *filename,
+                                                    const char         *contents,
+                                                    gssize              length,
+                                                    GError            **error);
+/* The same, for contents known to be those of the file open as share_fd:
+ * the new file then shares that file's data, as a reflink or, with
+ * share_link, a hard link, if they are on the same filesystem. share_fd
+ * must stay open until the commit. */
+gboolean           config_transaction_set_contents_shared (ConfigTransaction  *transaction,
+                                                           const char         *filename,
+                                                           const char         *contents,
+                                                           gssize              length,
+                                                           int                 share_fd,
+                                                           gboolean            share_link,
+                                                           GError            **error);
+gboolean           config_transaction_set_symlink  (ConfigTransaction  *transaction,
+                                                    const char         *filename,
+                                                    const char         *target,
+                                                    GError            **error);
+gboolean           config_transaction_commit       (ConfigTransaction  *transaction,
+                                                    GError            **error);
+
+/* Single key, single file transaction */
+gboolean           config_write_key                (const char         *filename,
+                                                    const char         *key,
+                                                    const char         *value,
+                                                    gboolean            append,
+                                                    GError            **error);
+
+/* Edit the "key=" lines of a buffer in place, leaving every other byte
+ * alone. The value is written in double quotes, with '"', '\\', '$' and
+ * '`' escaped, so the file still reads the same to a shell. Returns TRUE
+ * if the buffer changed. */
+gboolean           config_edit_key                 (GString            *contents,
+                                                    const char         *key,
+                                                    const char         *value,
+                                                    gboolean            append);
+
+G_END_DECLS
+
+#endif /* __CONFIG_WRITER_H__ */
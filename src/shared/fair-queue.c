@@ -0,0 +1,358 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+
+#include "fair-queue.h"
+
+/* Clients with nothing going on are forgotten once there are this many */
+#define PRUNE_THRESHOLD 128
+
+typedef struct
+{
+        FairQueueFunc  func;
+        gpointer       user_data;
+} Pending;
+
+typedef struct
+{
+        char     *name;
+        double    tokens;
+        gint64    stamp;
+        GQueue    pending;
+        gboolean  in_ring;
+} Client;
+
+struct _FairQueue
+{
+        GMutex               lock;
+
+        double               rate;
+        double               burst;
+        double               total_rate;
+        double               total_burst;
+        double               total_tokens;
+        gint64               total_stamp;
+
+        GHashTable          *clients;
+        /* Clients with requests waiting, in serving order */
+        GQueue               ring;
+
+        GMainContext        *context;
+        GSource             *timer;
+        FairQueueFunc        drop;
+
+        FairQueueStatistics  statistics;
+};
+
+static void
+client_free (gpointer data)
+{
+        Client *client = data;
+
+        g_queue_foreach (&client->pending, (GFunc) g_free, NULL);
+        g_queue_clear (&client->pending);
+        g_free (client->name);
+        g_free (client);
+}
+
+FairQueue *
+fair_queue_new (double        rate,
+                guint         burst,
+                double        total_rate,
+                FairQueueFunc drop)
+{
+        FairQueue *queue;
+
+        queue = g_new0 (FairQueue, 1);
+        g_mutex_init (&queue->lock);
+
+        queue->rate = MAX (rate, 0.0);
+        queue->burst = MAX (burst, 1);
+        queue->total_rate = MAX (total_rate, 0.0);
+        queue->total_burst = MAX (queue->burst, queue->total_rate);
+        queue->total_tokens = queue->total_burst;
+        queue->total_stamp = g_get_monotonic_time ();
+
+        queue->clients = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, client_free);
+        g_queue_init (&queue->ring);
+        queue->context = g_main_context_ref_thread_default ();
+        queue->drop = drop;
+
+        return queue;
+}
+
+void
+fair_queue_free (FairQueue *queue)
+{
+        Client *client;
+        Pending *pending;
+
+        if (queue->timer != NULL) {
+                g_source_destroy (queue->timer);
+                g_source_unref (queue->timer);
+        }
+
+        while ((client = g_queue_pop_head (&queue->ring)) != NULL) {
+                while ((pending = g_queue_pop_head (&client->pending)) != NULL) {
+                        queue->drop (pending->user_data);
+                        g_free (pending);
+                }
+        }
+
+        g_queue_clear (&queue->ring);
+        g_hash_table_unref (queue->clients);
+        g_main_context_unref (queue->context);
+        g_mutex_clear (&queue->lock);
+        g_free (queue);
+}
+
+static void
+bucket_refill (double *tokens,
+               gint64 *stamp,
+               double  rate,
+               double  burst,
+               gint64  now)
+{
+        if (rate > 0)
+                *tokens = MIN (burst, *tokens + (now - *stamp) * rate / G_USEC_PER_SEC);
+        *stamp = now;
+}
+
+static gboolean
+bucket_has_token (double tokens,
+                  double rate)
+{
+        return rate <= 0 || tokens >= 1.0;
+}
+
+/* In seconds */
+static double
+bucket_wait (double tokens,
+             double rate)
+{
+        return bucket_has_token (tokens, rate) ? 0.0 : (1.0 - tokens) / rate;
+}
+
+static void
+refill (FairQueue *queue,
+        Client    *client,
+        gint64     now)
+{
+        bucket_refill (&client->tokens, &client->stamp, queue->rate, queue->burst, now);
+        bucket_refill (&queue->total_tokens, &queue->total_stamp,
+                       queue->total_rate, queue->total_burst, now);
+}
+
+static gboolean
+can_run (FairQueue *queue,
+         Client    *client)
+{
+        return bucket_has_token (client->tokens, queue->rate) &&
+               bucket_has_token (queue->total_tokens, queue->total_rate);
+}
+
+static void
+take_token (FairQueue *queue,
+            Client    *client)
+{
+        if (queue->rate > 0)
+                client->tokens -= 1.0;
+        if (queue->total_rate > 0)
+                queue->total_tokens -= 1.0;
+}
+
+static void
+prune (FairQueue *queue,
+       gint64     now)
+{
+        GHashTableIter iter;
+        Client *client;
+
+        if (g_hash_table_size (queue->clients) < PRUNE_THRESHOLD)
+                return;
+
+        g_hash_table_iter_init (&iter, queue->clients);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &client)) {
+                if (client->in_ring)
+                        continue;
+                bucket_refill (&client->tokens, &client->stamp, queue->rate, queue->burst, now);
+                if (client->tokens >= queue->burst)
+                        g_hash_table_iter_remove (&iter);
+        }
+}
+
+static gboolean dispatch_cb (gpointer user_data);
+
+/* Called locked, whenever the ring changed */
+static void
+schedule (FairQueue *queue)
+{
+        GList *l;
+        double wait, client_wait;
+
+        if (queue->timer != NULL) {
+                g_source_destroy (queue->timer);
+                g_source_unref (queue->timer);
+                queue->timer = NULL;
+        }
+
+        if (g_queue_is_empty (&queue->ring))
+                return;
+
+        /* The first client to get a token, if there's a shared token */
+        client_wait = G_MAXDOUBLE;
+        for (l = queue->ring.head; l != NULL; l = l->next) {
+                Client *client = l->data;
+
+                client_wait = MIN (client_wait, bucket_wait (client->tokens, queue->rate));
+        }
+        wait = MAX (client_wait, bucket_wait (queue->total_tokens, queue->total_rate));
+
+        queue->timer = g_timeout_source_new ((guint) (wait * 1000) + (wait > 0));
+        g_source_set_callback (queue->timer, dispatch_cb, queue, NULL);
+        g_source_attach (queue->timer, queue->context);
+}
+
+static gboolean
+dispatch_cb (gpointer user_data)
+{
+        FairQueue *queue = user_data;
+        GQueue ready = G_QUEUE_INIT;
+        Pending *pending;
+        gboolean progress;
+        gint64 now;
+        guint n;
+
+        g_mutex_lock (&queue->lock);
+
+        /* Unless another thread just replaced it */
+        if (queue->timer == g_main_current_source ()) {
+                g_source_unref (queue->timer);
+                queue->timer = NULL;
+        }
+
+        /* One request per client and pass, until nobody can run */
+        now = g_get_monotonic_time ();
+        do {
+                progress = FALSE;
+                for (n = queue->ring.length; n > 0; n--) {
+                        Client *client = g_queue_pop_head (&queue->ring);
+
+                        refill (queue, client, now);
+                        if (can_run (queue, client)) {
+                                take_token (queue, client);
+                                g_queue_push_tail (&ready, g_queue_pop_head (&client->pending));
+                                queue->statistics.queued--;
+                                progress = TRUE;
+                        }
+
+                        if (g_queue_is_empty (&client->pending))
+                                client->in_ring = FALSE;
+                        else
+                                g_queue_push_tail (&queue->ring, client);
+                }
+        } while (progress && !g_queue_is_empty (&queue->ring));
+
+        schedule (queue);
+
+        g_mutex_unlock (&queue->lock);
+
+        while ((pending = g_queue_pop_head (&ready)) != NULL) {
+                pending->func (pending->user_data);
+                g_free (pending);
+        }
+
+        return FALSE;
+}
+
+FairQueueVerdict
+fair_queue_admit (FairQueue     *queue,
+                  const char    *client_name,
+                  FairQueueFunc  func,
+                  gpointer       user_data)
+{
+        FairQueueVerdict verdict;
+        Client *client;
+        Pending *pending;
+        gint64 now;
+
+        g_mutex_lock (&queue->lock);
+
+        now = g_get_monotonic_time ();
+
+        client = g_hash_table_lookup (queue->clients, client_name);
+        if (client == NULL) {
+                prune (queue, now);
+
+                client = g_new0 (Client, 1);
+                client->name = g_strdup (client_name);
+                client->tokens = queue->burst;
+                client->stamp = now;
+                g_queue_init (&client->pending);
+                g_hash_table_insert (queue->clients, client->name, client);
+        }
+
+        refill (queue, client, now);
+
+        /* With a shared limit, clients already waiting for it go first */
+        if (g_queue_is_empty (&client->pending) && can_run (queue, client) &&
+            (queue->total_rate <= 0 || g_queue_is_empty (&queue->ring))) {
+                take_token (queue, client);
+                queue->statistics.admitted++;
+                verdict = FAIR_QUEUE_RUN;
+        } else if (client->pending.length >= queue->burst) {
+                queue->statistics.rejected++;
+                verdict = FAIR_QUEUE_REJECTED;
+        } else {
+                pending = g_new0 (Pending, 1);
+                pending->func = func;
+                pending->user_data = user_data;
+                g_queue_push_tail (&client->pending, pending);
+
+                if (!client->in_ring) {
+                        client->in_ring = TRUE;
+                        g_queue_push_tail (&queue->ring, client);
+                }
+
+                queue->statistics.throttled++;
+                queue->statistics.queued++;
+                schedule (queue);
+                verdict = FAIR_QUEUE_QUEUED;
+        }
+
+        g_mutex_unlock (&queue->lock);
+
+        return verdict;
+}
+
+void
+fair_queue_get_statistics (FairQueue           *queue,
+                           FairQueueStatistics *statistics)
+{
+        g_mutex_lock (&queue->lock);
+        *statistics = queue->statistics;
+        statistics->clients = g_hash_table_size (queue->clients);
+        g_mutex_unlock (&queue->lock);
+}
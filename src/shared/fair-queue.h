@@ -0,0 +1,76 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __FAIR_QUEUE_H__
+#define __FAIR_QUEUE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Admission control in front of method dispatch. Each client gets a token
+ * bucket refilled at rate tokens per second, holding at most burst tokens,
+ * and all clients share one more bucket refilled at total_rate. A request
+ * runs right away when both buckets have a token and nobody is waiting
+ * ahead of it. Otherwise it waits in its client's queue, and waiting
+ * clients are served round-robin, one request at a time, from the main
+ * context the queue was created in. A rate of 0 means no limit.
+ *
+ * Safe to use from any thread; functions are never called with the queue
+ * locked. */
+typedef struct _FairQueue FairQueue;
+
+typedef void (*FairQueueFunc) (gpointer user_data);
+
+typedef enum
+{
+        FAIR_QUEUE_RUN,         /* Go ahead, func won't be called */
+        FAIR_QUEUE_QUEUED,      /* func will be called when it's its turn */
+        FAIR_QUEUE_REJECTED     /* The client has burst requests waiting already */
+} FairQueueVerdict;
+
+typedef struct
+{
+        guint64 admitted;       /* Ran right away */
+        guint64 throttled;      /* Had to wait */
+        guint64 rejected;
+        guint   queued;         /* Waiting now */
+        guint   clients;        /* Being tracked */
+} FairQueueStatistics;
+
+/* drop is called instead of func for each request still waiting when the
+ * queue is freed, to answer it */
+FairQueue        *fair_queue_new            (double               rate,
+                                             guint                burst,
+                                             double               total_rate,
+                                             FairQueueFunc        drop);
+void              fair_queue_free           (FairQueue           *queue);
+
+FairQueueVerdict  fair_queue_admit          (FairQueue           *queue,
+                                             const char          *client,
+                                             FairQueueFunc        func,
+                                             gpointer             user_data);
+
+void              fair_queue_get_statistics (FairQueue           *queue,
+                                             FairQueueStatistics *statistics);
+
+G_END_DECLS
+
+#endif /* __FAIR_QUEUE_H__ */
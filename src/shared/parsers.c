@@ -0,0 +1,765 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "parsers.h"
+
+GQuark
+parse_error_quark (void)
+{
+        static GQuark ret = 0;
+
+        if (ret == 0)
+                ret = g_quark_from_static_string ("parse-error");
+
+        return ret;
+}
+
+static const char *
+line_end (const char *line)
+{
+        const char *end;
+
+        end = strchr (line, '\n');
+        return end != NULL ? end : line + strlen (line);
+}
+
+static void
+strip (const char **start,
+       const char **end)
+{
+        while (*start < *end && g_ascii_isspace (**start))
+                (*start)++;
+        while (*end > *start && g_ascii_isspace ((*end)[-1]))
+                (*end)--;
+}
+
+/* Stripped, unquoted value of a line, from just after the '='. FALSE if
+ * the value is quoted but not closed. */
+static gboolean
+line_value (const char  *value,
+            const char  *end,
+            const char **value_start,
+            const char **value_end,
+            gboolean    *quoted)
+{
+        const char *p;
+
+        strip (&value, &end);
+
+        *quoted = value < end && *value == '"';
+        if (*quoted) {
+                if (end - value < 2 || end[-1] != '"')
+                        return FALSE;
+                /* A closing quote after an odd run of backslashes is escaped */
+                for (p = end - 1; p > value + 1 && p[-1] == '\\'; p--)
+                        ;
+                if ((end - 1 - p) % 2 != 0)
+                        return FALSE;
+                value++;
+                end--;
+                strip (&value, &end);
+        }
+
+        *value_start = value;
+        *value_end = end;
+
+        return TRUE;
+}
+
+/* Inside double quotes, as in the shell, a backslash escapes the
+ * characters config_edit_key () escapes; anything else is taken as is */
+static char *
+value_dup (const char *value,
+           const char *end,
+           gboolean    quoted)
+{
+        char *ret, *q;
+
+        if (!quoted || memchr (value, '\\', end - value) == NULL)
+                return g_strndup (value, end - value);
+
+        ret = q = g_malloc (end - value + 1);
+        for (; value < end; value++) {
+                if (*value == '\\' && value + 1 < end && strchr ("\"\\$`", value[1]) != NULL)
+                        value++;
+                *q++ = *value;
+        }
+        *q = '\0';
+
+        return g_strstrip (ret);
+}
+
+char *
+parse_key_file_value (const char *contents,
+                      const char *key)
+{
+        const char *line, *end;
+        const char *found = NULL, *found_end = NULL;
+        const char *value, *value_end;
+        gboolean found_quoted = FALSE, quoted;
+        gsize key_len;
+
+        key_len = strlen (key);
+
+        /* Only the last match is copied */
+        for (line = contents; *line != '\0'; line = *end != '\0' ? end + 1 : end) {
+                end = line_end (line);
+
+                if ((gsize) (end - line) <= key_len ||
+                    line[key_len] != '=' ||
+                    strncmp (line, key, key_len) != 0)
+                        continue;
+
+                if (line_value (line + key_len + 1, end, &value, &value_end, &quoted)) {
+                        found = value;
+                        found_end = value_end;
+                        found_quoted = quoted;
+                }
+        }
+
+        return found != NULL ? value_dup (found, found_end, found_quoted) : NULL;
+}
+
+GHashTable *
+parse_env_file (const char *contents)
+{
+        GHashTable *values;
+        const char *line, *end, *eq;
+        const char *value, *value_end;
+        gboolean quoted;
+
+        values = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+        for (line = contents; *line != '\0'; line = *end != '\0' ? end + 1 : end) {
+                end = line_end (line);
+
+                eq = memchr (line, '=', end - line);
+                if (eq == NULL || eq == line)
+                        continue;
+
+                if (line_value (eq + 1, end, &value, &value_end, &quoted))
+                        g_hash_table_replace (values,
+                                              g_strndup (line, eq - line),
+                                              value_dup (value, value_end, quoted));
+        }
+
+        return values;
+}
+
+char *
+parse_zoneinfo_path (const char *filename,
+                     const char *zoneinfodir)
+{
+        gsize len;
+
+        len = strlen (zoneinfodir);
+        if (filename == NULL ||
+            strncmp (filename, zoneinfodir, len) != 0 ||
+            filename[len] != '/')
+                return NULL;
+
+        filename += len + 1;
+
+        /* Timezone data files also live under posix/ and right/ for some
+         * reason.
+         * FIXME: make sure accepting those files is valid. I think "posix" is
+         * okay, not sure about "right" */
+        if (g_str_has_prefix (filename, "posix/"))
+                filename += strlen ("posix/");
+        else if (g_str_has_prefix (filename, "right/"))
+                filename += strlen ("right/");
+
+        return g_strdup (filename);
+}
+
+gboolean
+parse_tz_name_is_valid (const char *tz)
+{
+        const char *c;
+
+        if (!tz)
+                return FALSE;
+
+        for (c = tz; *c != '\0'; c++) {
+                if (!(g_ascii_isalnum (*c) ||
+                      *c == '/' || *c == '-' || *c == '_'))
+                        return FALSE;
+        }
+
+        return TRUE;
+}
+
+gboolean
+parse_adjtime (const char     *contents,
+               ParsedAdjtime  *adjtime,
+               GError        **error)
+{
+        const char *lines[3];
+        const char *end, *mode, *mode_end;
+        char *p;
+        int i;
+
+        memset (adjtime, 0, sizeof (ParsedAdjtime));
+
+        lines[0] = contents;
+        for (i = 1; i < 3; i++) {
+                end = strchr (lines[i - 1], '\n');
+                if (end == NULL) {
+                        g_set_error (error, PARSE_ERROR, PARSE_ERROR_INVALID,
+                                     "Cannot parse /etc/adjtime");
+                        return FALSE;
+                }
+                lines[i] = end + 1;
+        }
+
+        /* Missing numbers are taken as 0, like hwclock does */
+        adjtime->drift = g_ascii_strtod (lines[0], &p);
+        adjtime->last_adjust = g_ascii_strtoll (p, &p, 10);
+        adjtime->adjust = g_ascii_strtod (p, &p);
+        adjtime->last_calibration = g_ascii_strtoll (lines[1], NULL, 10);
+
+        mode = lines[2];
+        mode_end = line_end (mode);
+        if (mode_end - mode == 3 && strncmp (mode, "UTC", 3) == 0) {
+                adjtime->utc = TRUE;
+        } else if (mode_end - mode == 5 && strncmp (mode, "LOCAL", 5) == 0) {
+                adjtime->utc = FALSE;
+        } else {
+                g_set_error (error, PARSE_ERROR, PARSE_ERROR_INVALID,
+                             "Expected UTC or LOCAL at line 3 of /etc/adjtime; found '%.*s'",
+                             (int) (mode_end - mode), mode);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+gboolean
+parse_proc_stat_start_time (const char  *contents,
+                            guint64     *start_time)
+{
+        const char *p;
+        char *end;
+        int i;
+
+        /* The command name may have anything in it, ')' included, so
+         * the fields are counted from the last one */
+        p = strrchr (contents, ')');
+        if (p == NULL)
+                return FALSE;
+
+        /* From the state, field 3, to the start time, field 22 */
+        for (i = 3; i <= 22; i++) {
+                p = strchr (p + 1, ' ');
+                if (p == NULL)
+                        return FALSE;
+        }
+
+        *start_time = g_ascii_strtoull (p + 1, &end, 10);
+
+        return end != p + 1 && (*end == ' ' || *end == '\n' || *end == '\0');
+}
+
+/* TZif */
+
+#define TZIF_HEADER_LEN 44
+
+typedef struct
+{
+        char     kind;          /* 'J', 'M', or 0 for a zero-based day */
+        int      day;
+        int      month;
+        int      week;
+        gint32   time;
+} PosixRule;
+
+typedef struct
+{
+        char      std[PARSE_TZ_ABBREV_LEN];
+        gint32    std_offset;
+        gboolean  has_dst;
+        char      dst[PARSE_TZ_ABBREV_LEN];
+        gint32    dst_offset;
+        PosixRule start;
+        PosixRule end;
+} PosixTz;
+
+static guint32
+be32 (const guchar *p)
+{
+        return ((guint32) p[0] << 24) | ((guint32) p[1] << 16) | ((guint32) p[2] << 8) | p[3];
+}
+
+static gint64
+be64 (const guchar *p)
+{
+        return (gint64) (((guint64) be32 (p) << 32) | be32 (p + 4));
+}
+
+/* Days since the epoch of a date in the proleptic Gregorian calendar */
+static gint64
+days_from_civil (gint64 year,
+                 int    month,
+                 int    day)
+{
+        gint64 era, yoe, doy;
+
+        if (month <= 2)
+                year--;
+        era = (year >= 0 ? year : year - 399) / 400;
+        yoe = year - era * 400;
+        doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+
+        return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+/* The year a time falls in, in UTC */
+static gint64
+year_from_time (gint64 t)
+{
+        gint64 days = t / 86400 - (t % 86400 < 0 ? 1 : 0);
+        gint64 era, doe, yoe, doy, mp;
+
+        days += 719468;
+        era = (days >= 0 ? days : days - 146096) / 146097;
+        doe = days - era * 146097;
+        yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        mp = (5 * doy + 2) / 153;
+
+        return yoe + era * 400 + (mp >= 10 ? 1 : 0);
+}
+
+static gboolean
+is_leap (gint64 year)
+{
+        return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static int
+month_days (gint64 year,
+            int    month)
+{
+        static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+        return month == 2 && is_leap (year) ? 29 : days[month - 1];
+}
+
+static gboolean
+posix_number (const char **p,
+              int          min,
+              int          max,
+              int         *value)
+{
+        const char *s = *p;
+        int n = 0;
+
+        if (!g_ascii_isdigit (*s))
+                return FALSE;
+        while (g_ascii_isdigit (*s) && n <= max)
+                n = n * 10 + (*s++ - '0');
+        if (n < min || n > max)
+                return FALSE;
+
+        *p = s;
+        *value = n;
+        return TRUE;
+}
+
+/* [+-]hh[:mm[:ss]], hours up to 167 as RFC 8536 allows for rule times */
+static gboolean
+posix_time (const char **p,
+            gint32      *seconds)
+{
+        const char *s = *p;
+        int sign = 1;
+        int h, m = 0, sec = 0;
+
+        if (*s == '+' || *s == '-')
+                sign = *s++ == '-' ? -1 : 1;
+        if (!posix_number (&s, 0, 167, &h))
+                return FALSE;
+        if (*s == ':') {
+                s++;
+                if (!posix_number (&s, 0, 59, &m))
+                        return FALSE;
+                if (*s == ':') {
+                        s++;
+                        if (!posix_number (&s, 0, 59, &sec))
+                                return FALSE;
+                }
+        }
+
+        *p = s;
+        *seconds = sign * (h * 3600 + m * 60 + sec);
+        return TRUE;
+}
+
+static gboolean
+posix_name (const char **p,
+            char        *name)
+{
+        const char *s = *p;
+        const char *start, *end;
+
+        if (*s == '<') {
+                start = ++s;
+                while (*s != '\0' && *s != '>')
+                        s++;
+                if (*s != '>')
+                        return FALSE;
+                end = s++;
+        } else {
+                start = s;
+                while (g_ascii_isalpha (*s))
+                        s++;
+                end = s;
+        }
+        if (end - start < 1)
+                return FALSE;
+
+        g_strlcpy (name, start, MIN (end - start + 1, PARSE_TZ_ABBREV_LEN));
+        *p = s;
+        return TRUE;
+}
+
+static gboolean
+posix_rule (const char **p,
+            PosixRule   *rule)
+{
+        const char *s = *p;
+
+        if (*s++ != ',')
+                return FALSE;
+
+        memset (rule, 0, sizeof (PosixRule));
+        if (*s == 'J') {
+                s++;
+                rule->kind = 'J';
+                if (!posix_number (&s, 1, 365, &rule->day))
+                        return FALSE;
+        } else if (*s == 'M') {
+                s++;
+                rule->kind = 'M';
+                if (!posix_number (&s, 1, 12, &rule->month) || *s++ != '.' ||
+                    !posix_number (&s, 1, 5, &rule->week) || *s++ != '.' ||
+                    !posix_number (&s, 0, 6, &rule->day))
+                        return FALSE;
+        } else if (!posix_number (&s, 0, 365, &rule->day)) {
+                return FALSE;
+        }
+
+        rule->time = 2 * 3600;
+        if (*s == '/') {
+                s++;
+                if (!posix_time (&s, &rule->time))
+                        return FALSE;
+        }
+
+        *p = s;
+        return TRUE;
+}
+
+/* std offset [dst [offset] [,start[/time],end[/time]]], with offsets west
+ * of Greenwich, see tzset(3) */
+static gboolean
+parse_posix_tz (const char *s,
+                PosixTz    *tz)
+{
+        gint32 west;
+
+        memset (tz, 0, sizeof (PosixTz));
+
+        if (!posix_name (&s, tz->std) || !posix_time (&s, &west))
+                return FALSE;
+        tz->std_offset = -west;
+
+        if (*s == '\0')
+                return TRUE;
+
+        if (!posix_name (&s, tz->dst))
+                return FALSE;
+        tz->has_dst = TRUE;
+        tz->dst_offset = tz->std_offset + 3600;
+        if (*s != ',' && *s != '\0') {
+                if (!posix_time (&s, &west))
+                        return FALSE;
+                tz->dst_offset = -west;
+        }
+
+        /* Without rules the dates are up to the implementation; zic
+         * always writes them */
+        return posix_rule (&s, &tz->start) && posix_rule (&s, &tz->end) && *s == '\0';
+}
+
+/* When a rule takes effect in a year, offset being that in effect before */
+static gint64
+posix_rule_time (const PosixRule *rule,
+                 gint64           year,
+                 gint32           offset)
+{
+        gint64 days, first;
+        int day, wday;
+
+        days = days_from_civil (year, 1, 1);
+        switch (rule->kind) {
+        case 'J':
+                /* Never counting February 29 */
+                days += rule->day - 1 + (is_leap (year) && rule->day >= 60 ? 1 : 0);
+                break;
+        case 'M':
+                first = days_from_civil (year, rule->month, 1);
+                wday = (int) (((first + 4) % 7 + 7) % 7);
+                day = 1 + (rule->day - wday + 7) % 7 + (rule->week - 1) * 7;
+                while (day > month_days (year, rule->month))
+                        day -= 7;
+                days = first + day - 1;
+                break;
+        default:
+                days += rule->day;
+                break;
+        }
+
+        return days * 86400 + rule->time - offset;
+}
+
+static gboolean
+posix_tz_is_dst (const PosixTz *tz,
+                 gint64         at)
+{
+        gint64 year, start, end;
+
+        if (!tz->has_dst)
+                return FALSE;
+
+        /* Rules are in local time */
+        year = year_from_time (at + tz->std_offset);
+        start = posix_rule_time (&tz->start, year, tz->std_offset);
+        end = posix_rule_time (&tz->end, year, tz->dst_offset);
+
+        /* Southern hemisphere zones start DST late in the year */
+        if (start < end)
+                return at >= start && at < end;
+        return at < end || at >= start;
+}
+
+static void
+posix_tz_offset (const PosixTz *tz,
+                 gint64         at,
+                 gint32        *offset,
+                 char          *abbrev)
+{
+        gboolean dst = posix_tz_is_dst (tz, at);
+
+        *offset = dst ? tz->dst_offset : tz->std_offset;
+        strcpy (abbrev, dst ? tz->dst : tz->std);
+}
+
+/* The first change of offset after 'after', if the offset there is
+ * 'offset'. Checking a year either side covers rules near the year's
+ * ends. */
+static void
+posix_tz_next (const PosixTz    *tz,
+               gint64            after,
+               gint32            offset,
+               ParsedTzifOffset *result)
+{
+        gint64 year, candidates[8], t;
+        gint32 o;
+        char abbrev[PARSE_TZ_ABBREV_LEN];
+        int i, j, n = 0;
+
+        result->next = PARSE_TZIF_NEVER;
+        if (!tz->has_dst)
+                return;
+
+        year = year_from_time (after);
+        for (i = -1; i <= 2; i++) {
+                candidates[n++] = posix_rule_time (&tz->start, year + i, tz->std_offset);
+                candidates[n++] = posix_rule_time (&tz->end, year + i, tz->dst_offset);
+        }
+
+        /* Few enough for an insertion sort */
+        for (i = 1; i < n; i++) {
+                t = candidates[i];
+                for (j = i; j > 0 && candidates[j - 1] > t; j--)
+                        candidates[j] = candidates[j - 1];
+                candidates[j] = t;
+        }
+
+        for (i = 0; i < n; i++) {
+                if (candidates[i] <= after)
+                        continue;
+                posix_tz_offset (tz, candidates[i], &o, abbrev);
+                if (o != offset) {
+                        result->next = candidates[i];
+                        result->next_offset = o;
+                        strcpy (result->next_abbrev, abbrev);
+                        return;
+                }
+        }
+}
+
+static void
+tzif_type (const guchar *types,
+           const char   *chars,
+           guint32       charcnt,
+           guint         type,
+           gint32       *offset,
+           char         *abbrev)
+{
+        const guchar *info = types + type * 6;
+        const char *name = chars + info[5];
+        gsize len;
+
+        *offset = (gint32) be32 (info);
+
+        /* The last one may lack its NUL */
+        len = MIN (strnlen (name, charcnt - info[5]), PARSE_TZ_ABBREV_LEN - 1);
+        memcpy (abbrev, name, len);
+        abbrev[len] = '\0';
+}
+
+gboolean
+parse_tzif (const guchar      *contents,
+            gsize              length,
+            gint64             at,
+            ParsedTzifOffset  *offset,
+            GError           **error)
+{
+        const guchar *p = contents;
+        const guchar *end = contents + length;
+        const guchar *times, *indices, *types;
+        const char *chars, *footer, *footer_end;
+        guint32 isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt;
+        gsize time_size = 4;
+        gsize block;
+        char *rule;
+        PosixTz tz;
+        gboolean has_tz = FALSE;
+        gint32 o;
+        char abbrev[PARSE_TZ_ABBREV_LEN];
+        guint32 i, j;
+
+        memset (offset, 0, sizeof (ParsedTzifOffset));
+        offset->next = PARSE_TZIF_NEVER;
+
+        for (;;) {
+                if (end - p < TZIF_HEADER_LEN || memcmp (p, "TZif", 4) != 0)
+                        goto invalid;
+
+                isutcnt = be32 (p + 20);
+                isstdcnt = be32 (p + 24);
+                leapcnt = be32 (p + 28);
+                timecnt = be32 (p + 32);
+                typecnt = be32 (p + 36);
+                charcnt = be32 (p + 40);
+
+                if (typecnt == 0 || typecnt > 256 || charcnt == 0 || charcnt > 256 || timecnt > 65536 ||
+                    leapcnt > 65536 || isutcnt > typecnt || isstdcnt > typecnt)
+                        goto invalid;
+
+                block = timecnt * time_size + timecnt + typecnt * 6 + charcnt +
+                        leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+                if ((gsize) (end - p) - TZIF_HEADER_LEN < block)
+                        goto invalid;
+
+                /* Version 2 and later repeat the data with 64-bit times */
+                if (time_size == 4 && p[4] >= '2') {
+                        p += TZIF_HEADER_LEN + block;
+                        time_size = 8;
+                        continue;
+                }
+                break;
+        }
+
+        times = p + TZIF_HEADER_LEN;
+        indices = times + timecnt * time_size;
+        types = indices + timecnt;
+        chars = (const char *) types + typecnt * 6;
+
+#define TIME(n) (time_size == 8 ? be64 (times + (n) * 8) : (gint64) (gint32) be32 (times + (n) * 4))
+
+        for (i = 0; i < timecnt; i++)
+                if (indices[i] >= typecnt || (i > 0 && TIME (i) <= TIME (i - 1)))
+                        goto invalid;
+        for (i = 0; i < typecnt; i++)
+                if (types[i * 6 + 5] >= charcnt)
+                        goto invalid;
+
+        if (time_size == 8) {
+                footer = (const char *) p + TZIF_HEADER_LEN + block;
+                if (footer < (const char *) end && *footer == '\n') {
+                        footer_end = memchr (footer + 1, '\n', (const char *) end - footer - 1);
+                        if (footer_end == NULL)
+                                goto invalid;
+                        if (footer_end > footer + 1) {
+                                rule = g_strndup (footer + 1, footer_end - footer - 1);
+                                has_tz = parse_posix_tz (rule, &tz);
+                                g_free (rule);
+                                if (!has_tz)
+                                        goto invalid;
+                        }
+                }
+        }
+
+        /* The first transition after 'at'. Before any, the first type
+         * applies; after all of them, the TZ rule does. */
+        for (i = 0; i < timecnt && TIME (i) <= at; i++)
+                ;
+
+        if (i == timecnt && has_tz) {
+                posix_tz_offset (&tz, at, &offset->offset, offset->abbrev);
+        } else {
+                tzif_type (types, chars, charcnt, i > 0 ? indices[i - 1] : 0,
+                           &offset->offset, offset->abbrev);
+        }
+
+        for (j = i; j < timecnt; j++) {
+                tzif_type (types, chars, charcnt, indices[j], &o, abbrev);
+                if (o != offset->offset) {
+                        offset->next = TIME (j);
+                        offset->next_offset = o;
+                        strcpy (offset->next_abbrev, abbrev);
+                        return TRUE;
+                }
+        }
+
+        if (has_tz)
+                posix_tz_next (&tz, timecnt > 0 ? MAX (at, TIME (timecnt - 1)) : at,
+                               offset->offset, offset);
+
+        return TRUE;
+
+invalid:
+        g_set_error (error, PARSE_ERROR, PARSE_ERROR_INVALID,
+                     "Cannot parse TZif data");
+        return FALSE;
+
+#undef TIME
+}
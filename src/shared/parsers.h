@@ -0,0 +1,106 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2019 Ataraxia Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __PARSERS_H__
+#define __PARSERS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Parsers for the small file formats the daemons read. They work on a
+ * buffer the caller has read, touch no files, and are benchmarked by
+ * src/bench/parse-bench. */
+
+#define PARSE_ERROR parse_error_quark ()
+GQuark parse_error_quark (void);
+
+typedef enum
+{
+        PARSE_ERROR_INVALID
+} ParseError;
+
+/* The value of the last "key=" line of a KEY=VALUE file, stripped of
+ * blanks and of double quotes around it, and with the backslash escapes
+ * config_edit_key () writes undone inside them. A quoted value missing
+ * its closing quote is skipped. NULL if the key isn't there. */
+char       *parse_key_file_value   (const char  *contents,
+                                    const char  *key);
+
+/* Every key of a KEY=VALUE file, by the same rules: key -> value */
+GHashTable *parse_env_file         (const char  *contents);
+
+/* The zone name of a file under zoneinfodir, or its posix/ and right/
+ * subdirectories; NULL for any other file */
+char       *parse_zoneinfo_path    (const char  *filename,
+                                    const char  *zoneinfodir);
+
+/* Whether tz only has the characters zone names are made of */
+gboolean    parse_tz_name_is_valid (const char  *tz);
+
+/* /etc/adjtime, see hwclock(8):
+ *   drift (seconds per day) last-adjustment (epoch) adjustment
+ *   last-calibration (epoch)
+ *   UTC or LOCAL */
+typedef struct
+{
+        double   drift;
+        gint64   last_adjust;
+        double   adjust;
+        gint64   last_calibration;
+        gboolean utc;
+} ParsedAdjtime;
+
+gboolean    parse_adjtime          (const char     *contents,
+                                    ParsedAdjtime  *adjtime,
+                                    GError        **error);
+
+/* The start time of a process, in clock ticks since boot, from its
+ * /proc/PID/stat, see proc(5). With the PID, it tells the process from
+ * any later one given the same PID. */
+gboolean    parse_proc_stat_start_time (const char  *contents,
+                                        guint64     *start_time);
+
+/* The UTC offset in effect at a given time, and the next time it changes,
+ * from a zone's TZif data, see tzfile(5). Past the transitions listed, the
+ * POSIX TZ rule at the end of version 2 and later files applies. Changes
+ * of abbreviation alone don't count. */
+#define PARSE_TZIF_NEVER G_MAXINT64
+#define PARSE_TZ_ABBREV_LEN 16
+
+typedef struct
+{
+        gint32   offset;
+        char     abbrev[PARSE_TZ_ABBREV_LEN];
+
+        gint64   next;          /* PARSE_TZIF_NEVER if the offset stays */
+        gint32   next_offset;
+        char     next_abbrev[PARSE_TZ_ABBREV_LEN];
+} ParsedTzifOffset;
+
+gboolean    parse_tzif             (const guchar      *contents,
+                                    gsize              length,
+                                    gint64             at,
+                                    ParsedTzifOffset  *offset,
+                                    GError           **error);
+
+G_END_DECLS
+
+#endif /* __PARSERS_H__ */